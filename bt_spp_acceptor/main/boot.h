@@ -0,0 +1,29 @@
+#ifndef MAIN_BOOT_H_
+#define MAIN_BOOT_H_
+
+#include "freertos/FreeRTOS.h"
+
+// Startup stages. Independent stages run in different tasks;
+// a stage that needs another one waits for it with boot_wait().
+typedef enum {
+	BOOT_NVS,
+	BOOT_BT,
+	BOOT_SPIFFS,
+	BOOT_PANEL,
+	BOOT_FONT,
+	BOOT_FIRST_PIXEL,
+	BOOT_CONNECTABLE,
+	BOOT_STAGE_MAX
+} boot_stage_t;
+
+#define BOOT_BIT(stage) (1 << (stage))
+
+// stages: BOOT_BIT() of every stage this project goes through.
+// The timeline is logged once all of them have ended.
+void boot_init(uint32_t stages);
+void boot_begin(boot_stage_t stage);
+// A stage that never began is a milestone, counted from reset
+void boot_end(boot_stage_t stage);
+void boot_wait(boot_stage_t stage);
+
+#endif /* MAIN_BOOT_H_ */
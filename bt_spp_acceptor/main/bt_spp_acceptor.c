@@ -16,6 +16,7 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "esp_bt.h"
 #include "esp_bt_main.h"
 #include "esp_gap_bt_api.h"
@@ -27,6 +28,20 @@
 #include "esp_spiffs.h"
 
 #include "cmd.h"
+#include "memplan.h"
+#include "button.h"
+#include "telemetry.h"
+#include "msgpool.h"
+#include "boot.h"
+#include "link.h"
+#include "coalesce.h"
+#include "mux.h"
+#include "reliable.h"
+#include "rpc.h"
+#include "probe.h"
+#include "record.h"
+#include "xfer.h"
+#include "ota.h"
 
 #define SPP_TAG "SPP_ACCEPTOR"
 #define SPP_SERVER_NAME "SPP_SERVER"
@@ -35,6 +50,9 @@
 static const esp_spp_mode_t esp_spp_mode = ESP_SPP_MODE_CB;
 
 QueueHandle_t xQueueCmd;
+#if CONFIG_XPT2046
+QueueHandle_t xQueueTouch;
+#endif
 
 #define CONFIG_STACK 1
 #define CONFIG_STICKC 0
@@ -42,6 +60,7 @@ QueueHandle_t xQueueCmd;
 #if CONFIG_STACK
 #include "ili9340.h"
 #include "fontx.h"
+#include "spiclock.h"
 #endif
 
 #if CONFIG_STICKC
@@ -59,7 +78,7 @@ QueueHandle_t xQueueCmd;
 #define DC_GPIO 27
 #define RESET_GPIO 33
 #define BL_GPIO 32
-#define MISO_GPIO -1
+#define MISO_GPIO 19
 #define XPT_CS_GPIO  -1
 #define XPT_IRQ_GPIO  -1
 #define DISPLAY_LENGTH 26
@@ -76,16 +95,141 @@ QueueHandle_t xQueueCmd;
 #define GPIO_INPUT_B GPIO_NUM_39
 #endif
 
+// A plain SPP terminal gets "ok" for every write, an initiator an ACK frame
 #define SPP_ACK_LEN 2
 static uint8_t spp_ack[SPP_ACK_LEN]  = {'o', 'k'};
+// Capabilities accepted from initiators
+#define LINK_CAPS (LINK_CAP_LZ | LINK_CAP_STAMP)
+// Button B asks the initiator for its state
+#define QUERY_TIMEOUT_MS 3000
+
+// Render scheduler
+// When lines arrive faster than the panel can draw them,
+// only the last lines that fit in one frame are drawn.
+#define FRAME_BUDGET_MS 100
+#define MAX_LINES 16
+
+// Lines that did not reach the display queue
+static portMUX_TYPE skipMux = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t skipLines = 0;
 
 
 static const esp_spp_sec_t sec_mask = ESP_SPP_SEC_AUTHENTICATE;
 static const esp_spp_role_t role_slave = ESP_SPP_ROLE_SLAVE;
 
+static bool sppWrite(uint32_t sppHandle, const uint8_t *data, size_t length)
+{
+	esp_err_t ret = esp_spp_write(sppHandle, length, (uint8_t *)data);
+	if (ret == ESP_OK) return true;
+	// No ESP_SPP_WRITE_EVT returns the credit and the peer misses part of
+	// the stream. The link starts over, CLOSE_EVT clears the queues.
+	ESP_LOGE(SPP_TAG, "esp_spp_write %d bytes failed: %s", (int)length, esp_err_to_name(ret));
+	esp_spp_disconnect(sppHandle);
+	return false;
+}
+
+// Hands one line to the display.
+// The payload is copied once, into the pool, and handed over by pointer.
+// stamp is NULL for a plain SPP terminal.
+static void sppLine(uint32_t sppHandle, const uint8_t *data, size_t length, const RELIABLE_STAMP_t *stamp)
+{
+	// A record is kept whole and formatted when it is drawn
+	size_t limit = record_is(data, length) ? RECORD_MAX : DISPLAY_LENGTH;
+	if (length > limit) length = limit;
+	uint32_t upstream = stamp ? probe_receive(stamp) : 0;
+	CMD_t *cmd = msgpool_alloc(CMD_RECEIVE, length+1);
+	if (cmd != NULL) {
+		cmd->sppHandle = sppHandle;
+		cmd->upstream = upstream;
+		cmd->length = length;
+		memcpy(cmd->payload, data, length);
+		cmd->payload[length] = 0;
+	}
+	if (telemetry_send(xQueueCmd, cmd, 0) != pdTRUE) {
+		taskENTER_CRITICAL(&skipMux);
+		skipLines++;
+		taskEXIT_CRITICAL(&skipMux);
+	}
+}
+
+// Frames from an initiator, DATA already decompressed
+static void sppFrame(uint32_t sppHandle, uint8_t type, const uint8_t *payload, size_t length)
+{
+	if (type == FRAME_SYNC) {
+		reliable_sync(sppHandle, payload, length);
+	} else if ((type & FRAME_TYPE_MASK) == FRAME_DATA) {
+		// Every message is acked here, even if the display can't keep up.
+		// A message sent again after a reconnect is acked but not shown twice.
+		RELIABLE_STAMP_t stamp;
+		const uint8_t *message = reliable_receive(sppHandle, type, payload, &length, &stamp);
+		if (message) sppLine(sppHandle, message, length, &stamp);
+	} else if (type == FRAME_REQUEST || type == FRAME_RESPONSE) {
+		rpc_receive(sppHandle, type, payload, length);
+	} else if (type == FRAME_FILE || type == FRAME_CHUNK) {
+		xfer_rx_receive(sppHandle, type, payload, length);
+	}
+}
+
+// From the xfer task after every block
+static void xferProgress(const XFER_PROGRESS_t *progress)
+{
+	telemetry_send(xQueueCmd, msgpool_alloc(CMD_XFER, 0), 0);
+}
+
+// Answer to one query, as a line for the display.
+// Runs in the BTC task, or in the tft task for a timeout.
+static void queryDone(void *ctx, rpc_method_t method, rpc_status_t status, const uint8_t *result, size_t length)
+{
+	static const char * statusName[] = {"ok", "unknown", "failed", "timeout", "closed"};
+	char line[48];
+	if (status != RPC_OK) {
+		snprintf(line, sizeof(line), "%s %s", (char *)ctx, statusName[status]);
+	} else if (method == RPC_COUNTERS && length >= 28) {
+		snprintf(line, sizeof(line), "rx%"PRIu32" tx%"PRIu32" rt%"PRIu32,
+			frame_get32(&result[0]), frame_get32(&result[4]), frame_get32(&result[20]));
+	} else if (method == RPC_BATTERY && length >= 13) {
+		snprintf(line, sizeof(line), "bat %umV %"PRId32"mA%s", frame_get16(&result[0]),
+			(int32_t)frame_get32(&result[2]) / 1000, result[6] ? " usb" : "");
+	} else if (method == RPC_CONFIG && length >= 6) {
+		snprintf(line, sizeof(line), "%"PRIu32"ms win%d caps%02x",
+			frame_get32(&result[0]), result[4], result[5]);
+	} else {
+		snprintf(line, sizeof(line), "%s %d bytes", (char *)ctx, (int)length);
+	}
+	size_t lineLength = strlen(line);
+	if (lineLength > DISPLAY_LENGTH) lineLength = DISPLAY_LENGTH;
+	CMD_t *cmd = msgpool_alloc(CMD_RESULT, lineLength+1);
+	if (cmd != NULL) {
+		cmd->length = lineLength;
+		memcpy(cmd->payload, line, lineLength);
+		cmd->payload[lineLength] = 0;
+	}
+	telemetry_send(xQueueCmd, cmd, 0);
+}
+
+// All queries go out at once, the answers come back in any order
+static void query(uint32_t sppHandle)
+{
+	static const struct {
+		rpc_method_t method;
+		char * name;
+	} queries[] = {
+		{RPC_COUNTERS, "counters"},
+		{RPC_BATTERY, "battery"},
+		{RPC_CONFIG, "config"},
+	};
+	if (sppHandle == 0 || link_framed() == false) return;
+	for (int i=0;i<sizeof(queries)/sizeof(queries[0]);i++) {
+		if (rpc_call(sppHandle, queries[i].method, NULL, 0, QUERY_TIMEOUT_MS, queryDone, queries[i].name) < 0) {
+			ESP_LOGW(SPP_TAG, "too many calls pending");
+			break;
+		}
+	}
+}
+
 static void esp_spp_cb(esp_spp_cb_event_t event, esp_spp_cb_param_t *param)
 {
-	CMD_t cmdBuf;
+	CMD_t *cmd;
 	switch (event) {
 	case ESP_SPP_INIT_EVT:
 		ESP_LOGI(SPP_TAG, "ESP_SPP_INIT_EVT");
@@ -105,37 +249,47 @@ static void esp_spp_cb(esp_spp_cb_event_t event, esp_spp_cb_param_t *param)
 		break;
 	case ESP_SPP_CLOSE_EVT:
 		ESP_LOGI(SPP_TAG, "ESP_SPP_CLOSE_EVT");
-		cmdBuf.command = CMD_CLOSE;
-		xQueueSend(xQueueCmd, &cmdBuf, 0);
+		telemetry_send(xQueueCmd, msgpool_alloc(CMD_CLOSE, 0), 0);
+		link_close();
+		mux_close();
+		coalesce_close();
+		rpc_close();
+		probe_close();
+		xfer_rx_close();
 		break;
 	case ESP_SPP_START_EVT:
 		ESP_LOGI(SPP_TAG, "ESP_SPP_START_EVT");
+		boot_end(BOOT_CONNECTABLE);
 		break;
 	case ESP_SPP_CL_INIT_EVT:
 		ESP_LOGI(SPP_TAG, "ESP_SPP_CL_INIT_EVT");
 		break;
 	case ESP_SPP_DATA_IND_EVT:
-		ESP_LOGI(SPP_TAG, "ESP_SPP_DATA_IND_EVT len=%d handle=%"PRIu32,
+		// Per packet, at INFO the console would hold up the BTC task
+		ESP_LOGD(SPP_TAG, "ESP_SPP_DATA_IND_EVT len=%d handle=%"PRIu32,
 				 param->data_ind.len, param->data_ind.handle);
-		ESP_LOG_BUFFER_HEXDUMP(__FUNCTION__, param->data_ind.data, param->data_ind.len, ESP_LOG_INFO);
-
-		cmdBuf.sppHandle = param->data_ind.handle;
-		cmdBuf.command = CMD_RECEIVE;
-		strcpy((char *)cmdBuf.payload, (char *)param->data_ind.data);
-		cmdBuf.payload[param->data_ind.len] = 0;
-		cmdBuf.length = param->data_ind.len;
-		xQueueSend(xQueueCmd, &cmdBuf, 0);
+		ESP_LOG_BUFFER_HEXDUMP(__FUNCTION__, param->data_ind.data, param->data_ind.len, ESP_LOG_DEBUG);
+		telemetry_rx(param->data_ind.len);
+
+		// Frames go through the link layer, which calls sppFrame
+		if (link_receive(param->data_ind.handle, param->data_ind.data, param->data_ind.len)) break;
+		mux_write(param->data_ind.handle, spp_ack, SPP_ACK_LEN);
+		sppLine(param->data_ind.handle, param->data_ind.data, param->data_ind.len, NULL);
 		break;
 	case ESP_SPP_CONG_EVT:
 		ESP_LOGI(SPP_TAG, "ESP_SPP_CONG_EVT");
+		if (param->cong.cong) telemetry_congestion();
 		break;
 	case ESP_SPP_WRITE_EVT:
-		ESP_LOGI(SPP_TAG, "ESP_SPP_WRITE_EVT");
+		ESP_LOGD(SPP_TAG, "ESP_SPP_WRITE_EVT");
+		if (param->write.status == ESP_SPP_SUCCESS) telemetry_tx(param->write.len);
+		mux_write_done(param->write.len);
 		break;
 	case ESP_SPP_SRV_OPEN_EVT:
 		ESP_LOGI(SPP_TAG, "ESP_SPP_SRV_OPEN_EVT");
-		cmdBuf.command = CMD_OPEN;
-		xQueueSend(xQueueCmd, &cmdBuf, 0);
+		cmd = msgpool_alloc(CMD_OPEN, 0);
+		if (cmd != NULL) cmd->sppHandle = param->srv_open.handle;
+		telemetry_send(xQueueCmd, cmd, 0);
 		break;
 	default:
 		break;
@@ -193,14 +347,165 @@ void esp_bt_gap_cb(esp_bt_gap_cb_event_t event, esp_bt_gap_cb_param_t *param)
 	return;
 }
 
+typedef struct {
+	uint16_t lines;
+	uint16_t ymax;
+	uint16_t fontHeight;
+	uint16_t vsp;
+	uint16_t ypos;
+	uint16_t current;
+} SCROLL_t;
+
+// Draw one line at the bottom of the scroll area
+static void drawLine(TFT_t * dev, FontxFile *fx, SCROLL_t * sc, uint8_t * text, uint16_t color)
+{
+	if (sc->current < sc->lines) {
+		lcdDrawString(dev, fx, 0, sc->ypos, text, color);
+	} else {
+		lcdDrawFillRect(dev, 0, sc->ypos-sc->fontHeight, SCREEN_WIDTH-1, sc->ypos, BLACK);
+		lcdSetScrollArea(dev, sc->fontHeight, (SCREEN_HEIGHT-sc->fontHeight), 0);
+		lcdScroll(dev, sc->vsp);
+		sc->vsp = sc->vsp + sc->fontHeight;
+		if (sc->vsp > sc->ymax) sc->vsp = sc->fontHeight*2;
+		lcdDrawString(dev, fx, 0, sc->ypos, text, color);
+	}
+	sc->current++;
+	sc->ypos = sc->ypos + sc->fontHeight;
+	if (sc->ypos > sc->ymax) sc->ypos = (sc->fontHeight*2) - 1;
+}
+
+// A received line. Records are turned into text here, in the small font
+// that has room for all of their fields.
+static void drawMessage(TFT_t * dev, FontxFile *fxM, FontxFile *fxS, SCROLL_t * sc, CMD_t *cmd)
+{
+	if (record_is(cmd->payload, cmd->length) == false) {
+		drawLine(dev, fxM, sc, cmd->payload, CYAN);
+		return;
+	}
+	RECORD_t rec;
+	char line[RECORD_LINE];
+	if (record_decode(cmd->payload, cmd->length, &rec)) {
+		record_format(&rec, line, sizeof(line));
+	} else {
+		strcpy(line, "bad record");
+	}
+	drawLine(dev, fxS, sc, (uint8_t *)line, CYAN);
+}
+
+// Transfer bar, rate and time left in place of the connection state
+#define PROGRESS_BAR 60
+static void drawProgress(TFT_t * dev, FontxFile *fx, uint16_t xstatus, uint8_t fontHeight, const XFER_PROGRESS_t *progress)
+{
+	uint16_t width = PROGRESS_BAR - 2;
+	uint16_t done = progress->size ? (uint64_t)progress->offset * width / progress->size : width;
+	lcdDrawRect(dev, xstatus, 2, xstatus+PROGRESS_BAR-1, fontHeight-3, WHITE);
+	if (done) lcdDrawFillRect(dev, xstatus+1, 3, xstatus+done, fontHeight-4, GREEN);
+	if (done < width) lcdDrawFillRect(dev, xstatus+1+done, 3, xstatus+PROGRESS_BAR-2, fontHeight-4, BLACK);
+
+	uint32_t eta = 0;
+	if (progress->bytesPerSec) eta = (progress->size - progress->offset) / progress->bytesPerSec;
+	char text[16];
+	snprintf(text, sizeof(text), "%"PRIu32"K %"PRIu32"s", progress->bytesPerSec / 1024, eta);
+	lcdDrawFillRect(dev, xstatus+PROGRESS_BAR, 0, SCREEN_WIDTH-1, fontHeight-1, BLACK);
+	lcdDrawString(dev, fx, xstatus+PROGRESS_BAR+4, fontHeight-4, (uint8_t *)text, WHITE);
+}
+
+// Telemetry page in two columns below the status line
+static void drawStats(TFT_t * dev, FontxFile *fx, uint8_t fontHeight, uint8_t statsHeight)
+{
+	TELEMETRY_t t;
+	telemetry_get(&t);
+	int rows = (SCREEN_HEIGHT - fontHeight) / statsHeight;
+	char lines[rows*2][TELEMETRY_LINE];
+	int num = telemetry_format(&t, lines, rows*2);
+	num += probe_format(&lines[num], rows*2 - num);
+	lcdDrawFillRect(dev, 0, fontHeight, SCREEN_WIDTH-1, SCREEN_HEIGHT-1, BLACK);
+	for (int i=0;i<num;i++) {
+		uint16_t xpos = (i / rows) * (SCREEN_WIDTH / 2);
+		uint16_t ypos = fontHeight + ((i % rows) + 1) * statsHeight - 1;
+		lcdDrawString(dev, fx, xpos, ypos, (uint8_t *)lines[i], GREEN);
+	}
+}
+
+#if CONFIG_STACK
+// SPI clock calibration of the panel
+static bool panelSetClock(void *dev, int hz)
+{
+	return spi_master_set_clock(dev, hz);
+}
+
+static void panelFill(void *dev)
+{
+	lcdFillScreen(dev, BLACK);
+}
+
+static bool panelVerify(void *dev)
+{
+	// A new pattern every round, so a write that never lands can't pass
+	static uint16_t seed = 0x5AA5;
+	uint16_t pattern[TFT_READ_MAX];
+	uint16_t readback[TFT_READ_MAX];
+	seed = seed * 75 + 74;
+	for (int i=0;i<TFT_READ_MAX;i++) pattern[i] = (i & 1) ? seed : ~seed;
+	lcdDrawMultiPixels(dev, 0, 0, TFT_READ_MAX, pattern);
+	if (lcdReadPixels(dev, 0, 0, TFT_READ_MAX, readback) == false) return false;
+	return memcmp(pattern, readback, sizeof(pattern)) == 0;
+}
+
+static void panelCalibrate(TFT_t * dev)
+{
+	SPICLOCK_PANEL_t panel = {
+		.name = "ili9341",
+		.dev = dev,
+		.candidates = {SPI_MASTER_FREQ_20M, SPI_MASTER_FREQ_26M, SPI_MASTER_FREQ_40M},
+		.set_clock = panelSetClock,
+		.verify = NULL,
+		.fill = panelFill,
+	};
+	// 80MHz only when readback can prove it
+	uint16_t color;
+	if (lcdReadPixels(dev, 0, 0, 1, &color)) {
+		panel.candidates[3] = SPI_MASTER_FREQ_80M;
+		panel.verify = panelVerify;
+	}
+	spiclock_calibrate(&panel);
+	lcdFillScreen(dev, BLACK);
+}
+#endif
+
 void tft(void *pvParameters)
 {
 	ESP_LOGI(pcTaskGetName(NULL), "Start");
+
+	// Setup Screen
+	// This runs while app_main brings up BT and SPIFFS
+	boot_begin(BOOT_PANEL);
+	TFT_t dev;
+	//spi_master_init(&dev, CS_GPIO, DC_GPIO, RESET_GPIO, BL_GPIO);
+	spi_master_init(&dev, MOSI_GPIO, SCLK_GPIO, TFT_CS_GPIO, DC_GPIO,
+		RESET_GPIO, BL_GPIO, MISO_GPIO, XPT_CS_GPIO, XPT_IRQ_GPIO);
+	lcdInit(&dev, 0x9341, SCREEN_WIDTH, SCREEN_HEIGHT, 0, 0);
+	ESP_LOGI(pcTaskGetName(NULL), "Setup Screen done");
+	boot_end(BOOT_PANEL);
+
+	// Initial Screen
+	lcdFillScreen(&dev, BLACK);
+	lcdSetFontDirection(&dev, 0);
+	boot_end(BOOT_FIRST_PIXEL);
+
+	// The clock is stored in NVS once probed
+	boot_wait(BOOT_NVS);
+	panelCalibrate(&dev);
+
 	// set font file
+	boot_wait(BOOT_SPIFFS);
+	boot_begin(BOOT_FONT);
 	FontxFile fxG[2];
 	InitFontx(fxG,"/spiffs/ILGH24XB.FNT",""); // 12x24Dot Gothic
 	FontxFile fxM[2];
 	InitFontx(fxM,"/spiffs/ILMH24XB.FNT",""); // 12x24Dot Mincyo
+	FontxFile fxS[2];
+	InitFontx(fxS,"/spiffs/ILGH16XB.FNT",""); // 8x16Dot Gothic
 
 	// get font width & height
 	uint8_t buffer[FontxGlyphBufSize];
@@ -208,24 +513,25 @@ void tft(void *pvParameters)
 	uint8_t fontHeight;
 	GetFontx(fxG, 0, buffer, &fontWidth, &fontHeight);
 	ESP_LOGI(pcTaskGetName(NULL), "fontWidth=%d fontHeight=%d",fontWidth,fontHeight);
-
-	// Setup Screen
-	TFT_t dev;
-	//spi_master_init(&dev, CS_GPIO, DC_GPIO, RESET_GPIO, BL_GPIO);
-	spi_master_init(&dev, MOSI_GPIO, SCLK_GPIO, TFT_CS_GPIO, DC_GPIO,
-		RESET_GPIO, BL_GPIO, MISO_GPIO, XPT_CS_GPIO, XPT_IRQ_GPIO);
-	lcdInit(&dev, 0x9341, SCREEN_WIDTH, SCREEN_HEIGHT, 0, 0);
-	ESP_LOGI(pcTaskGetName(NULL), "Setup Screen done");
+	uint8_t statsWidth;
+	uint8_t statsHeight;
+	GetFontx(fxS, 0, buffer, &statsWidth, &statsHeight);
+	ESP_LOGI(pcTaskGetName(NULL), "statsWidth=%d statsHeight=%d",statsWidth,statsHeight);
+	boot_end(BOOT_FONT);
+
+#if CONFIG_XPT2046
+	// The sampler sleeps until PENIRQ fires
+	xptSetEventQueue(&dev, xQueueTouch);
+	memplan_task_create(MEMPLAN_TASK_XPT, xptSampler, &dev);
+#endif
 
 	int lines = (SCREEN_HEIGHT - fontHeight) / fontHeight;
+	if (lines > MAX_LINES) lines = MAX_LINES;
 	ESP_LOGD(pcTaskGetName(NULL), "SCREEN_HEIGHT=%d fontHeight=%d lines=%d", SCREEN_HEIGHT, fontHeight, lines);
 	int ymax = (lines+1) * fontHeight;
 	ESP_LOGD(pcTaskGetName(NULL), "ymax=%d",ymax);
 
-	// Initial Screen
 	uint8_t ascii[DISPLAY_LENGTH+1];
-	lcdFillScreen(&dev, BLACK);
-	lcdSetFontDirection(&dev, 0);
 
 	// Reset scroll area
 	lcdSetScrollArea(&dev, 0, 0x0140, 0);
@@ -236,37 +542,143 @@ void tft(void *pvParameters)
 	uint16_t xstatus = 15*fontWidth;
 	lcdDrawString(&dev, fxG, xstatus, fontHeight-1, ascii, RED);
 
-	uint16_t vsp = fontHeight*2;
-	uint16_t ypos = (fontHeight*2) - 1;
-	uint16_t current = 0;
-	CMD_t cmdBuf;
+	SCROLL_t scroll;
+	scroll.lines = lines;
+	scroll.ymax = ymax;
+	scroll.fontHeight = fontHeight;
+	scroll.vsp = fontHeight*2;
+	scroll.ypos = (fontHeight*2) - 1;
+	scroll.current = 0;
+
+	// Average time to draw one line, in microseconds
+	int64_t lineTime = 0;
+	// Last lines received in this frame
+	CMD_t *pending[MAX_LINES] = {0};
+	bool statsPage = false;
+	uint32_t sppHandle = 0;
+	CMD_t *cmd = NULL;
 
 	while(1) {
-		xQueueReceive(xQueueCmd, &cmdBuf, portMAX_DELAY);
-		ESP_LOGI(pcTaskGetName(NULL),"cmdBuf.command=%d", cmdBuf.command);
-		if (cmdBuf.command == CMD_OPEN) {
+		// Done with the previous message
+		msgpool_free(cmd);
+		cmd = NULL;
+		// Wakes up for the next RPC deadline or latency probe
+		TickType_t wait = rpc_poll();
+		TickType_t probe = probe_poll(sppHandle);
+		if (probe < wait) wait = probe;
+		if (xQueueReceive(xQueueCmd, &cmd, wait) != pdTRUE) continue;
+		ESP_LOGI(pcTaskGetName(NULL),"cmd->command=%d", cmd->command);
+		if (cmd->command == CMD_OPEN) {
+			sppHandle = cmd->sppHandle;
+			probe_open();
 			strcpy((char *)ascii, "Connect");
 			lcdDrawFillRect(&dev, xstatus, 0, SCREEN_WIDTH-1, fontHeight-1, BLACK);
 			lcdDrawString(&dev, fxG, xstatus, fontHeight-1, ascii, CYAN);
-		} else if (cmdBuf.command == CMD_CLOSE) {
+		} else if (cmd->command == CMD_CLOSE) {
+			sppHandle = 0;
 			strcpy((char *)ascii, "Not Connect");
 			lcdDrawFillRect(&dev, xstatus, 0, SCREEN_WIDTH-1, fontHeight-1, BLACK);
 			lcdDrawString(&dev, fxG, xstatus, fontHeight-1, ascii, RED);
-		} else if (cmdBuf.command == CMD_RECEIVE) {
-			esp_spp_write(cmdBuf.sppHandle, SPP_ACK_LEN, spp_ack);
-			if (current < lines) {
-				lcdDrawString(&dev, fxM, 0, ypos, cmdBuf.payload, CYAN);
+		} else if (cmd->command == CMD_STATS) {
+			statsPage = !statsPage;
+			// Back to an unscrolled screen
+			lcdSetScrollArea(&dev, 0, 0x0140, 0);
+			lcdScroll(&dev, 0);
+			if (statsPage) {
+				drawStats(&dev, fxS, fontHeight, statsHeight);
 			} else {
-				lcdDrawFillRect(&dev, 0, ypos-fontHeight, SCREEN_WIDTH-1, ypos, BLACK);
-				lcdSetScrollArea(&dev, fontHeight, (SCREEN_HEIGHT-fontHeight), 0);
-				lcdScroll(&dev, vsp);
-				vsp = vsp + fontHeight;
-				if (vsp > ymax) vsp = fontHeight*2;
-				lcdDrawString(&dev, fxM, 0, ypos, cmdBuf.payload, CYAN);
+				lcdDrawFillRect(&dev, 0, fontHeight, SCREEN_WIDTH-1, SCREEN_HEIGHT-1, BLACK);
+				scroll.vsp = fontHeight*2;
+				scroll.ypos = (fontHeight*2) - 1;
+				scroll.current = 0;
+			}
+		} else if (cmd->command == CMD_TELEMETRY) {
+			if (statsPage) drawStats(&dev, fxS, fontHeight, statsHeight);
+		} else if (cmd->command == CMD_QUERY) {
+			query(sppHandle);
+		} else if (cmd->command == CMD_XFER) {
+			XFER_PROGRESS_t progress;
+			xfer_rx_progress(&progress);
+			if (progress.state == XFER_RUNNING && sppHandle) {
+				drawProgress(&dev, fxS, xstatus, fontHeight, &progress);
+				continue;
 			}
-			current++;
-			ypos = ypos + fontHeight;
-			if (ypos > ymax) ypos = (fontHeight*2) - 1;
+			if (sppHandle) {
+				strcpy((char *)ascii, "Connect");
+				lcdDrawFillRect(&dev, xstatus, 0, SCREEN_WIDTH-1, fontHeight-1, BLACK);
+				lcdDrawString(&dev, fxG, xstatus, fontHeight-1, ascii, CYAN);
+			}
+			if (statsPage || progress.state == XFER_IDLE) continue;
+			char line[48];
+			snprintf(line, sizeof(line), "%s %s %"PRIu32"KB/s", progress.name,
+				progress.state == XFER_DONE ? "ok" : "failed", progress.bytesPerSec / 1024);
+			line[DISPLAY_LENGTH] = 0;
+			drawLine(&dev, fxM, &scroll, (uint8_t *)line, progress.state == XFER_DONE ? GREEN : RED);
+		} else if (cmd->command == CMD_RESULT && statsPage == false) {
+			drawLine(&dev, fxM, &scroll, cmd->payload, GREEN);
+		} else if (cmd->command == CMD_RECEIVE && statsPage) {
+			// Reported as skipped when the page is closed
+			taskENTER_CRITICAL(&skipMux);
+			skipLines++;
+			taskEXIT_CRITICAL(&skipMux);
+		} else if (cmd->command == CMD_RECEIVE) {
+			// Collect the backlog. Only the last lines are kept.
+			uint32_t received = 0;
+			CMD_t *next;
+			while(1) {
+				msgpool_free(pending[received % lines]);
+				pending[received % lines] = cmd;
+				cmd = NULL;
+				received++;
+				if (xQueuePeek(xQueueCmd, &next, 0) != pdTRUE) break;
+				if (next->command != CMD_RECEIVE) break;
+				xQueueReceive(xQueueCmd, &cmd, 0);
+			}
+
+			// Number of lines that fit in one frame
+			uint32_t visible = lines;
+			if (lineTime > 0) {
+				visible = (FRAME_BUDGET_MS * 1000) / lineTime;
+				if (visible < 1) visible = 1;
+				if (visible > lines) visible = lines;
+			}
+
+			taskENTER_CRITICAL(&skipMux);
+			uint32_t skipped = skipLines;
+			skipLines = 0;
+			taskEXIT_CRITICAL(&skipMux);
+			// The counter line takes the place of one text line, so it
+			// is reserved before the hidden lines are counted
+			if (skipped || received > visible) {
+				if (visible > 1) visible--;
+			}
+			if (received > visible) skipped = skipped + (received - visible);
+			ESP_LOGD(pcTaskGetName(NULL), "received=%"PRIu32" visible=%"PRIu32" skipped=%"PRIu32, received, visible, skipped);
+
+			int64_t startTime = esp_timer_get_time();
+			int drawn = 0;
+			if (skipped) {
+				sprintf((char *)ascii, "+%"PRIu32" lines skipped", skipped);
+				drawLine(&dev, fxM, &scroll, ascii, YELLOW);
+				drawn++;
+			}
+			if (visible > received) visible = received;
+			for (uint32_t i=received-visible;i<received;i++) {
+				drawMessage(&dev, fxM, fxS, &scroll, pending[i % lines]);
+				probe_drawn(pending[i % lines]);
+				drawn++;
+			}
+			for (int i=0;i<lines;i++) {
+				msgpool_free(pending[i]);
+				pending[i] = NULL;
+			}
+			int64_t frameTime = esp_timer_get_time() - startTime;
+			if (lineTime == 0) {
+				lineTime = frameTime / drawn;
+			} else {
+				lineTime = (lineTime * 3 + (frameTime / drawn)) / 4;
+			}
+			ESP_LOGD(pcTaskGetName(NULL), "frameTime=%"PRId64" lineTime=%"PRId64, frameTime, lineTime);
 		}
 	}
 
@@ -277,6 +689,26 @@ void tft(void *pvParameters)
 }
 
 
+#if CONFIG_XPT2046
+void touch(void *pvParameters)
+{
+	ESP_LOGI(pcTaskGetName(NULL), "Start");
+	TouchEvent_t event;
+	while(1) {
+		xQueueReceive(xQueueTouch, &event, portMAX_DELAY);
+		int64_t age = esp_timer_get_time() - event.time;
+		if (event.pressed) {
+			ESP_LOGI(pcTaskGetName(NULL), "touch xp=%d yp=%d age=%"PRId64"us", event.xp, event.yp, age);
+		} else {
+			ESP_LOGI(pcTaskGetName(NULL), "release age=%"PRId64"us", age);
+		}
+	}
+
+	// nerver reach
+	vTaskDelete(NULL);
+}
+#endif
+
 static void SPIFFS_Directory(char * path) {
 	DIR* dir = opendir(path);
 	assert(dir != NULL);
@@ -291,12 +723,37 @@ static void SPIFFS_Directory(char * path) {
 
 void app_main()
 {
+	/* Create Queue */
+	// Sizes are in memplan_table.h.
+	// Ready before the BT stack can call back
+	xQueueCmd = memplan_queue_create(MEMPLAN_QUEUE_CMD);
+	msgpool_init();
+	// Frames go through their channel, then share writes of up to one RFCOMM MTU
+	coalesce_init(sppWrite, ESP_SPP_MAX_MTU);
+	mux_init(coalesce_write);
+	link_init(LINK_CAPS, mux_write, sppFrame);
+
+	boot_init(BOOT_BIT(BOOT_NVS) | BOOT_BIT(BOOT_BT) | BOOT_BIT(BOOT_SPIFFS) | BOOT_BIT(BOOT_PANEL) |
+		BOOT_BIT(BOOT_FONT) | BOOT_BIT(BOOT_FIRST_PIXEL) | BOOT_BIT(BOOT_CONNECTABLE));
+
+	// The panel resets and initializes alongside the BT bringup.
+	// tft waits for SPIFFS only when it needs the fonts.
+#if CONFIG_XPT2046
+	xQueueTouch = memplan_queue_create(MEMPLAN_QUEUE_TOUCH);
+	memplan_task_create(MEMPLAN_TASK_TOUCH, touch, NULL);
+#endif
+	memplan_task_create(MEMPLAN_TASK_TFT, tft, NULL);
+
+	boot_begin(BOOT_NVS);
 	esp_err_t ret = nvs_flash_init();
 	if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
 		ESP_ERROR_CHECK(nvs_flash_erase());
 		ret = nvs_flash_init();
 	}
 	ESP_ERROR_CHECK( ret );
+	boot_end(BOOT_NVS);
+
+	boot_begin(BOOT_BT);
 
 	ESP_ERROR_CHECK(esp_bt_controller_mem_release(ESP_BT_MODE_BLE));
 
@@ -360,7 +817,10 @@ void app_main()
 	esp_bt_pin_type_t pin_type = ESP_BT_PIN_TYPE_VARIABLE;
 	esp_bt_pin_code_t pin_code;
 	esp_bt_gap_set_pin(pin_type, 0, pin_code);
+	boot_end(BOOT_BT);
 
+	// Mounted while Bluedroid starts the SPP server in its own task
+	boot_begin(BOOT_SPIFFS);
 	ESP_LOGI(SPP_TAG, "Initializing SPIFFS");
 	esp_vfs_spiffs_conf_t conf = {
 		.base_path = "/spiffs",
@@ -391,13 +851,23 @@ void app_main()
 	} else {
 		ESP_LOGI(SPP_TAG,"Partition size: total: %d, used: %d", total, used);
 	}
+	boot_end(BOOT_SPIFFS);
 
 	SPIFFS_Directory("/spiffs");
-
-	/* Create Queue */
-	xQueueCmd = xQueueCreate( 10, sizeof(CMD_t) );
-	configASSERT( xQueueCmd );
-
-	xTaskCreate(tft, "TFT", 1024*4, NULL, 2, NULL);
-
+	// Files from initiators are written to SPIFFS
+	xfer_rx_init(xferProgress);
+
+	// Button A toggles the telemetry page
+	button_add(GPIO_INPUT_A, CMD_STATS, CMD_STATS, NULL);
+	// Button B queries the initiator
+	button_add(GPIO_INPUT_B, CMD_QUERY, CMD_QUERY, NULL);
+	memplan_task_create(MEMPLAN_TASK_BUTTON, button_task, xQueueCmd);
+
+	telemetry_init(xQueueCmd, pdMS_TO_TICKS(5000));
+	memplan_report_start(pdMS_TO_TICKS(60*1000));
+
+	// A new image is kept once it has drawn and can take the next update
+	boot_wait(BOOT_FIRST_PIXEL);
+	boot_wait(BOOT_CONNECTABLE);
+	ota_confirm();
 }
@@ -0,0 +1,74 @@
+#include <string.h>
+
+#include "frame.h"
+
+size_t frame_header(uint8_t *dst, uint8_t type, size_t length)
+{
+	dst[0] = FRAME_MAGIC;
+	dst[1] = type;
+	dst[2] = length & 0xFF;
+	dst[3] = length >> 8;
+	return FRAME_HEADER;
+}
+
+void frame_parser_reset(FRAME_PARSER_t *parser)
+{
+	parser->have = 0;
+	parser->skipped = 0;
+}
+
+static inline size_t frame_length(const uint8_t *header)
+{
+	return header[2] | (header[3] << 8);
+}
+
+void frame_parse(FRAME_PARSER_t *parser, const uint8_t *data, size_t len, frame_cb_t cb, void *ctx)
+{
+	size_t i = 0;
+	while (i < len) {
+		if (parser->have == 0) {
+			if (data[i] != FRAME_MAGIC) {
+				parser->skipped++;
+				i++;
+				continue;
+			}
+			// Whole frame in data, no copy
+			if (len - i >= FRAME_HEADER) {
+				size_t length = frame_length(&data[i]);
+				if (length > FRAME_MAX_PAYLOAD) {
+					parser->skipped++;
+					i++;
+					continue;
+				}
+				if (len - i >= FRAME_HEADER + length) {
+					cb(ctx, data[i+1], &data[i+FRAME_HEADER], length);
+					i += FRAME_HEADER + length;
+					continue;
+				}
+			}
+		}
+
+		// Gather the header first, then the payload it announces
+		size_t need = FRAME_HEADER;
+		if (parser->have >= FRAME_HEADER) need = FRAME_HEADER + frame_length(parser->buf);
+		size_t n = need - parser->have;
+		if (n > len - i) n = len - i;
+		memcpy(&parser->buf[parser->have], &data[i], n);
+		parser->have += n;
+		i += n;
+		if (parser->have == FRAME_HEADER && frame_length(parser->buf) > FRAME_MAX_PAYLOAD) {
+			// Not a frame after all. Skip the magic and look again from the next byte.
+			parser->skipped++;
+			size_t rest = parser->have - 1;
+			uint8_t again[FRAME_HEADER];
+			memcpy(again, &parser->buf[1], rest);
+			parser->have = 0;
+			frame_parse(parser, again, rest, cb, ctx);
+			continue;
+		}
+		if (parser->have >= FRAME_HEADER && parser->have == FRAME_HEADER + frame_length(parser->buf)) {
+			cb(ctx, parser->buf[1], &parser->buf[FRAME_HEADER], parser->have - FRAME_HEADER);
+			parser->have = 0;
+		}
+	}
+}
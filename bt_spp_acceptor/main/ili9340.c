@@ -9,6 +9,9 @@
 #include <driver/spi_master.h>
 #include <driver/gpio.h>
 #include "esp_log.h"
+#if CONFIG_XPT2046
+#include "esp_timer.h"
+#endif
 
 #include "ili9340.h"
 
@@ -33,6 +36,8 @@ static const int SPI_Data_Mode = 1;
 ////static const int TFT_Frequency = SPI_MASTER_FREQ_26M;
 static const int TFT_Frequency = SPI_MASTER_FREQ_40M;
 ////static const int TFT_Frequency = SPI_MASTER_FREQ_80M;
+// Memory Read is specified for a much slower clock than Memory Write
+static const int TFT_Read_Frequency = 5*1000*1000;
 
 #if CONFIG_XPT2046
 static const int XPT_Frequency = 1*1000*1000;
@@ -44,6 +49,23 @@ static const int XPT_Frequency = 1*1000*1000;
 //#define XPT_IRQ 5
 #endif
 
+static esp_err_t spi_master_add_device(TFT_t * dev, int clock_speed_hz)
+{
+	spi_device_interface_config_t tft_devcfg={
+		.clock_speed_hz = clock_speed_hz,
+		.spics_io_num = dev->_cs,
+		.queue_size = 7,
+		.flags = SPI_DEVICE_NO_DUMMY,
+	};
+
+	spi_device_handle_t tft_handle;
+	esp_err_t ret = spi_bus_add_device( HOST_ID, &tft_devcfg, &tft_handle);
+	if (ret != ESP_OK) return ret;
+	dev->_TFT_Handle = tft_handle;
+	dev->_clock = clock_speed_hz;
+	return ESP_OK;
+}
+
 void spi_master_init(TFT_t * dev, int16_t GPIO_MOSI, int16_t GPIO_SCLK, int16_t TFT_CS, int16_t GPIO_DC, int16_t GPIO_RESET, int16_t GPIO_BL,
 	int16_t GPIO_MISO, int16_t XPT_CS, int16_t XPT_IRQ)
 {
@@ -76,7 +98,7 @@ void spi_master_init(TFT_t * dev, int16_t GPIO_MOSI, int16_t GPIO_SCLK, int16_t
 		gpio_set_level( GPIO_BL, 0 );
 	}
 
-#if CONFIG_XPT2046
+	// MISO serves the touch controller and lets the panel be read back
 	spi_bus_config_t buscfg = {
 		.sclk_io_num = GPIO_SCLK,
 		.mosi_io_num = GPIO_MOSI,
@@ -84,34 +106,18 @@ void spi_master_init(TFT_t * dev, int16_t GPIO_MOSI, int16_t GPIO_SCLK, int16_t
 		.quadwp_io_num = -1,
 		.quadhd_io_num = -1
 	};
-#else
-	spi_bus_config_t buscfg = {
-		.sclk_io_num = GPIO_SCLK,
-		.mosi_io_num = GPIO_MOSI,
-		.miso_io_num = -1,
-		.quadwp_io_num = -1,
-		.quadhd_io_num = -1
-	};
-#endif
 
 	ret = spi_bus_initialize( HOST_ID, &buscfg, SPI_DMA_CH_AUTO );
 	ESP_LOGD(TAG, "spi_bus_initialize=%d",ret);
 	assert(ret==ESP_OK);
 
-	spi_device_interface_config_t tft_devcfg={
-		.clock_speed_hz = TFT_Frequency,
-		.spics_io_num = TFT_CS,
-		.queue_size = 7,
-		.flags = SPI_DEVICE_NO_DUMMY,
-	};
-
-	spi_device_handle_t tft_handle;
-	ret = spi_bus_add_device( HOST_ID, &tft_devcfg, &tft_handle);
-	ESP_LOGD(TAG, "spi_bus_add_device=%d",ret);
-	assert(ret==ESP_OK);
 	dev->_dc = GPIO_DC;
 	dev->_bl = GPIO_BL;
-	dev->_TFT_Handle = tft_handle;
+	dev->_cs = TFT_CS;
+	dev->_miso = GPIO_MISO;
+	ret = spi_master_add_device(dev, TFT_Frequency);
+	ESP_LOGD(TAG, "spi_bus_add_device=%d",ret);
+	assert(ret==ESP_OK);
 
 #if CONFIG_XPT2046
 	ESP_LOGI(TAG, "XPT_CS=%d",XPT_CS);
@@ -147,6 +153,19 @@ void spi_master_init(TFT_t * dev, int16_t GPIO_MOSI, int16_t GPIO_SCLK, int16_t
 #endif
 }
 
+// Replaces the TFT device with one clocked at clock_speed_hz.
+// Returns false and keeps the previous clock when the bus refuses it.
+bool spi_master_set_clock(TFT_t * dev, int clock_speed_hz)
+{
+	int previous = dev->_clock;
+	esp_err_t ret = spi_bus_remove_device(dev->_TFT_Handle);
+	assert(ret==ESP_OK);
+	if (spi_master_add_device(dev, clock_speed_hz) == ESP_OK) return true;
+	ret = spi_master_add_device(dev, previous);
+	assert(ret==ESP_OK);
+	return false;
+}
+
 
 bool spi_master_write_byte(spi_device_handle_t SPIHandle, const uint8_t* Data, size_t DataLength)
 {
@@ -643,6 +662,65 @@ void lcdDrawMultiPixels(TFT_t * dev, uint16_t x, uint16_t y, uint16_t size, uint
 
 }
 
+// x:X coordinate
+// y:Y coordinate
+// size:Number of colors
+// colors:colors read from the GRAM
+// Reads with Memory Read at TFT_Read_Frequency, then restores the write clock.
+// Returns false when the panel can't be read (no MISO, or not an ILI9340/ILI9341).
+bool lcdReadPixels(TFT_t * dev, uint16_t x, uint16_t y, uint16_t size, uint16_t * colors) {
+#ifdef SPI_TRANS_CS_KEEP_ACTIVE
+	if (dev->_miso < 0) return false;
+	if (dev->_model != 0x9340 && dev->_model != 0x9341) return false;
+	if (x+size > dev->_width) return false;
+	if (y >= dev->_height) return false;
+	if (size > TFT_READ_MAX) return false;
+
+	int clock = dev->_clock;
+	if (spi_master_set_clock(dev, TFT_Read_Frequency) == false) return false;
+	uint16_t _x1 = x + dev->_offsetx;
+	uint16_t _x2 = _x1 + (size-1);
+	uint16_t _y1 = y + dev->_offsety;
+	spi_master_write_comm_byte(dev, 0x2A);	// set column(x) address
+	spi_master_write_addr(dev, _x1, _x2);
+	spi_master_write_comm_byte(dev, 0x2B);	// set Page(y) address
+	spi_master_write_addr(dev, _y1, _y1);
+
+	// CS must stay low from the command to the last pixel
+	static uint8_t Byte[1 + TFT_READ_MAX*3] __attribute__((aligned(4)));
+	static uint8_t Command = 0x2E;	// Memory Read
+	spi_transaction_t SPITransaction;
+	esp_err_t ret = spi_device_acquire_bus(dev->_TFT_Handle, portMAX_DELAY);
+	assert(ret==ESP_OK);
+	memset( &SPITransaction, 0, sizeof( spi_transaction_t ) );
+	SPITransaction.length = 8;
+	SPITransaction.tx_buffer = &Command;
+	SPITransaction.flags = SPI_TRANS_CS_KEEP_ACTIVE;
+	gpio_set_level( dev->_dc, SPI_Command_Mode );
+	ret = spi_device_polling_transmit( dev->_TFT_Handle, &SPITransaction );
+	assert(ret==ESP_OK);
+	memset( &SPITransaction, 0, sizeof( spi_transaction_t ) );
+	SPITransaction.length = (1 + size*3) * 8;
+	SPITransaction.rxlength = SPITransaction.length;
+	SPITransaction.rx_buffer = Byte;
+	gpio_set_level( dev->_dc, SPI_Data_Mode );
+	ret = spi_device_polling_transmit( dev->_TFT_Handle, &SPITransaction );
+	assert(ret==ESP_OK);
+	spi_device_release_bus(dev->_TFT_Handle);
+
+	// One dummy byte, then red, green and blue in the upper 6 bits of a byte each
+	for(int i=0;i<size;i++) {
+		uint8_t *rgb = &Byte[1 + i*3];
+		colors[i] = ((rgb[0] & 0xF8) << 8) | ((rgb[1] & 0xFC) << 3) | (rgb[2] >> 3);
+	}
+	spi_master_set_clock(dev, clock);
+	return true;
+#else
+	// Needs an ESP-IDF that can hold CS between transactions
+	return false;
+#endif
+}
+
 
 
 // Draw rectangle of filling
@@ -1581,3 +1659,110 @@ void xptGetxy(TFT_t * dev, int *xp, int *yp){
 	*yp = xptGetit(dev, (XPT_START | XPT_YPOS | XPT_SER) );
 #endif
 }
+
+#if CONFIG_XPT2046
+// Interrupt driven sampler.
+// PENIRQ wakes the sampler task, which reads the controller only while the pen is down.
+// Nothing runs and the bus stays free while the screen is not touched.
+#define XPT_SAMPLES	5	// median of 5 conversions
+#define XPT_AVERAGE	4	// moving average of the medians
+#define XPT_INTERVAL	20	// ms between reports
+
+static TaskHandle_t xptTask = NULL;
+static QueueHandle_t xptQueue = NULL;
+
+static void IRAM_ATTR xpt_isr_handler(void *arg)
+{
+	TFT_t * dev = (TFT_t *)arg;
+	BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+	// Mask PENIRQ until the pen is released. It toggles during conversions.
+	gpio_intr_disable(dev->_irq);
+	vTaskNotifyGiveFromISR(xptTask, &xHigherPriorityTaskWoken);
+	if (xHigherPriorityTaskWoken) portYIELD_FROM_ISR();
+}
+
+static int xpt_median(int *v)
+{
+	// insertion sort of XPT_SAMPLES values
+	for (int i=1;i<XPT_SAMPLES;i++) {
+		int key = v[i];
+		int j = i - 1;
+		while (j >= 0 && v[j] > key) {
+			v[j+1] = v[j];
+			j--;
+		}
+		v[j+1] = key;
+	}
+	return v[XPT_SAMPLES/2];
+}
+
+void xptSetEventQueue(TFT_t * dev, QueueHandle_t queue)
+{
+	xptQueue = queue;
+}
+
+// pvParameters:TFT_t initialized by spi_master_init
+void xptSampler(void *pvParameters)
+{
+	TFT_t * dev = (TFT_t *)pvParameters;
+	xptTask = xTaskGetCurrentTaskHandle();
+
+	esp_err_t ret = gpio_install_isr_service(0);
+	// Another driver may have installed the service already
+	assert(ret==ESP_OK || ret==ESP_ERR_INVALID_STATE);
+	gpio_set_intr_type(dev->_irq, GPIO_INTR_NEGEDGE);
+	gpio_isr_handler_add(dev->_irq, xpt_isr_handler, dev);
+
+	int xs[XPT_SAMPLES];
+	int ys[XPT_SAMPLES];
+	int xavg[XPT_AVERAGE];
+	int yavg[XPT_AVERAGE];
+	TouchEvent_t event;
+
+	while(1) {
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+		ESP_LOGD(TAG, "pen down");
+		int count = 0;
+		bool reported = false;
+		while (gpio_get_level(dev->_irq) == 0) {
+			for (int i=0;i<XPT_SAMPLES;i++) {
+				xptGetxy(dev, &xs[i], &ys[i]);
+			}
+			xavg[count % XPT_AVERAGE] = xpt_median(xs);
+			yavg[count % XPT_AVERAGE] = xpt_median(ys);
+			count++;
+
+			// The pen may have lifted during the conversions
+			if (gpio_get_level(dev->_irq) != 0) break;
+
+			int n = (count < XPT_AVERAGE) ? count : XPT_AVERAGE;
+			int xsum = 0;
+			int ysum = 0;
+			for (int i=0;i<n;i++) {
+				xsum = xsum + xavg[i];
+				ysum = ysum + yavg[i];
+			}
+			event.pressed = true;
+			event.xp = xsum / n;
+			event.yp = ysum / n;
+			event.time = esp_timer_get_time();
+			if (xptQueue != NULL) xQueueSend(xptQueue, &event, 0);
+			reported = true;
+			vTaskDelay(pdMS_TO_TICKS(XPT_INTERVAL));
+		}
+
+		if (reported) {
+			event.pressed = false;
+			event.time = esp_timer_get_time();
+			if (xptQueue != NULL) xQueueSend(xptQueue, &event, 0);
+		}
+		ESP_LOGD(TAG, "pen up count=%d", count);
+		gpio_intr_enable(dev->_irq);
+		// Touched again before the interrupt was enabled
+		if (gpio_get_level(dev->_irq) == 0) xTaskNotifyGive(xptTask);
+	}
+
+	// nerver reach
+	vTaskDelete(NULL);
+}
+#endif
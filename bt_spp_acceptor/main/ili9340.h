@@ -4,6 +4,11 @@
 #include "driver/spi_master.h"
 #include "fontx.h"
 
+#if CONFIG_XPT2046
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#endif
+
 #define RED			0xf800
 #define GREEN			0x07e0
 #define BLUE			0x001f
@@ -20,6 +25,8 @@
 #define DIRECTION180		2
 #define DIRECTION270		3
 
+#define TFT_READ_MAX	64	// pixels per lcdReadPixels
+
 typedef struct {
 	uint16_t _model;
 	uint16_t _width;
@@ -34,6 +41,9 @@ typedef struct {
 	int16_t _dc;
 	int16_t _bl;
 	int16_t _irq;
+	int16_t _cs;
+	int16_t _miso;
+	int _clock;
 	spi_device_handle_t _TFT_Handle;
 	spi_device_handle_t _XPT_Handle;
 	bool _calibration;
@@ -49,6 +59,7 @@ typedef struct {
 
 void spi_master_init(TFT_t * dev, int16_t GPIO_MOSI, int16_t GPIO_SCLK, int16_t TFT_CS, int16_t GPIO_DC, int16_t GPIO_RESET, int16_t GPIO_BL,
   int16_t GPIO_MISO, int16_t XPT_CS, int16_t XPT_IRQ);
+bool spi_master_set_clock(TFT_t * dev, int clock_speed_hz);
 bool spi_master_write_byte(spi_device_handle_t SPIHandle, const uint8_t* Data, size_t DataLength);
 bool spi_master_write_comm_byte(TFT_t * dev, uint8_t cmd);
 bool spi_master_write_comm_word(TFT_t * dev, uint16_t cmd);
@@ -64,6 +75,7 @@ void lcdWriteRegisterByte(TFT_t * dev, uint8_t addr, uint16_t data);
 void lcdInit(TFT_t * dev, uint16_t model, int width, int height, int offsetx, int offsety);
 void lcdDrawPixel(TFT_t * dev, uint16_t x, uint16_t y, uint16_t color);
 void lcdDrawMultiPixels(TFT_t * dev, uint16_t x, uint16_t y, uint16_t size, uint16_t * colors);
+bool lcdReadPixels(TFT_t * dev, uint16_t x, uint16_t y, uint16_t size, uint16_t * colors);
 void lcdDrawFillRect(TFT_t * dev, uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2, uint16_t color);
 void lcdDisplayOff(TFT_t * dev);
 void lcdDisplayOn(TFT_t * dev);
@@ -99,5 +111,17 @@ void lcdResetScrollArea(TFT_t * dev, uint16_t vsa);
 void lcdScroll(TFT_t * dev, uint16_t vsp);
 int xptGetit(TFT_t * dev, int cmd);
 void xptGetxy(TFT_t * dev, int *xp, int *yp);
+
+#if CONFIG_XPT2046
+typedef struct {
+	bool pressed; // false when the pen is released
+	int16_t xp; // filtered raw x
+	int16_t yp; // filtered raw y
+	int64_t time; // esp_timer_get_time() of the sample
+} TouchEvent_t;
+
+void xptSetEventQueue(TFT_t * dev, QueueHandle_t queue);
+void xptSampler(void *pvParameters);
+#endif
 #endif /* MAIN_ILI9340_H_ */
 
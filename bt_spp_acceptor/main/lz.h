@@ -0,0 +1,37 @@
+#ifndef MAIN_LZ_H_
+#define MAIN_LZ_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// LZSS over a small history that consecutive frames share, so a short
+// message can point back into the ones sent before it.
+// Both ends must see the same bytes in the same order: every frame of the
+// stream goes through lz_compress/lz_push on one side and
+// lz_decompress/lz_push on the other, starting from lz_reset.
+//
+// One flag byte precedes every 8 tokens, LSB first.
+// 0: a literal byte. 1: two bytes, distance-1 and length-LZ_MIN_MATCH.
+#define LZ_WINDOW 256	// a power of 2, at most 256
+#define LZ_MIN_MATCH 3
+#define LZ_MAX_MATCH (LZ_MIN_MATCH + 255)
+// Worst case output for len input bytes
+#define LZ_BOUND(len) ((len) + ((len) + 7) / 8)
+
+typedef struct {
+	uint8_t history[LZ_WINDOW];
+	uint16_t head;		// next write position
+	uint16_t filled;	// valid bytes in history
+} LZ_t;
+
+void lz_reset(LZ_t *lz);
+// Adds bytes sent or received uncompressed to the history
+void lz_push(LZ_t *lz, const uint8_t *src, size_t len);
+// Returns the compressed length, or 0 when it doesn't fit in dstSize.
+// src joins the history either way, so the caller sends it raw on 0.
+size_t lz_compress(LZ_t *lz, const uint8_t *src, size_t len, uint8_t *dst, size_t dstSize);
+// Returns the decompressed length, or -1 on a corrupt stream or a full dst
+int lz_decompress(LZ_t *lz, const uint8_t *src, size_t len, uint8_t *dst, size_t dstSize);
+
+#endif /* MAIN_LZ_H_ */
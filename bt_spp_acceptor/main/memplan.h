@@ -0,0 +1,32 @@
+#ifndef MAIN_MEMPLAN_H_
+#define MAIN_MEMPLAN_H_
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+
+// Every task, queue and message slab of the application is listed in memplan_table.h.
+// Their stacks and storage are static, so the total shows up in .bss
+// (idf.py size-files | grep memplan) and is checked against MEMPLAN_BUDGET at compile time.
+#include "memplan_table.h"
+
+#define MEMPLAN_TASK_ID(name, stack, priority) MEMPLAN_TASK_##name,
+typedef enum {
+	MEMPLAN_TASKS(MEMPLAN_TASK_ID)
+	MEMPLAN_TASK_MAX
+} memplan_task_t;
+
+#define MEMPLAN_QUEUE_ID(name, type, length) MEMPLAN_QUEUE_##name,
+typedef enum {
+	MEMPLAN_QUEUES(MEMPLAN_QUEUE_ID)
+	MEMPLAN_QUEUE_MAX
+} memplan_queue_t;
+
+extern const size_t memplan_static_bytes;
+
+TaskHandle_t memplan_task_create(memplan_task_t id, TaskFunction_t function, void * param);
+QueueHandle_t memplan_queue_create(memplan_queue_t id);
+void memplan_report(void);
+void memplan_report_start(TickType_t period);
+
+#endif /* MAIN_MEMPLAN_H_ */
@@ -0,0 +1,41 @@
+#ifndef MAIN_MEMPLAN_TABLE_H_
+#define MAIN_MEMPLAN_TABLE_H_
+
+#include "cmd.h"
+#include "ili9340.h"
+#include "xfer.h"
+
+// X(name, stack bytes, priority)
+// X(name, item type, length)
+#if CONFIG_XPT2046
+#define MEMPLAN_TASKS(X) \
+	X(TFT, 1024*4, 2) \
+	X(BUTTON, 1024*2, 2) \
+	X(XPT, 1024*2, 3) \
+	X(TOUCH, 1024*2, 2) \
+	X(XFER, 1024*4, 2)
+
+#define MEMPLAN_QUEUES(X) \
+	X(CMD, CMD_t *, 32) \
+	X(TOUCH, TouchEvent_t, 10) \
+	X(XFER, XFER_JOB_t, 4)
+#else
+#define MEMPLAN_TASKS(X) \
+	X(TFT, 1024*4, 2) \
+	X(BUTTON, 1024*2, 2) \
+	X(XFER, 1024*4, 2)
+
+#define MEMPLAN_QUEUES(X) \
+	X(CMD, CMD_t *, 32) \
+	X(XFER, XFER_JOB_t, 4)
+#endif
+
+// X(name, payload bytes, count), smallest payload first
+// LINE covers the queue plus the lines the tft task holds for one frame
+#define MSGPOOL_SLABS(X) \
+	X(EVENT, 0, 16) \
+	X(LINE, 48, 48)
+
+#define MEMPLAN_BUDGET (1024*24)
+
+#endif /* MAIN_MEMPLAN_TABLE_H_ */
@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include "esp_idf_version.h"
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+#include "esp_log.h"
+#include "mbedtls/sha256.h"
+
+#include "ota.h"
+
+#define TAG "OTA"
+
+#define OTA_HASH 32	// SHA-256 appended to the image
+
+static esp_ota_handle_t otaHandle;
+static const esp_partition_t *target;
+static bool opened;
+static uint32_t imageSize;
+static uint32_t written;
+static mbedtls_sha256_context sha;
+
+static void ota_hex(char *dst, const uint8_t *hash, int length)
+{
+	for (int i=0;i<length;i++) sprintf(&dst[i*2], "%02x", hash[i]);
+}
+
+bool ota_begin(uint32_t size)
+{
+	ota_abort();
+	target = esp_ota_get_next_update_partition(NULL);
+	if (target == NULL || size <= OTA_HASH || size > target->size) {
+		ESP_LOGE(TAG, "no slot for %"PRIu32" bytes", size);
+		return false;
+	}
+#ifdef OTA_WITH_SEQUENTIAL_WRITES
+	// Every sector is erased just before it is written, so erasing
+	// overlaps with reception instead of stalling the link up front
+	esp_err_t ret = esp_ota_begin(target, OTA_WITH_SEQUENTIAL_WRITES, &otaHandle);
+#else
+	esp_err_t ret = esp_ota_begin(target, size, &otaHandle);
+#endif
+	if (ret != ESP_OK) {
+		ESP_LOGE(TAG, "esp_ota_begin failed: %s", esp_err_to_name(ret));
+		return false;
+	}
+	mbedtls_sha256_init(&sha);
+	mbedtls_sha256_starts(&sha, 0);
+	opened = true;
+	imageSize = size;
+	written = 0;
+	ESP_LOGI(TAG, "%"PRIu32" bytes to %s at 0x%"PRIx32, size, target->label, target->address);
+	return true;
+}
+
+bool ota_write(const uint8_t *data, size_t length)
+{
+	if (opened == false) return false;
+	esp_err_t ret = esp_ota_write(otaHandle, data, length);
+	if (ret != ESP_OK) {
+		ESP_LOGE(TAG, "esp_ota_write at %"PRIu32" failed: %s", written, esp_err_to_name(ret));
+		ota_abort();
+		return false;
+	}
+	// The hash the image carries covers everything before it
+	if (written < imageSize - OTA_HASH) {
+		size_t hashed = imageSize - OTA_HASH - written;
+		mbedtls_sha256_update(&sha, data, length < hashed ? length : hashed);
+	}
+	written += length;
+	return true;
+}
+
+bool ota_end(void)
+{
+	if (opened == false || written != imageSize) return false;
+	opened = false;
+	uint8_t received[OTA_HASH];
+	uint8_t flashed[OTA_HASH];
+	mbedtls_sha256_finish(&sha, received);
+	mbedtls_sha256_free(&sha);
+
+	// Reads the image back from flash and checks its own hash
+	esp_err_t ret = esp_ota_end(otaHandle);
+	if (ret != ESP_OK) {
+		ESP_LOGE(TAG, "image rejected: %s", esp_err_to_name(ret));
+		return false;
+	}
+	// And it must be the image that came over the link
+	char hex[OTA_HASH*2+1];
+	ota_hex(hex, received, OTA_HASH);
+	if (esp_partition_get_sha256(target, flashed) != ESP_OK || memcmp(received, flashed, OTA_HASH)) {
+		ESP_LOGE(TAG, "sha256 %s doesn't match the flash", hex);
+		return false;
+	}
+	ret = esp_ota_set_boot_partition(target);
+	if (ret != ESP_OK) {
+		ESP_LOGE(TAG, "esp_ota_set_boot_partition failed: %s", esp_err_to_name(ret));
+		return false;
+	}
+	ESP_LOGI(TAG, "sha256 %s, %s boots next", hex, target->label);
+	return true;
+}
+
+void ota_abort(void)
+{
+	if (opened == false) return;
+	opened = false;
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(4, 3, 0)
+	esp_ota_abort(otaHandle);
+#else
+	esp_ota_end(otaHandle);
+#endif
+	mbedtls_sha256_free(&sha);
+}
+
+uint32_t ota_written(void)
+{
+	return opened ? written : 0;
+}
+
+void ota_confirm(void)
+{
+	const esp_partition_t *running = esp_ota_get_running_partition();
+	esp_ota_img_states_t state;
+	// Nothing to confirm for the factory app or an image flashed over USB
+	if (esp_ota_get_state_partition(running, &state) != ESP_OK) return;
+	if (state != ESP_OTA_IMG_PENDING_VERIFY) return;
+	esp_ota_mark_app_valid_cancel_rollback();
+	ESP_LOGI(TAG, "%s confirmed, rollback cancelled", running->label);
+}
@@ -0,0 +1,23 @@
+#ifndef MAIN_OTA_H_
+#define MAIN_OTA_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Firmware update into the inactive OTA slot, fed by xfer_rx.c.
+// Nothing changes until ota_end has checked the image and switched the
+// boot partition. A new image that resets before ota_confirm is rolled
+// back by the bootloader.
+bool ota_begin(uint32_t size);
+bool ota_write(const uint8_t *data, size_t length);
+// Verifies the image on flash and boots it next time
+bool ota_end(void);
+void ota_abort(void);
+// Bytes written since ota_begin, 0 when no update is open.
+// An update survives a dropped link, so it can resume.
+uint32_t ota_written(void);
+// Once the new firmware is up: keeps it, cancelling the rollback
+void ota_confirm(void);
+
+#endif /* MAIN_OTA_H_ */
@@ -0,0 +1,208 @@
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+
+#include "link.h"
+#include "rpc.h"
+#include "probe.h"
+
+#define TAG "PROBE"
+
+static const char * stageName[PROBE_STAGE_MAX] = {
+	"rtt", "queue", "air", "render", "total"
+};
+
+typedef struct {
+	uint32_t rtt;
+	uint32_t offset;
+} SAMPLE_t;
+
+static bool active;
+static bool supported;	// false once the peer has no RPC_CLOCK
+static int64_t nextProbe;
+static SAMPLE_t samples[PROBE_SAMPLES];
+static uint32_t probes;		// samples taken on this connection
+static uint32_t offset;		// of the sample with the shortest round trip
+static uint32_t drawn;
+static HIST_t hists[PROBE_STAGE_MAX];
+static portMUX_TYPE probeMux = portMUX_INITIALIZER_UNLOCKED;
+
+int probe_clock(const uint8_t *args, size_t length, uint8_t *result, size_t size)
+{
+	if (length != 4 || size < 8) return -1;
+	memcpy(result, args, 4);
+	frame_put32(&result[4], esp_timer_get_time());
+	return 8;
+}
+
+static void probe_add(probe_stage_t stage, uint32_t value)
+{
+	taskENTER_CRITICAL(&probeMux);
+	hist_add(&hists[stage], value);
+	taskEXIT_CRITICAL(&probeMux);
+}
+
+void probe_open(void)
+{
+	taskENTER_CRITICAL(&probeMux);
+	active = true;
+	supported = true;
+	nextProbe = 0;
+	probes = 0;
+	drawn = 0;
+	for (int i=0;i<PROBE_STAGE_MAX;i++) hist_reset(&hists[i]);
+	taskEXIT_CRITICAL(&probeMux);
+}
+
+void probe_close(void)
+{
+	taskENTER_CRITICAL(&probeMux);
+	bool report = active && (probes || drawn);
+	active = false;
+	taskEXIT_CRITICAL(&probeMux);
+	if (report) probe_report();
+}
+
+// In the BTC task, or in the tft task for a timeout
+static void probe_done(void *ctx, rpc_method_t method, rpc_status_t status, const uint8_t *result, size_t length)
+{
+	if (status == RPC_UNKNOWN) {
+		ESP_LOGW(TAG, "peer has no clock, latency is not split");
+		supported = false;
+		return;
+	}
+	if (status != RPC_OK || length < 8) return;
+	uint32_t now = esp_timer_get_time();
+	uint32_t sent = frame_get32(&result[0]);
+	uint32_t peer = frame_get32(&result[4]);
+	SAMPLE_t sample;
+	sample.rtt = now - sent;
+	// The peer read its clock halfway through the round trip
+	sample.offset = peer - (sent + sample.rtt / 2);
+
+	taskENTER_CRITICAL(&probeMux);
+	samples[probes % PROBE_SAMPLES] = sample;
+	probes++;
+	uint32_t count = probes < PROBE_SAMPLES ? probes : PROBE_SAMPLES;
+	SAMPLE_t best = samples[0];
+	for (int i=1;i<count;i++) {
+		if (samples[i].rtt < best.rtt) best = samples[i];
+	}
+	offset = best.offset;
+	hist_add(&hists[PROBE_RTT], sample.rtt);
+	bool first = (probes == 1);
+	taskEXIT_CRITICAL(&probeMux);
+	if (first) ESP_LOGI(TAG, "clock offset %"PRId32" us, rtt %"PRIu32" us", (int32_t)best.offset, best.rtt);
+}
+
+TickType_t probe_poll(uint32_t handle)
+{
+	if (handle == 0 || active == false || supported == false) return portMAX_DELAY;
+	int64_t now = esp_timer_get_time();
+	if (now >= nextProbe) {
+		// A plain SPP terminal has no RPC, look again later
+		if (link_framed()) {
+			uint8_t args[4];
+			frame_put32(args, now);
+			rpc_call(handle, RPC_CLOCK, args, sizeof(args), PROBE_PERIOD_MS, probe_done, NULL);
+		}
+		nextProbe = now + PROBE_PERIOD_MS * 1000;
+	}
+	return pdMS_TO_TICKS((nextProbe - now) / 1000) + 1;
+}
+
+uint32_t probe_receive(const RELIABLE_STAMP_t *stamp)
+{
+	if (stamp->valid == false) return 0;
+	uint32_t now = esp_timer_get_time();
+	probe_add(PROBE_QUEUE, stamp->sent - stamp->created);
+
+	taskENTER_CRITICAL(&probeMux);
+	bool synced = probes > 0;
+	// The initiator's stamps on this clock
+	uint32_t sent = stamp->sent - offset;
+	uint32_t created = stamp->created - offset;
+	taskEXIT_CRITICAL(&probeMux);
+	if (synced == false) return 0;
+
+	// An offset a little off can't make the link faster than zero
+	int32_t air = now - sent;
+	if (air < 0) air = 0;
+	probe_add(PROBE_AIR, air);
+	int32_t upstream = now - created;
+	return upstream > air ? upstream : air;
+}
+
+void probe_drawn(const CMD_t *cmd)
+{
+	uint32_t render = esp_timer_get_time() - cmd->stamp;
+	probe_add(PROBE_RENDER, render);
+	if (cmd->upstream) probe_add(PROBE_TOTAL, cmd->upstream + render);
+
+	taskENTER_CRITICAL(&probeMux);
+	drawn++;
+	bool report = (drawn % PROBE_REPORT == 0);
+	taskEXIT_CRITICAL(&probeMux);
+	if (report) probe_report();
+}
+
+void probe_get(probe_stage_t stage, HIST_t *hist)
+{
+	taskENTER_CRITICAL(&probeMux);
+	*hist = hists[stage];
+	taskEXIT_CRITICAL(&probeMux);
+}
+
+bool probe_offset(int32_t *current)
+{
+	taskENTER_CRITICAL(&probeMux);
+	bool synced = probes > 0;
+	*current = offset;
+	taskEXIT_CRITICAL(&probeMux);
+	return synced;
+}
+
+// Rounded up, so a stage that took any time doesn't show 0
+static uint32_t probe_ms(uint32_t us)
+{
+	return (us + 999) / 1000;
+}
+
+int probe_format(char lines[][TELEMETRY_LINE], int maxLines)
+{
+	int num = 0;
+#define LINE(...) if (num < maxLines) snprintf(lines[num++], TELEMETRY_LINE, __VA_ARGS__)
+	LINE("ms  50/99/max");
+	for (int i=0;i<PROBE_STAGE_MAX;i++) {
+		HIST_t hist;
+		probe_get(i, &hist);
+		if (hist.total == 0) {
+			LINE("%-4.4s-", stageName[i]);
+			continue;
+		}
+		LINE("%-4.4s%"PRIu32"/%"PRIu32"/%"PRIu32, stageName[i], probe_ms(hist_percentile(&hist, 50)),
+			probe_ms(hist_percentile(&hist, 99)), probe_ms(hist.max));
+	}
+	int32_t current;
+	if (probe_offset(&current)) LINE("clock %+"PRId32"ms", current / 1000);
+#undef LINE
+	return num;
+}
+
+void probe_report(void)
+{
+	int32_t current;
+	if (probe_offset(&current)) ESP_LOGI(TAG, "clock offset %"PRId32" us", current);
+	ESP_LOGI(TAG, "%-6s %6s %8s %8s %8s %8s", "stage", "n", "p50", "p95", "p99", "max(us)");
+	for (int i=0;i<PROBE_STAGE_MAX;i++) {
+		HIST_t hist;
+		probe_get(i, &hist);
+		if (hist.total == 0) continue;
+		ESP_LOGI(TAG, "%-6s %6"PRIu32" %8"PRIu32" %8"PRIu32" %8"PRIu32" %8"PRIu32, stageName[i], hist.total,
+			hist_percentile(&hist, 50), hist_percentile(&hist, 95), hist_percentile(&hist, 99), hist.max);
+	}
+}
@@ -0,0 +1,74 @@
+#ifndef MAIN_RECORD_H_
+#define MAIN_RECORD_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Binary telemetry records, sent in place of formatted text.
+//
+//  mark  fields (varint)  the fields that are set, in schema order
+//
+// RECORD_MARK is ASCII RS, which never starts a line of text, so the
+// acceptor tells records from text by the first byte. It turns a record
+// into text only when it draws it.
+//
+// Field kinds:
+//  VARINT  unsigned, LEB128 (7 bits per byte, low first)
+//  FIXED   signed, in units of 10^-scale, zigzag LEB128
+//  TIME    esp_timer_get_time(), sent in milliseconds
+//
+// New fields go at the end. A decoder drops records with fields it
+// doesn't know, since it can't tell where they end.
+//
+// X(name, kind, scale, unit). Fields with a NULL unit are not drawn.
+#define RECORD_FIELDS(X) \
+	X(device, VARINT, 0, NULL) \
+	X(counter, VARINT, 0, NULL) \
+	X(batVoltage, FIXED, 3, "V") \
+	X(batCurrent, FIXED, 0, "mA") \
+	X(temperature, FIXED, 1, "C") \
+	X(time, TIME, 0, "s")
+
+#define RECORD_MARK 0x1E
+#define RECORD_MAX 40	// encoded size with every field set
+#define RECORD_LINE 41	// 40 characters, the 8x16 font across the M5Stack
+
+typedef enum {
+	RECORD_UNKNOWN,
+	RECORD_STICK,
+	RECORD_STICKC,
+	RECORD_STICKC_PLUS,
+} record_device_t;
+
+#define RECORD_FIELD_ENUM(name, kind, scale, unit) RECORD_FIELD_##name,
+typedef enum {
+	RECORD_FIELDS(RECORD_FIELD_ENUM)
+	RECORD_FIELD_MAX
+} record_field_t;
+#undef RECORD_FIELD_ENUM
+
+#define RECORD_HAS(name) (1UL << RECORD_FIELD_##name)
+
+#define RECORD_TYPE_VARINT uint32_t
+#define RECORD_TYPE_FIXED int32_t
+#define RECORD_TYPE_TIME int64_t
+#define RECORD_MEMBER(name, kind, scale, unit) RECORD_TYPE_##kind name;
+typedef struct {
+	uint32_t fields;	// RECORD_HAS() of every field that is set
+	RECORD_FIELDS(RECORD_MEMBER)
+} RECORD_t;
+#undef RECORD_MEMBER
+
+#define RECORD_SET(rec, name, value) ((rec)->name = (value), (rec)->fields |= RECORD_HAS(name))
+
+// dst holds RECORD_MAX bytes. Returns the encoded length.
+size_t record_encode(const RECORD_t *rec, uint8_t *dst);
+bool record_is(const uint8_t *src, size_t length);
+// false for text, a truncated record or unknown fields
+bool record_decode(const uint8_t *src, size_t length, RECORD_t *rec);
+// One line: the device and counter, then every field with a unit.
+// Returns the length, cut to fit size.
+size_t record_format(const RECORD_t *rec, char *line, size_t size);
+
+#endif /* MAIN_RECORD_H_ */
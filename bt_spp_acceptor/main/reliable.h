@@ -0,0 +1,78 @@
+#ifndef MAIN_RELIABLE_H_
+#define MAIN_RELIABLE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "cmd.h"
+
+// Reliable delivery of DATA frames on top of link.c.
+//
+// The initiator numbers every message and keeps it until the acceptor
+// acknowledges it. Unacknowledged messages survive a dropped link and
+// are sent again after the next HELLO. The acceptor drops duplicates.
+//
+//  DATA  seq (LE16), [created (LE32), sent (LE32)], message
+//  SYNC  stream (LE32), oldest unacknowledged seq (LE16)
+//  ACK   next expected seq (LE16), received bitmap (LE32)
+//
+// Bit i of the bitmap is seq expected+i, so one ACK also covers
+// messages that arrived after a gap (selective acknowledgement).
+// A new stream id, picked at every boot of the initiator, tells the
+// acceptor that the numbering starts over.
+// Once LINK_CAP_STAMP is agreed, DATA frames carry FRAME_STAMP and the
+// two stamps: when the message was allocated and when this copy went
+// out, the low 32 bits of esp_timer_get_time() on the initiator.
+#define RELIABLE_WINDOW_MAX 32	// the bitmap width
+#define RELIABLE_HEADER 2		// seq in front of every DATA payload
+#define RELIABLE_STAMP 8		// the stamps after seq
+#define RELIABLE_RTO_MIN_MS 200
+#define RELIABLE_RTO_MAX_MS 8000
+#define RELIABLE_REPORT 100		// log every so many acknowledged or delivered messages
+
+typedef struct {
+	// Initiator
+	uint32_t sent;			// first transmissions
+	uint32_t retransmits;
+	uint32_t acked;
+	uint32_t timeouts;
+	uint8_t inflight;
+	uint32_t rtoMs;
+	uint32_t srttUs;		// 0 before the first ACK
+	// Acceptor
+	uint32_t delivered;
+	uint32_t duplicates;
+	uint32_t lost;			// numbers the initiator skipped past
+} RELIABLE_STATS_t;
+
+typedef struct {
+	bool valid;			// the frame had FRAME_STAMP
+	uint32_t created;	// initiator clock, microseconds
+	uint32_t sent;
+} RELIABLE_STAMP_t;
+
+// Initiator side. Everything runs in the one task that sends DATA.
+// window: messages in flight, at most RELIABLE_WINDOW_MAX.
+// stream: a random number, new at every boot.
+void reliable_init(uint8_t window, uint32_t stream);
+// Takes the message and sends it when handle is not 0.
+// Returns false with the message left to the caller when the window is full.
+bool reliable_send(uint32_t handle, CMD_t *cmd);
+bool reliable_full(void);
+// After link_open: SYNC, then every unacknowledged message again
+void reliable_open(uint32_t handle);
+// An ACK frame from the acceptor
+void reliable_ack(const uint8_t *payload, size_t length);
+// Retransmits what timed out. Returns the ticks until the next timeout.
+TickType_t reliable_poll(uint32_t handle);
+
+// Acceptor side, in the BTC task
+void reliable_sync(uint32_t handle, const uint8_t *payload, size_t length);
+// Acknowledges a DATA frame. Returns the message, or NULL for a duplicate.
+// type is the frame type from link.c, stamp gets the stamps if it has any.
+const uint8_t *reliable_receive(uint32_t handle, uint8_t type, const uint8_t *payload, size_t *length, RELIABLE_STAMP_t *stamp);
+
+void reliable_stats(RELIABLE_STATS_t *stats);
+
+#endif /* MAIN_RELIABLE_H_ */
@@ -0,0 +1,385 @@
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "esp_spiffs.h"
+#include "esp_system.h"
+
+#include "memplan.h"
+#include "link.h"
+#include "xfer.h"
+#include "ota.h"
+
+#define TAG "XFER"
+
+#define XFER_DIR "/spiffs"
+#define XFER_PART XFER_DIR "/xfer.prt"	// data received so far
+#define XFER_INFO XFER_DIR "/xfer.inf"	// the OFFER it belongs to
+#define XFER_RESTART_MS 3000	// after a firmware update, time to show the result
+
+typedef struct {
+	uint32_t size;
+	uint32_t crc;
+	char name[XFER_NAME];
+} OFFER_t;
+
+// The BTC task fills a block while the writer task puts the other one on flash
+static uint8_t buffers[2][XFER_BLOCK];
+static volatile bool busy[2];
+static uint8_t current;
+static uint16_t fill;
+static bool receiving;
+static volatile bool stopped;	// RESULT went out since the last OFFER
+static uint32_t expected;	// offset of the next chunk
+static uint32_t size;
+static OFFER_t offer;		// handed to the writer with XFER_OFFER
+static volatile uint32_t sppHandle;
+static portMUX_TYPE rxMux = portMUX_INITIALIZER_UNLOCKED;
+
+// Writer task
+static QueueHandle_t xQueueJob;
+static xfer_progress_t progressCb;
+static FILE *part;
+static OFFER_t active;
+static bool firmware;	// active goes to ota.c instead of SPIFFS
+static uint32_t written;
+static uint32_t crc;
+static uint32_t startOffset;
+static int64_t startTime;
+static XFER_PROGRESS_t progress;
+
+static void xfer_reply(uint8_t op, uint32_t value)
+{
+	uint8_t reply[5] = {op};
+	frame_put32(&reply[1], value);
+	link_send(sppHandle, FRAME_FILE, reply, op == XFER_ACCEPT || op == XFER_PROGRESS ? 5 : 2);
+}
+
+static void xfer_report(xfer_state_t state)
+{
+	int64_t elapsed = esp_timer_get_time() - startTime;
+	taskENTER_CRITICAL(&rxMux);
+	memcpy(progress.name, active.name, XFER_NAME);
+	progress.state = state;
+	progress.offset = written;
+	progress.size = active.size;
+	progress.bytesPerSec = elapsed > 0 ? (int64_t)(written - startOffset) * 1000000 / elapsed : 0;
+	XFER_PROGRESS_t current = progress;
+	taskEXIT_CRITICAL(&rxMux);
+	if (progressCb) progressCb(&current);
+}
+
+static void xfer_stop(void)
+{
+	taskENTER_CRITICAL(&rxMux);
+	receiving = false;
+	taskEXIT_CRITICAL(&rxMux);
+}
+
+static void xfer_finish(void)
+{
+	if (part) fclose(part);
+	part = NULL;
+	xfer_stop();
+	xfer_status_t status = crc == active.crc ? XFER_OK : XFER_BAD_CRC;
+	if (firmware) {
+		if (status == XFER_OK && ota_end() == false) status = XFER_IO_ERROR;
+		ota_abort();
+	} else {
+		if (status == XFER_OK) {
+			char path[XFER_PATH];
+			snprintf(path, sizeof(path), "%s/%s", XFER_DIR, active.name);
+			remove(path);
+			if (rename(XFER_PART, path) != 0) status = XFER_IO_ERROR;
+		}
+		remove(XFER_PART);
+		remove(XFER_INFO);
+	}
+	stopped = true;
+	xfer_reply(XFER_RESULT, status);
+	int64_t elapsed = esp_timer_get_time() - startTime;
+	ESP_LOGI(TAG, "%s %"PRIu32" bytes in %"PRId64" ms, %"PRId64" KB/s, crc %08"PRIx32" %s", active.name,
+		written - startOffset, elapsed / 1000, (int64_t)(written - startOffset) * 1000 / 1024 / (elapsed / 1000 + 1),
+		crc, status == XFER_OK ? "ok" : "failed");
+	xfer_report(status == XFER_OK ? XFER_DONE : XFER_FAILED);
+	if (firmware && status == XFER_OK) {
+		ESP_LOGW(TAG, "restart in %d ms", XFER_RESTART_MS);
+		vTaskDelay(pdMS_TO_TICKS(XFER_RESTART_MS));
+		esp_restart();
+	}
+}
+
+static void xfer_start(void);
+
+// Picks up a partial file of the same OFFER, otherwise starts over
+static uint32_t xfer_resume(void)
+{
+	OFFER_t info;
+	struct stat st;
+	FILE *fp = fopen(XFER_INFO, "rb");
+	if (fp == NULL) return 0;
+	bool same = fread(&info, sizeof(info), 1, fp) == 1 && memcmp(&info, &active, sizeof(info)) == 0;
+	fclose(fp);
+	if (same == false || stat(XFER_PART, &st) != 0) return 0;
+	// Only whole blocks are written, except the last one
+	if (st.st_size > active.size) return 0;
+	if (st.st_size % XFER_BLOCK && st.st_size != active.size) return 0;
+
+	fp = fopen(XFER_PART, "rb");
+	if (fp == NULL) return 0;
+	uint32_t offset = 0;
+	size_t length;
+	while ((length = fread(buffers[0], 1, XFER_BLOCK, fp)) > 0) {
+		crc = xfer_crc32(crc, buffers[0], length);
+		offset += length;
+	}
+	fclose(fp);
+	return offset;
+}
+
+// The image goes straight into the inactive slot. An update that is
+// still open after a dropped link goes on where it stopped.
+static bool xfer_firmware(void)
+{
+	if (ota_written() && written == ota_written()) return true;
+	crc = 0;
+	written = 0;
+	return ota_begin(active.size);
+}
+
+static void xfer_offer(void)
+{
+	if (part) fclose(part);
+	part = NULL;
+	bool same;
+	taskENTER_CRITICAL(&rxMux);
+	same = memcmp(&active, &offer, sizeof(offer)) == 0;
+	active = offer;
+	taskEXIT_CRITICAL(&rxMux);
+
+	firmware = strcmp(active.name, XFER_FIRMWARE) == 0;
+	if (firmware) {
+		if (same == false) ota_abort();
+		if (xfer_firmware() == false) {
+			xfer_reply(XFER_REFUSE, XFER_IO_ERROR);
+			return;
+		}
+		xfer_start();
+		return;
+	}
+	ota_abort();
+
+	crc = 0;
+	written = xfer_resume();
+	if (written == 0) {
+		crc = 0;
+		remove(XFER_PART);
+		FILE *fp = fopen(XFER_INFO, "wb");
+		if (fp) {
+			fwrite(&active, sizeof(active), 1, fp);
+			fclose(fp);
+		}
+	}
+
+	// The old file stays until the new one is complete
+	size_t total = 0, used = 0;
+	esp_spiffs_info(NULL, &total, &used);
+	part = fopen(XFER_PART, written ? "ab" : "wb");
+	if (part == NULL || active.size - written > total - used) {
+		ESP_LOGE(TAG, "%s %"PRIu32" bytes don't fit, %d free", active.name, active.size, total - used);
+		if (part) fclose(part);
+		part = NULL;
+		xfer_reply(XFER_REFUSE, XFER_IO_ERROR);
+		return;
+	}
+	xfer_start();
+}
+
+static void xfer_start(void)
+{
+	if (written) ESP_LOGI(TAG, "%s resumes at %"PRIu32, active.name, written);
+	startOffset = written;
+	startTime = esp_timer_get_time();
+	taskENTER_CRITICAL(&rxMux);
+	size = active.size;
+	expected = written;
+	current = 0;
+	fill = 0;
+	busy[0] = busy[1] = false;
+	receiving = true;
+	taskEXIT_CRITICAL(&rxMux);
+	xfer_reply(XFER_ACCEPT, written);
+	xfer_report(XFER_RUNNING);
+	if (written == active.size) xfer_finish();
+}
+
+static void xfer_block(uint8_t buffer, uint16_t length)
+{
+	if (part == NULL && firmware == false) {
+		busy[buffer] = false;
+		return;
+	}
+	bool ok;
+	if (firmware) {
+		ok = ota_write(buffers[buffer], length);
+	} else {
+		ok = fwrite(buffers[buffer], 1, length, part) == length && fflush(part) == 0;
+	}
+	crc = xfer_crc32(crc, buffers[buffer], length);
+	busy[buffer] = false;
+	if (ok == false) {
+		ESP_LOGE(TAG, "%s write error at %"PRIu32, active.name, written);
+		if (part) fclose(part);
+		part = NULL;
+		firmware = false;
+		xfer_stop();
+		stopped = true;
+		xfer_reply(XFER_RESULT, XFER_IO_ERROR);
+		xfer_report(XFER_FAILED);
+		return;
+	}
+	written += length;
+	if (written == active.size) {
+		xfer_finish();
+		return;
+	}
+	// Opens the window for the next block
+	xfer_reply(XFER_PROGRESS, written);
+	xfer_report(XFER_RUNNING);
+}
+
+static void xfer_task(void *pvParameters)
+{
+	XFER_JOB_t job;
+	while (1) {
+		xQueueReceive(xQueueJob, &job, portMAX_DELAY);
+		if (job.op == XFER_OFFER) {
+			xfer_offer();
+		} else if (job.op == XFER_PROGRESS) {
+			xfer_block(job.buffer, job.length);
+		} else if (part || firmware) {
+			// Kept for the next OFFER of the same file
+			if (part) fclose(part);
+			part = NULL;
+			firmware = false;
+			ESP_LOGW(TAG, "%s interrupted at %"PRIu32, active.name, written);
+			xfer_report(XFER_FAILED);
+		}
+	}
+
+	// nerver reach
+	while (1) {
+		vTaskDelay(2000 / portTICK_PERIOD_MS);
+	}
+}
+
+void xfer_rx_init(xfer_progress_t progress)
+{
+	progressCb = progress;
+	xQueueJob = memplan_queue_create(MEMPLAN_QUEUE_XFER);
+	memplan_task_create(MEMPLAN_TASK_XFER, xfer_task, NULL);
+}
+
+void xfer_rx_close(void)
+{
+	if (xQueueJob == NULL) return;
+	xfer_stop();
+	XFER_JOB_t job = {0};
+	xQueueSend(xQueueJob, &job, 0);
+}
+
+// In the BTC task. The sender offers the file again and resumes at
+// what is on flash by then. Once per OFFER, the chunks still on the way
+// would repeat it.
+static void xfer_again(void)
+{
+	xfer_stop();
+	if (stopped) return;
+	stopped = true;
+	xfer_reply(XFER_RESULT, XFER_AGAIN);
+}
+
+static void xfer_chunk(const uint8_t *payload, size_t length)
+{
+	uint32_t offset = frame_get32(payload);
+	const uint8_t *data = &payload[4];
+	length -= 4;
+	if (receiving == false || offset != expected || expected + length > size) {
+		ESP_LOGW(TAG, "chunk at %"PRIu32" unexpected, want %"PRIu32, offset, expected);
+		xfer_again();
+		return;
+	}
+	while (length) {
+		if (busy[current]) {
+			// The window keeps the sender from getting here
+			ESP_LOGE(TAG, "receive overrun at %"PRIu32, expected);
+			xfer_again();
+			return;
+		}
+		size_t copy = XFER_BLOCK - fill < length ? XFER_BLOCK - fill : length;
+		memcpy(&buffers[current][fill], data, copy);
+		fill += copy;
+		data += copy;
+		length -= copy;
+		expected += copy;
+		if (fill == XFER_BLOCK || expected == size) {
+			XFER_JOB_t job = {XFER_PROGRESS, current, fill};
+			busy[current] = true;
+			if (xQueueSend(xQueueJob, &job, 0) != pdTRUE) {
+				ESP_LOGE(TAG, "writer queue full at %"PRIu32, expected);
+				busy[current] = false;
+				xfer_again();
+				return;
+			}
+			current ^= 1;
+			fill = 0;
+		}
+	}
+}
+
+void xfer_rx_receive(uint32_t handle, uint8_t type, const uint8_t *payload, size_t length)
+{
+	// SPIFFS isn't mounted yet
+	if (xQueueJob == NULL) return;
+	if (type == FRAME_CHUNK && length > 4) {
+		// Also answers chunks of a transfer this end doesn't know, e.g. after a reset
+		sppHandle = handle;
+		xfer_chunk(payload, length);
+		return;
+	}
+	if (type != FRAME_FILE || length < 9 || payload[0] != XFER_OFFER) return;
+
+	xfer_stop();
+	stopped = false;
+	sppHandle = handle;
+	taskENTER_CRITICAL(&rxMux);
+	memset(&offer, 0, sizeof(offer));
+	offer.size = frame_get32(&payload[1]);
+	offer.crc = frame_get32(&payload[5]);
+	size_t nameLength = length - 9 < XFER_NAME - 1 ? length - 9 : XFER_NAME - 1;
+	memcpy(offer.name, &payload[9], nameLength);
+	taskEXIT_CRITICAL(&rxMux);
+	// Only plain names, and not the files of the transfer itself
+	if (nameLength == 0 || memchr(offer.name, '/', nameLength) || strncmp(offer.name, "xfer.", 5) == 0) {
+		uint8_t refuse[2] = {XFER_REFUSE, XFER_IO_ERROR};
+		link_send(handle, FRAME_FILE, refuse, sizeof(refuse));
+		return;
+	}
+	XFER_JOB_t job = {XFER_OFFER, 0, 0};
+	if (xQueueSend(xQueueJob, &job, 0) != pdTRUE) {
+		uint8_t refuse[2] = {XFER_REFUSE, XFER_BUSY};
+		link_send(handle, FRAME_FILE, refuse, sizeof(refuse));
+	}
+}
+
+void xfer_rx_progress(XFER_PROGRESS_t *current)
+{
+	taskENTER_CRITICAL(&rxMux);
+	*current = progress;
+	taskEXIT_CRITICAL(&rxMux);
+}
@@ -26,28 +26,47 @@
 #include "esp_spp_api.h"
 #include "esp_err.h"
 #include "esp_system.h"
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+#include "esp_random.h"
+#endif
+#include "esp_timer.h"
 #include "esp_vfs.h"
 #include "esp_spiffs.h"
 
 #include "cmd.h"
+#include "button.h"
+#include "memplan.h"
+#include "telemetry.h"
+#include "msgpool.h"
+#include "boot.h"
+#include "connmgr.h"
+#include "powermgr.h"
+#include "link.h"
+#include "coalesce.h"
+#include "mux.h"
+#include "reliable.h"
+#include "rpc.h"
+#include "probe.h"
+#include "record.h"
+#include "ratemgr.h"
 
 #define SPP_TAG "SPP_INITIATOR"
 #define DEVICE_NAME "ESP_SPP_INITIATOR"
 
 static const esp_spp_mode_t esp_spp_mode = ESP_SPP_MODE_CB;
-static const esp_spp_sec_t sec_mask = ESP_SPP_SEC_AUTHENTICATE;
-static const esp_spp_role_t role_master = ESP_SPP_ROLE_MASTER;
 
-static esp_bd_addr_t peer_bd_addr;
 static uint8_t peer_bdname_len;
 static char peer_bdname[ESP_BT_GAP_MAX_BDNAME_LEN + 1];
 static const char remote_device_name[] = "ESP_SPP_ACCEPTOR";
-static const esp_bt_inq_mode_t inq_mode = ESP_BT_INQ_MODE_GENERAL_INQUIRY;
-static const uint8_t inq_len = 30;
-static const uint8_t inq_num_rsps = 0;
 
-#define SPP_DATA_LEN 20
-static uint8_t spp_data[SPP_DATA_LEN];
+// Compression and send stamps are offered to the acceptor at every connect
+#define LINK_CAPS (LINK_CAP_LZ | LINK_CAP_STAMP)
+// Messages sent but not yet acknowledged
+#define RELIABLE_WINDOW 8
+
+// Send rate in messages per 1000 seconds, ratemgr.c moves it in between
+#define SEND_RATE_FLOOR 500
+#define SEND_RATE_CEILING 50000
 
 QueueHandle_t xQueueCmd;
 
@@ -73,14 +92,22 @@ QueueHandle_t xQueueCmd;
 
 #if CONFIG_STICKC
 #include "axp192.h"
+#include "power.h"
+#include "sensor.h"
 #include "st7735s.h"
 #include "fontx.h"
+#include "spiclock.h"
+#include "xfer.h"
 #endif
 
 #if CONFIG_STICKC_PLUS
 #include "axp192.h"
+#include "power.h"
+#include "sensor.h"
 #include "st7789.h"
 #include "fontx.h"
+#include "spiclock.h"
+#include "xfer.h"
 #endif
 
 
@@ -122,6 +149,7 @@ QueueHandle_t xQueueCmd;
 #define MAX_LINE 8
 #define MAX_CHARACTER 10
 #define GPIO_INPUT GPIO_NUM_37
+#define GPIO_INPUT_B GPIO_NUM_39
 #endif
 
 #if CONFIG_STICKC_PLUS
@@ -141,6 +169,7 @@ QueueHandle_t xQueueCmd;
 #define MAX_LINE 12
 #define MAX_CHARACTER 16
 #define GPIO_INPUT GPIO_NUM_37
+#define GPIO_INPUT_B GPIO_NUM_39
 #endif
 
 
@@ -178,7 +207,7 @@ static bool get_name_from_eir(uint8_t *eir, char *bdname, uint8_t *bdname_len)
 
 static void esp_spp_cb(esp_spp_cb_event_t event, esp_spp_cb_param_t *param)
 {
-	CMD_t cmdBuf;
+	CMD_t *cmd;
 	switch (event) {
 	case ESP_SPP_INIT_EVT:
 		ESP_LOGI(SPP_TAG, "ESP_SPP_INIT_EVT");
@@ -188,45 +217,64 @@ static void esp_spp_cb(esp_spp_cb_event_t event, esp_spp_cb_param_t *param)
 		esp_bt_dev_set_device_name(DEVICE_NAME);
 #endif
 		esp_bt_gap_set_scan_mode(ESP_BT_CONNECTABLE, ESP_BT_GENERAL_DISCOVERABLE);
-		esp_bt_gap_start_discovery(inq_mode, inq_len, inq_num_rsps);
+		connmgr_start();
+		boot_end(BOOT_CONNECTABLE);
 		break;
 	case ESP_SPP_DISCOVERY_COMP_EVT:
 		ESP_LOGI(SPP_TAG, "ESP_SPP_DISCOVERY_COMP_EVT status=%d scn_num=%d",param->disc_comp.status, param->disc_comp.scn_num);
-		if (param->disc_comp.status == ESP_SPP_SUCCESS) {
-			esp_spp_connect(sec_mask, role_master, param->disc_comp.scn[0], peer_bd_addr);
-		}
+		connmgr_sdp_done(param->disc_comp.status, param->disc_comp.scn[0]);
 		break;
 	case ESP_SPP_OPEN_EVT:
 		ESP_LOGI(SPP_TAG, "ESP_SPP_OPEN_EVT");
-		//esp_spp_write(param->srv_open.handle, SPP_DATA_LEN, spp_data);
-		cmdBuf.sppHandle = param->srv_open.handle;
-		cmdBuf.command = CMD_OPEN;
-		xQueueSend(xQueueCmd, &cmdBuf, 0);
+		connmgr_open();
+		powermgr_open(param->open.rem_bda);
+		cmd = msgpool_alloc(CMD_OPEN, 0);
+		if (cmd != NULL) cmd->sppHandle = param->srv_open.handle;
+		telemetry_send(xQueueCmd, cmd, 0);
 		break;
 	case ESP_SPP_CLOSE_EVT:
 		ESP_LOGI(SPP_TAG, "ESP_SPP_CLOSE_EVT");
-		cmdBuf.command = CMD_CLOSE;
-		xQueueSend(xQueueCmd, &cmdBuf, 0);
+		telemetry_send(xQueueCmd, msgpool_alloc(CMD_CLOSE, 0), 0);
+		link_close();
+		mux_close();
+		coalesce_close();
+		rpc_close();
+#if CONFIG_STICKC || CONFIG_STICKC_PLUS
+		xfer_tx_close();
+#endif
+		connmgr_close();
+		powermgr_close();
 		break;
 	case ESP_SPP_START_EVT:
 		ESP_LOGI(SPP_TAG, "ESP_SPP_START_EVT");
 		break;
 	case ESP_SPP_CL_INIT_EVT:
-		ESP_LOGI(SPP_TAG, "ESP_SPP_CL_INIT_EVT");
+		ESP_LOGI(SPP_TAG, "ESP_SPP_CL_INIT_EVT status=%d", param->cl_init.status);
+		if (param->cl_init.status != ESP_SPP_SUCCESS) connmgr_close();
 		break;
 	case ESP_SPP_DATA_IND_EVT:
-		//ESP_LOGI(SPP_TAG, "ESP_SPP_DATA_IND_EVT");
-		ESP_LOGI(SPP_TAG, "ESP_SPP_DATA_IND_EVT len=%d handle=%"PRIu32,
+		// Per packet, at INFO the console would hold up the BTC task
+		ESP_LOGD(SPP_TAG, "ESP_SPP_DATA_IND_EVT len=%d handle=%"PRIu32,
 				 param->data_ind.len, param->data_ind.handle);
+		telemetry_rx(param->data_ind.len);
+		link_receive(param->data_ind.handle, param->data_ind.data, param->data_ind.len);
+		powermgr_traffic();
 		break;
 	case ESP_SPP_CONG_EVT:
 		ESP_LOGI(SPP_TAG, "ESP_SPP_CONG_EVT cong=%d", param->cong.cong);
-		if (param->cong.cong == 0) {
-			esp_spp_write(param->cong.handle, SPP_DATA_LEN, spp_data);
+		if (param->cong.cong) {
+			telemetry_congestion();
+			ratemgr_congestion();
 		}
 		break;
 	case ESP_SPP_WRITE_EVT:
-		ESP_LOGI(SPP_TAG, "ESP_SPP_WRITE_EVT len=%d cong=%d", param->write.len , param->write.cong);
+		ESP_LOGD(SPP_TAG, "ESP_SPP_WRITE_EVT len=%d cong=%d", param->write.len , param->write.cong);
+		if (param->write.status == ESP_SPP_SUCCESS) telemetry_tx(param->write.len);
+		powermgr_write_done();
+		mux_write_done(param->write.len);
+#if CONFIG_STICKC || CONFIG_STICKC_PLUS
+		xfer_write_done();
+#endif
 		break;
 	case ESP_SPP_SRV_OPEN_EVT:
 		ESP_LOGI(SPP_TAG, "ESP_SPP_SRV_OPEN_EVT");
@@ -236,6 +284,133 @@ static void esp_spp_cb(esp_spp_cb_event_t event, esp_spp_cb_param_t *param)
 	}
 }
 
+// Every write goes out here, frames gathered by coalesce.c
+static bool sppWrite(uint32_t sppHandle, const uint8_t *data, size_t length)
+{
+	powermgr_write_start();
+	esp_err_t ret = esp_spp_write(sppHandle, length, (uint8_t *)data);
+	if (ret == ESP_OK) return true;
+	// No ESP_SPP_WRITE_EVT returns the credit and the peer misses part of
+	// the stream. The link starts over, CLOSE_EVT clears the queues and
+	// reliable.c sends what was lost after the reconnect.
+	ESP_LOGE(SPP_TAG, "esp_spp_write %d bytes failed: %s", (int)length, esp_err_to_name(ret));
+	powermgr_write_done();
+	esp_spp_disconnect(sppHandle);
+	return false;
+}
+
+// Frames from the acceptor, in the BTC task.
+// ACKs go to the tft task, which owns the reliable window.
+// Requests are answered right here.
+static void sppFrame(uint32_t sppHandle, uint8_t type, const uint8_t *payload, size_t length)
+{
+	if (type == FRAME_REQUEST) {
+		rpc_receive(sppHandle, type, payload, length);
+		return;
+	}
+#if CONFIG_STICKC || CONFIG_STICKC_PLUS
+	if (type == FRAME_FILE) {
+		xfer_tx_receive(sppHandle, type, payload, length);
+		return;
+	}
+#endif
+	if (type != FRAME_ACK) return;
+	CMD_t *cmd = msgpool_alloc(CMD_ACK, length);
+	if (cmd != NULL) {
+		cmd->sppHandle = sppHandle;
+		cmd->length = length;
+		memcpy(cmd->payload, payload, length);
+	}
+	// A lost ACK only costs a retransmission
+	telemetry_send(xQueueCmd, cmd, 0);
+}
+
+// Move what was held back into the window as it frees up
+static void flushBacklog(uint32_t sppHandle)
+{
+	CMD_t *cmd;
+	while (reliable_full() == false && (cmd = connmgr_backlog_pop()) != NULL) {
+		reliable_send(sppHandle, cmd);
+	}
+}
+
+// The window keeps the message until it is acknowledged, also across
+// a dropped link. When the window is full it waits in the backlog.
+static void sendMessage(uint32_t sppHandle, CMD_t *cmd)
+{
+	if (sppHandle) ratemgr_offer();
+	flushBacklog(sppHandle);
+	if (reliable_send(sppHandle, cmd)) return;
+	connmgr_backlog_push(cmd);
+}
+
+// RPC methods the acceptor can call. They run in the BTC task.
+static int rpcPing(const uint8_t *args, size_t length, uint8_t *result, size_t size)
+{
+	if (length > size) return -1;
+	memcpy(result, args, length);
+	return length;
+}
+
+static int rpcCounters(const uint8_t *args, size_t length, uint8_t *result, size_t size)
+{
+	TELEMETRY_t t;
+	RELIABLE_STATS_t r;
+	telemetry_get(&t);
+	reliable_stats(&r);
+	uint32_t counters[] = {t.rxMessages, t.txMessages, t.dropTotal, t.freeHeap, r.sent, r.retransmits, r.acked};
+	if (sizeof(counters) > size) return -1;
+	for (int i=0;i<sizeof(counters)/sizeof(counters[0]);i++) {
+		frame_put32(&result[i*4], counters[i]);
+	}
+	return sizeof(counters);
+}
+
+#if CONFIG_STICKC || CONFIG_STICKC_PLUS
+static int rpcBattery(const uint8_t *args, size_t length, uint8_t *result, size_t size)
+{
+	SENSOR_t s;
+	if (13 > size || sensor_get(&s) == false) return -1;
+	frame_put16(&result[0], s.adc.batVoltage);
+	frame_put32(&result[2], s.adc.batCurrent);
+	result[6] = s.vbus;
+	frame_put16(&result[7], s.adc.temperature);
+	frame_put32(&result[9], s.coulomb);
+	return 13;
+}
+#endif
+
+static int rpcConfig(const uint8_t *args, size_t length, uint8_t *result, size_t size)
+{
+	size_t nameLength = strlen(DEVICE_NAME);
+	if (6 + nameLength > size) return -1;
+	frame_put32(&result[0], ratemgr_period_ms());
+	result[4] = RELIABLE_WINDOW;
+	result[5] = link_caps();
+	memcpy(&result[6], DEVICE_NAME, nameLength);
+	return 6 + nameLength;
+}
+
+#if CONFIG_STICKC || CONFIG_STICKC_PLUS
+// Queues every file on SPIFFS for the acceptor
+static void sendFiles(char * path)
+{
+	DIR* dir = opendir(path);
+	if (dir == NULL) return;
+	while (true) {
+		struct dirent*pe = readdir(dir);
+		if (!pe) break;
+		char file[XFER_PATH];
+		snprintf(file, sizeof(file), "%s/%s", path, pe->d_name);
+		if (xfer_send(file) == false) {
+			ESP_LOGW(SPP_TAG, "transfer queue full, %s not sent", file);
+			break;
+		}
+	}
+	closedir(dir);
+}
+#endif
+
 static void esp_bt_gap_cb(esp_bt_gap_cb_event_t event, esp_bt_gap_cb_param_t *param)
 {
 	switch(event){
@@ -249,15 +424,14 @@ static void esp_bt_gap_cb(esp_bt_gap_cb_event_t event, esp_bt_gap_cb_param_t *pa
 				ESP_LOG_BUFFER_HEXDUMP(SPP_TAG, peer_bdname, peer_bdname_len, ESP_LOG_INFO);
 				if (strlen(remote_device_name) == peer_bdname_len
 					&& strncmp(peer_bdname, remote_device_name, peer_bdname_len) == 0) {
-					memcpy(peer_bd_addr, param->disc_res.bda, ESP_BD_ADDR_LEN);
-					esp_spp_start_discovery(peer_bd_addr);
-					esp_bt_gap_cancel_discovery();
+					connmgr_found(param->disc_res.bda);
 				}
 			}
 		}
 		break;
 	case ESP_BT_GAP_DISC_STATE_CHANGED_EVT:
-		ESP_LOGI(SPP_TAG, "ESP_BT_GAP_DISC_STATE_CHANGED_EVT");
+		ESP_LOGI(SPP_TAG, "ESP_BT_GAP_DISC_STATE_CHANGED_EVT state=%d", param->disc_st_chg.state);
+		if (param->disc_st_chg.state == ESP_BT_GAP_DISCOVERY_STOPPED) connmgr_discovery_stopped();
 		break;
 	case ESP_BT_GAP_RMT_SRVCS_EVT:
 		ESP_LOGI(SPP_TAG, "ESP_BT_GAP_RMT_SRVCS_EVT");
@@ -305,138 +479,39 @@ static void esp_bt_gap_cb(esp_bt_gap_cb_event_t event, esp_bt_gap_cb_param_t *pa
 		break;
 #endif
 
-	default:
+	case ESP_BT_GAP_MODE_CHG_EVT:
+		ESP_LOGI(SPP_TAG, "ESP_BT_GAP_MODE_CHG_EVT mode:%d", param->mode_chg.mode);
+		powermgr_link_mode(param->mode_chg.mode);
 		break;
-	}
-}
-
-#if CONFIG_STICK || CONFIG_STICKC || CONFIG_STICKC_PLUS
-void buttonStick(void *pvParameters)
-{
-	ESP_LOGI(pcTaskGetName(NULL), "Start");
-	CMD_t cmdBuf;
-	cmdBuf.taskHandle = xTaskGetCurrentTaskHandle();
-
-	// set the GPIO as a input
-	gpio_reset_pin(GPIO_INPUT);
-	gpio_set_direction(GPIO_INPUT, GPIO_MODE_DEF_INPUT);
 
-	while(1) {
-		int level = gpio_get_level(GPIO_INPUT);
-		if (level == 0) {
-			ESP_LOGI(pcTaskGetName(NULL), "Push Button");
-			cmdBuf.command = CMD_START;
-			TickType_t startTick = xTaskGetTickCount();
-			while(1) {
-				level = gpio_get_level(GPIO_INPUT);
-				if (level == 1) break;
-				vTaskDelay(1);
-			}
-			TickType_t endTick = xTaskGetTickCount();
-			TickType_t diffTick = endTick-startTick;
-			ESP_LOGI(pcTaskGetName(NULL),"diffTick=%"PRIu32, diffTick);
-			cmdBuf.command = CMD_START;
-			if (diffTick > 200) cmdBuf.command = CMD_STOP;
-			xQueueSend(xQueueCmd, &cmdBuf, 0);
-		}
-		vTaskDelay(1);
+	default:
+		break;
 	}
 }
-#endif
-
 
 #if CONFIG_STACK
-void buttonA(void *pvParameters)
-{
-	ESP_LOGI(pcTaskGetName(NULL), "Start");
-	CMD_t cmdBuf;
-	cmdBuf.command = CMD_SEND;
-	strcpy((char *)cmdBuf.payload, "abcdefghijk");
-	cmdBuf.length = strlen((char *)cmdBuf.payload);
-	cmdBuf.taskHandle = xTaskGetCurrentTaskHandle();
-
-	// set the GPIO as a input
-	gpio_reset_pin(GPIO_INPUT_A);
-	gpio_set_direction(GPIO_INPUT_A, GPIO_MODE_DEF_INPUT);
-
-	while(1) {
-		int level = gpio_get_level(GPIO_INPUT_A);
-		if (level == 0) {
-			ESP_LOGI(pcTaskGetName(NULL), "Push Button");
-			while(1) {
-				level = gpio_get_level(GPIO_INPUT_A);
-				if (level == 1) break;
-				vTaskDelay(1);
-			}
-			xQueueSend(xQueueCmd, &cmdBuf, 0);
-		}
-		vTaskDelay(1);
-	}
-}
-
-void buttonB(void *pvParameters)
-{
-	ESP_LOGI(pcTaskGetName(NULL), "Start");
-	CMD_t cmdBuf;
-	cmdBuf.command = CMD_SEND;
-	strcpy((char *)cmdBuf.payload, "01234567890");
-	cmdBuf.length = strlen((char *)cmdBuf.payload);
-	cmdBuf.taskHandle = xTaskGetCurrentTaskHandle();
-
-	// set the GPIO as a input
-	gpio_reset_pin(GPIO_INPUT_B);
-	gpio_set_direction(GPIO_INPUT_B, GPIO_MODE_DEF_INPUT);
-
-	while(1) {
-		int level = gpio_get_level(GPIO_INPUT_B);
-		if (level == 0) {
-			ESP_LOGI(pcTaskGetName(NULL), "Push Button");
-			while(1) {
-				level = gpio_get_level(GPIO_INPUT_B);
-				if (level == 1) break;
-				vTaskDelay(1);
-			}
-			xQueueSend(xQueueCmd, &cmdBuf, 0);
-		}
-		vTaskDelay(1);
-	}
-}
-
-void buttonC(void *pvParameters)
+void tft(void *pvParameters)
 {
 	ESP_LOGI(pcTaskGetName(NULL), "Start");
-	CMD_t cmdBuf;
-	cmdBuf.command = CMD_SEND;
-	strcpy((char *)cmdBuf.payload, "ABCDEFGHIJK");
-	cmdBuf.length = strlen((char *)cmdBuf.payload);
-	cmdBuf.taskHandle = xTaskGetCurrentTaskHandle();
-
-	// set the GPIO as a input
-	gpio_reset_pin(GPIO_INPUT_C);
-	gpio_set_direction(GPIO_INPUT_C, GPIO_MODE_DEF_INPUT);
 
-	while(1) {
-		int level = gpio_get_level(GPIO_INPUT_C);
-		if (level == 0) {
-			ESP_LOGI(pcTaskGetName(NULL), "Push Button");
-			while(1) {
-				level = gpio_get_level(GPIO_INPUT_C);
-				if (level == 1) break;
-				vTaskDelay(1);
-			}
-			xQueueSend(xQueueCmd, &cmdBuf, 0);
-		}
-		vTaskDelay(1);
-	}
-}
-#endif
+	// Setup Screen
+	// This runs while app_main brings up BT and SPIFFS
+	boot_begin(BOOT_PANEL);
+	TFT_t dev;
+	spi_master_init(&dev, CS_GPIO, DC_GPIO, RESET_GPIO, BL_GPIO);
+	lcdInit(&dev, 0x9341, SCREEN_WIDTH, SCREEN_HEIGHT, 0, 0);
+	ESP_LOGI(pcTaskGetName(NULL), "Setup Screen done");
+	boot_end(BOOT_PANEL);
 
+	// Initial Screen
+	uint8_t ascii[MAX_CHARACTER+1];
+	lcdFillScreen(&dev, BLACK);
+	lcdSetFontDirection(&dev, 0);
+	boot_end(BOOT_FIRST_PIXEL);
 
-#if CONFIG_STACK
-void tft(void *pvParameters)
-{
-	ESP_LOGI(pcTaskGetName(NULL), "Start");
 	// set font file
+	boot_wait(BOOT_SPIFFS);
+	boot_begin(BOOT_FONT);
 	FontxFile fxG[2];
 	InitFontx(fxG,"/spiffs/ILGH24XB.FNT",""); // 12x24Dot Gothic
 	FontxFile fxM[2];
@@ -448,17 +523,7 @@ void tft(void *pvParameters)
 	uint8_t fontHeight;
 	GetFontx(fxG, 0, buffer, &fontWidth, &fontHeight);
 	ESP_LOGD(pcTaskGetName(NULL), "fontWidth=%d fontHeight=%d",fontWidth,fontHeight);
-
-	// Setup Screen
-	TFT_t dev;
-	spi_master_init(&dev, CS_GPIO, DC_GPIO, RESET_GPIO, BL_GPIO);
-	lcdInit(&dev, 0x9341, SCREEN_WIDTH, SCREEN_HEIGHT, 0, 0);
-	ESP_LOGI(pcTaskGetName(NULL), "Setup Screen done");
-
-	// Initial Screen
-	uint8_t ascii[MAX_CHARACTER+1];
-	lcdFillScreen(&dev, BLACK);
-	lcdSetFontDirection(&dev, 0);
+	boot_end(BOOT_FONT);
 	strcpy((char *)ascii, "SPP INITIATOR");
 	lcdDrawString(&dev, fxG, 0, FONT_HEIGHT-1, ascii, RED);
 	strcpy((char *)ascii, "Not Connect");
@@ -469,33 +534,47 @@ void tft(void *pvParameters)
 	uint32_t sppHandle = 0;
 	bool clearScreen = false;
 
-	CMD_t cmdBuf;
+	CMD_t *cmd = NULL;
 	while(1) {
-		xQueueReceive(xQueueCmd, &cmdBuf, portMAX_DELAY);
-		ESP_LOGD(pcTaskGetName(NULL),"cmdBuf.command=%d", cmdBuf.command);
-		if (cmdBuf.command == CMD_OPEN) {
-			sppHandle = cmdBuf.sppHandle;
+		// Done with the previous message
+		msgpool_free(cmd);
+		cmd = NULL;
+		// Also wakes up when a message is due for retransmission
+		if (xQueueReceive(xQueueCmd, &cmd, reliable_poll(sppHandle)) != pdTRUE) continue;
+		ESP_LOGD(pcTaskGetName(NULL),"cmd->command=%d", cmd->command);
+		if (cmd->command == CMD_OPEN) {
+			sppHandle = cmd->sppHandle;
+			link_open(sppHandle);
+			reliable_open(sppHandle);
+			flushBacklog(sppHandle);
 			strcpy((char *)ascii, "Connect");
 			lcdDrawFillRect(&dev, xstatus, 0, SCREEN_WIDTH-1, FONT_HEIGHT-1, BLACK);
 			lcdDrawString(&dev, fxG, xstatus, FONT_HEIGHT-1, ascii, RED);
 
-		} else if (cmdBuf.command == CMD_CLOSE) {
+		} else if (cmd->command == CMD_CLOSE) {
 			sppHandle = 0;
 			strcpy((char *)ascii, "Not Connect");
 			lcdDrawFillRect(&dev, xstatus, 0, SCREEN_WIDTH-1, FONT_HEIGHT-1, BLACK);
 			lcdDrawString(&dev, fxG, xstatus, FONT_HEIGHT-1, ascii, RED);
 
-		} else if (cmdBuf.command == CMD_SEND) {
-			if (sppHandle == 0) continue;
-			esp_spp_write(sppHandle, cmdBuf.length, cmdBuf.payload);
-			if (clearScreen) lcdDrawFillRect(&dev, 0, FONT_HEIGHT-1, SCREEN_WIDTH-1, SCREEN_HEIGHT-1, BLACK);
-			lcdDrawString(&dev, fxM, 0, ypos, cmdBuf.payload, color);
-			ypos = ypos + FONT_HEIGHT;
-			clearScreen = false;
-			if (ypos >= SCREEN_HEIGHT) {
-				ypos = (FONT_HEIGHT*2) - 1;
-				clearScreen = true;
+		} else if (cmd->command == CMD_ACK) {
+			reliable_ack(cmd->payload, cmd->length);
+			flushBacklog(sppHandle);
+
+		} else if (cmd->command == CMD_SEND) {
+			if (sppHandle != 0) {
+				if (clearScreen) lcdDrawFillRect(&dev, 0, FONT_HEIGHT-1, SCREEN_WIDTH-1, SCREEN_HEIGHT-1, BLACK);
+				lcdDrawString(&dev, fxM, 0, ypos, cmd->payload, color);
+				ypos = ypos + FONT_HEIGHT;
+				clearScreen = false;
+				if (ypos >= SCREEN_HEIGHT) {
+					ypos = (FONT_HEIGHT*2) - 1;
+					clearScreen = true;
+				}
 			}
+			// Sent now, or when the link is back
+			sendMessage(sppHandle, cmd);
+			cmd = NULL;
 		}
 	}
 
@@ -506,38 +585,141 @@ void tft(void *pvParameters)
 }
 #endif
 
+#if CONFIG_STICKC || CONFIG_STICKC_PLUS
+// Battery fields of the telemetry record
+static void sensorRecord(RECORD_t *rec)
+{
+	SENSOR_t s;
+	if (sensor_get(&s) == false) return;
+	RECORD_SET(rec, batVoltage, s.adc.batVoltage);
+	RECORD_SET(rec, batCurrent, s.adc.batCurrent / 1000);
+	RECORD_SET(rec, temperature, s.adc.temperature);
+}
+#endif
+
 #if CONFIG_STICKC
+// One binary record, the acceptor formats it when it draws it
 static void timer_cb(TimerHandle_t arg)
 {
 	static uint32_t counter = 0;
-	CMD_t cmdBuf;
-	cmdBuf.command = CMD_SEND;
-	sprintf((char *)cmdBuf.payload, "This is M5StickC:%"PRIu32, counter);
-	cmdBuf.length = strlen((char *)cmdBuf.payload);
-	xQueueSend(xQueueCmd, &cmdBuf, 0);
+	ratemgr_tick();
+	CMD_t *cmd = msgpool_alloc(CMD_SEND, RECORD_MAX);
+	if (cmd != NULL) {
+		RECORD_t rec = {0};
+		RECORD_SET(&rec, device, RECORD_STICKC);
+		RECORD_SET(&rec, counter, counter);
+		RECORD_SET(&rec, time, cmd->stamp);
+		sensorRecord(&rec);
+		cmd->length = record_encode(&rec, cmd->payload);
+	}
+	telemetry_send(xQueueCmd, cmd, 0);
 	counter++;
 }
 #endif
 
 
 #if CONFIG_STICKC || CONFIG_STICKC_PLUS
+// Telemetry page over the whole screen
+#if CONFIG_STICKC
+static void drawStats(ST7735_t * dev, FontxFile *fx)
+#else
+static void drawStats(TFT_t * dev, FontxFile *fx)
+#endif
+{
+	TELEMETRY_t t;
+	telemetry_get(&t);
+	char lines[SCREEN_HEIGHT/FONT_HEIGHT][TELEMETRY_LINE];
+	int num = telemetry_format(&t, lines, SCREEN_HEIGHT/FONT_HEIGHT);
+	lcdFillScreen(dev, BLACK);
+	for (int i=0;i<num;i++) {
+		lcdDrawString(dev, fx, 0, (FONT_HEIGHT*(i+1))-1, (uint8_t *)lines[i], GREEN);
+	}
+}
+
+// Battery and energy per message over the whole screen
+#if CONFIG_STICKC
+static void drawPower(ST7735_t * dev, FontxFile *fx)
+#else
+static void drawPower(TFT_t * dev, FontxFile *fx)
+#endif
+{
+	POWER_t p;
+	power_get(&p);
+	char lines[SCREEN_HEIGHT/FONT_HEIGHT][TELEMETRY_LINE];
+	int num = power_format(&p, lines, SCREEN_HEIGHT/FONT_HEIGHT);
+	lcdFillScreen(dev, BLACK);
+	for (int i=0;i<num;i++) {
+		lcdDrawString(dev, fx, 0, (FONT_HEIGHT*(i+1))-1, (uint8_t *)lines[i], p.vbus ? YELLOW : GREEN);
+	}
+}
+
+// Title and connection status
+#if CONFIG_STICKC
+static void drawStatus(ST7735_t * dev, FontxFile *fx, uint32_t sppHandle, bool sendStatus)
+#else
+static void drawStatus(TFT_t * dev, FontxFile *fx, uint32_t sppHandle, bool sendStatus)
+#endif
+{
+	uint8_t ascii[MAX_CHARACTER+1];
+	lcdFillScreen(dev, BLACK);
+	strcpy((char *)ascii, "SPP");
+	lcdDrawString(dev, fx, 0, (FONT_HEIGHT*1)-1, ascii, YELLOW);
+	strcpy((char *)ascii, "INITIATOR");
+	lcdDrawString(dev, fx, 0, (FONT_HEIGHT*2)-1, ascii, YELLOW);
+	if (sppHandle == 0) {
+		strcpy((char *)ascii, "DisConnect");
+		lcdDrawString(dev, fx, 0, (FONT_HEIGHT*4)-1, ascii, RED);
+		return;
+	}
+	strcpy((char *)ascii, "Connect");
+	lcdDrawString(dev, fx, 0, (FONT_HEIGHT*4)-1, ascii, CYAN);
+	if (sendStatus) {
+		strcpy((char *)ascii, "Start");
+		lcdDrawString(dev, fx, 0, (FONT_HEIGHT*5)-1, ascii, CYAN);
+	} else {
+		strcpy((char *)ascii, "Stop");
+		lcdDrawString(dev, fx, 0, (FONT_HEIGHT*5)-1, ascii, RED);
+	}
+}
+
+// SPI clock calibration of the panel.
+// There is no MISO line, so only the fill time tells whether a clock pays off.
+static bool panelSetClock(void *dev, int hz)
+{
+	return spi_master_set_clock(dev, hz);
+}
+
+static void panelFill(void *dev)
+{
+	lcdFillScreen(dev, BLACK);
+}
+
+static void panelCalibrate(void *dev)
+{
+	SPICLOCK_PANEL_t panel = {
+#if CONFIG_STICKC
+		.name = "st7735s",
+#endif
+#if CONFIG_STICKC_PLUS
+		.name = "st7789",
+#endif
+		.dev = dev,
+		// Nothing can check the pixels, so stay within the controller's rating
+		.candidates = {SPI_MASTER_FREQ_20M, SPI_MASTER_FREQ_26M, SPI_MASTER_FREQ_40M},
+		.set_clock = panelSetClock,
+		.verify = NULL,
+		.fill = panelFill,
+	};
+	spiclock_calibrate(&panel);
+}
+
 void tft(void *pvParameters)
 {
 	ESP_LOGI(pcTaskGetName(NULL), "Start");
-	// set font file
-	FontxFile fxG[2];
-	InitFontx(fxG,"/spiffs/ILGH16XB.FNT",""); // 8x16Dot Gothic
-	FontxFile fxM[2];
-	InitFontx(fxM,"/spiffs/ILMH16XB.FNT",""); // 8x16Dot Mincyo
-
-	// get font width & height
-	uint8_t buffer[FontxGlyphBufSize];
-	uint8_t fontWidth;
-	uint8_t fontHeight;
-	GetFontx(fxG, 0, buffer, &fontWidth, &fontHeight);
-	ESP_LOGD(pcTaskGetName(NULL), "fontWidth=%d fontHeight=%d",fontWidth,fontHeight);
 
 	// Setup Screen
+	// This runs while app_main brings up BT and SPIFFS
+	boot_begin(BOOT_PANEL);
 #if CONFIG_STICKC
 	ST7735_t dev;
 	spi_master_init(&dev, GPIO_MOSI, GPIO_SCLK, GPIO_CS, GPIO_DC, GPIO_RESET);
@@ -548,11 +730,33 @@ void tft(void *pvParameters)
 #endif
 	lcdInit(&dev, SCREEN_WIDTH, SCREEN_HEIGHT, OFFSET_X, OFFSET_Y);
 	ESP_LOGI(pcTaskGetName(NULL), "Setup Screen done");
+	boot_end(BOOT_PANEL);
 
 	// Initial Screen
 	uint8_t ascii[MAX_CHARACTER+1];
 	lcdFillScreen(&dev, BLACK);
 	lcdSetFontDirection(&dev, 0);
+	boot_end(BOOT_FIRST_PIXEL);
+
+	// The clock is stored in NVS once probed
+	boot_wait(BOOT_NVS);
+	panelCalibrate(&dev);
+
+	// set font file
+	boot_wait(BOOT_SPIFFS);
+	boot_begin(BOOT_FONT);
+	FontxFile fxG[2];
+	InitFontx(fxG,"/spiffs/ILGH16XB.FNT",""); // 8x16Dot Gothic
+	FontxFile fxM[2];
+	InitFontx(fxM,"/spiffs/ILMH16XB.FNT",""); // 8x16Dot Mincyo
+
+	// get font width & height
+	uint8_t buffer[FontxGlyphBufSize];
+	uint8_t fontWidth;
+	uint8_t fontHeight;
+	GetFontx(fxG, 0, buffer, &fontWidth, &fontHeight);
+	ESP_LOGD(pcTaskGetName(NULL), "fontWidth=%d fontHeight=%d",fontWidth,fontHeight);
+	boot_end(BOOT_FONT);
 	strcpy((char *)ascii, "SPP");
 	lcdDrawString(&dev, fxG, 0, (FONT_HEIGHT*1)-1, ascii, YELLOW);
 	strcpy((char *)ascii, "INITIATOR");
@@ -562,22 +766,44 @@ void tft(void *pvParameters)
 
 	uint32_t sppHandle = 0;
 	bool sendStatus = false;
-	CMD_t cmdBuf;
+	// Button B cycles status, telemetry and power pages
+	enum { PAGE_STATUS, PAGE_TELEMETRY, PAGE_POWER, PAGE_MAX } page = PAGE_STATUS;
+	CMD_t *cmd = NULL;
 
 	while(1) {
-		xQueueReceive(xQueueCmd, &cmdBuf, portMAX_DELAY);
-		ESP_LOGD(pcTaskGetName(NULL),"cmdBuf.command=%d", cmdBuf.command);
-		if (cmdBuf.command == CMD_OPEN) {
-			sppHandle = cmdBuf.sppHandle;
-			strcpy((char *)ascii, "Connect");
-			lcdDrawFillRect(&dev, 0, (FONT_HEIGHT*3), SCREEN_WIDTH-1, (FONT_HEIGHT*4)-1, BLACK);
-			lcdDrawString(&dev, fxG, 0, (FONT_HEIGHT*4)-1, ascii, CYAN);
-			strcpy((char *)ascii, "Stop");
-			lcdDrawFillRect(&dev, 0, (FONT_HEIGHT*4), SCREEN_WIDTH-1, (FONT_HEIGHT*5)-1, BLACK);
-			lcdDrawString(&dev, fxG, 0, (FONT_HEIGHT*5)-1, ascii, RED);
+		// Done with the previous message
+		msgpool_free(cmd);
+		cmd = NULL;
+		// Also wakes up when a message is due for retransmission
+		if (xQueueReceive(xQueueCmd, &cmd, reliable_poll(sppHandle)) != pdTRUE) continue;
+		ESP_LOGD(pcTaskGetName(NULL),"cmd->command=%d", cmd->command);
+		if (cmd->command == CMD_STATS) {
+			page = (page + 1) % PAGE_MAX;
+			if (page == PAGE_TELEMETRY) {
+				drawStats(&dev, fxG);
+			} else if (page == PAGE_POWER) {
+				drawPower(&dev, fxG);
+			} else {
+				drawStatus(&dev, fxG, sppHandle, sendStatus);
+			}
 
-		} else if (cmdBuf.command == CMD_CLOSE) {
+		} else if (cmd->command == CMD_TELEMETRY) {
+			if (page == PAGE_TELEMETRY) drawStats(&dev, fxG);
+			if (page == PAGE_POWER) drawPower(&dev, fxG);
+
+		} else if (cmd->command == CMD_OPEN) {
+			sppHandle = cmd->sppHandle;
+			link_open(sppHandle);
+			reliable_open(sppHandle);
+			xfer_tx_open(sppHandle);
+			if (sendStatus) flushBacklog(sppHandle);
+			if (page != PAGE_STATUS) continue;
+			// Redraws the sending state too, which survives a reconnect
+			drawStatus(&dev, fxG, sppHandle, sendStatus);
+
+		} else if (cmd->command == CMD_CLOSE) {
 			sppHandle = 0;
+			if (page != PAGE_STATUS) continue;
 			strcpy((char *)ascii, "DisConnect");
 			lcdDrawFillRect(&dev, 0, (FONT_HEIGHT*3), SCREEN_WIDTH-1, (FONT_HEIGHT*4)-1, BLACK);
 			lcdDrawString(&dev, fxG, 0, (FONT_HEIGHT*4)-1, ascii, RED);
@@ -585,24 +811,35 @@ void tft(void *pvParameters)
 			lcdDrawFillRect(&dev, 0, (FONT_HEIGHT*4), SCREEN_WIDTH-1, (FONT_HEIGHT*5)-1, BLACK);
 			//lcdDrawString(&dev, fxG, 0, (FONT_HEIGHT*5)-1, ascii, RED);
 
-		} else if (cmdBuf.command == CMD_START) {
+		} else if (cmd->command == CMD_START) {
 			if (sppHandle == 0) continue;
+			sendStatus = true;
+			if (page != PAGE_STATUS) continue;
 			strcpy((char *)ascii, "Start");
 			lcdDrawFillRect(&dev, 0, (FONT_HEIGHT*4), SCREEN_WIDTH-1, (FONT_HEIGHT*5)-1, BLACK);
 			lcdDrawString(&dev, fxG, 0, (FONT_HEIGHT*5)-1, ascii, CYAN);
-			sendStatus = true;
 
-		} else if (cmdBuf.command == CMD_STOP) {
+		} else if (cmd->command == CMD_STOP) {
 			if (sppHandle == 0) continue;
+			sendStatus = false;
+			if (page != PAGE_STATUS) continue;
 			strcpy((char *)ascii, "Stop");
 			lcdDrawFillRect(&dev, 0, (FONT_HEIGHT*4), SCREEN_WIDTH-1, (FONT_HEIGHT*5)-1, BLACK);
 			lcdDrawString(&dev, fxG, 0, (FONT_HEIGHT*5)-1, ascii, RED);
-			sendStatus = false;
 
-		} else if (cmdBuf.command == CMD_SEND) {
-			if (sppHandle == 0) continue;
+		} else if (cmd->command == CMD_ACK) {
+			reliable_ack(cmd->payload, cmd->length);
+			flushBacklog(sppHandle);
+
+		} else if (cmd->command == CMD_XFER) {
+			// Sent by the xfer task, also across reconnects
+			sendFiles("/spiffs");
+
+		} else if (cmd->command == CMD_SEND) {
 			if (!sendStatus) continue;
-			esp_spp_write(sppHandle, cmdBuf.length, cmdBuf.payload);
+			// Sent now, or when the link is back
+			sendMessage(sppHandle, cmd);
+			cmd = NULL;
 		}
 	}
 
@@ -614,28 +851,41 @@ void tft(void *pvParameters)
 #endif
 
 #if CONFIG_STICKC_PLUS
+// One binary record, the acceptor formats it when it draws it
 static void timer_cb(TimerHandle_t arg)
 {
 	static uint32_t counter = 0;
-	CMD_t cmdBuf;
-	cmdBuf.command = CMD_SEND;
-	sprintf((char *)cmdBuf.payload, "This is M5StickC+:%"PRIu32, counter);
-	cmdBuf.length = strlen((char *)cmdBuf.payload);
-	xQueueSend(xQueueCmd, &cmdBuf, 0);
+	ratemgr_tick();
+	CMD_t *cmd = msgpool_alloc(CMD_SEND, RECORD_MAX);
+	if (cmd != NULL) {
+		RECORD_t rec = {0};
+		RECORD_SET(&rec, device, RECORD_STICKC_PLUS);
+		RECORD_SET(&rec, counter, counter);
+		RECORD_SET(&rec, time, cmd->stamp);
+		sensorRecord(&rec);
+		cmd->length = record_encode(&rec, cmd->payload);
+	}
+	telemetry_send(xQueueCmd, cmd, 0);
 	counter++;
 }
 #endif
 
 
 #if CONFIG_STICK
+// One binary record, the acceptor formats it when it draws it
 static void timer_cb(TimerHandle_t arg)
 {
 	static uint32_t counter = 0;
-	CMD_t cmdBuf;
-	cmdBuf.command = CMD_SEND;
-	sprintf((char *)cmdBuf.payload, "This is M5Stick:%"PRIu32, counter);
-	cmdBuf.length = strlen((char *)cmdBuf.payload);
-	xQueueSend(xQueueCmd, &cmdBuf, 0);
+	ratemgr_tick();
+	CMD_t *cmd = msgpool_alloc(CMD_SEND, RECORD_MAX);
+	if (cmd != NULL) {
+		RECORD_t rec = {0};
+		RECORD_SET(&rec, device, RECORD_STICK);
+		RECORD_SET(&rec, counter, counter);
+		RECORD_SET(&rec, time, cmd->stamp);
+		cmd->length = record_encode(&rec, cmd->payload);
+	}
+	telemetry_send(xQueueCmd, cmd, 0);
 	counter++;
 }
 #endif
@@ -647,13 +897,17 @@ void tft(void *pvParameters)
 	ESP_LOGI(pcTaskGetName(NULL), "Start");
 
 	// Setup Screen
+	// This runs while app_main brings up BT
+	boot_begin(BOOT_PANEL);
 	SH1107_t dev;
 	spi_master_init(&dev);
 	spi_init(&dev, 64, 128);
 	ESP_LOGI(pcTaskGetName(NULL), "Setup Screen done");
+	boot_end(BOOT_PANEL);
 
 	// Initial Screen
 	clear_screen(&dev, false);
+	boot_end(BOOT_FIRST_PIXEL);
 	display_contrast(&dev, 0xff);
 	char ascii[MAX_CHARACTER+1];
 	strcpy(ascii, "SPP	   ");
@@ -663,41 +917,54 @@ void tft(void *pvParameters)
 
 	uint32_t sppHandle = 0;
 	bool sendStatus = false;
-	CMD_t cmdBuf;
+	CMD_t *cmd = NULL;
 
 	while(1) {
-		xQueueReceive(xQueueCmd, &cmdBuf, portMAX_DELAY);
-		ESP_LOGD(pcTaskGetName(NULL),"cmdBuf.command=%d", cmdBuf.command);
-		if (cmdBuf.command == CMD_OPEN) {
-			sppHandle = cmdBuf.sppHandle;
+		// Done with the previous message
+		msgpool_free(cmd);
+		cmd = NULL;
+		// Also wakes up when a message is due for retransmission
+		if (xQueueReceive(xQueueCmd, &cmd, reliable_poll(sppHandle)) != pdTRUE) continue;
+		ESP_LOGD(pcTaskGetName(NULL),"cmd->command=%d", cmd->command);
+		if (cmd->command == CMD_OPEN) {
+			sppHandle = cmd->sppHandle;
+			link_open(sppHandle);
+			reliable_open(sppHandle);
+			if (sendStatus) flushBacklog(sppHandle);
 			strcpy((char *)ascii, "Connect ");
 			display_text(&dev, 3, ascii, 8, false);
-			strcpy((char *)ascii, "Stop    ");
+			// The sending state survives a reconnect
+			strcpy((char *)ascii, sendStatus ? "Start   " : "Stop    ");
 			display_text(&dev, 5, ascii, 8, false);
 
-		} else if (cmdBuf.command == CMD_CLOSE) {
+		} else if (cmd->command == CMD_CLOSE) {
 			sppHandle = 0;
 			strcpy((char *)ascii, "		   ");
 			display_text(&dev, 3, ascii, 8, false);
 			strcpy((char *)ascii, "		   ");
 			display_text(&dev, 5, ascii, 8, false);
 
-		} else if (cmdBuf.command == CMD_START) {
+		} else if (cmd->command == CMD_START) {
 			if (sppHandle == 0) continue;
 			strcpy((char *)ascii, "Start   ");
 			display_text(&dev, 5, ascii, 8, false);
 			sendStatus = true;
 
-		} else if (cmdBuf.command == CMD_STOP) {
+		} else if (cmd->command == CMD_STOP) {
 			if (sppHandle == 0) continue;
 			strcpy((char *)ascii, "Stop    ");
 			display_text(&dev, 5, ascii, 8, false);
 			sendStatus = false;
 
-		} else if (cmdBuf.command == CMD_SEND) {
-			if (sppHandle == 0) continue;
+		} else if (cmd->command == CMD_ACK) {
+			reliable_ack(cmd->payload, cmd->length);
+			flushBacklog(sppHandle);
+
+		} else if (cmd->command == CMD_SEND) {
 			if (!sendStatus) continue;
-			esp_spp_write(sppHandle, cmdBuf.length, cmdBuf.payload);
+			// Sent now, or when the link is back
+			sendMessage(sppHandle, cmd);
+			cmd = NULL;
 		}
 	}
 
@@ -725,16 +992,62 @@ static void SPIFFS_Directory(char * path) {
 
 void app_main()
 {
-	for (int i = 0; i < SPP_DATA_LEN; ++i) {
-		spp_data[i] = i;
-	}
+	/* Create Queue */
+	// Sizes are in memplan_table.h.
+	// Ready before the BT stack can call back
+	xQueueCmd = memplan_queue_create(MEMPLAN_QUEUE_CMD);
+	msgpool_init();
+	connmgr_init();
+	powermgr_init();
+	// Frames go through their channel, then share writes of up to one RFCOMM MTU
+	coalesce_init(sppWrite, ESP_SPP_MAX_MTU);
+	mux_init(coalesce_write);
+	link_init(LINK_CAPS, mux_write, sppFrame);
+	reliable_init(RELIABLE_WINDOW, esp_random());
+	rpc_register(RPC_PING, rpcPing);
+	rpc_register(RPC_COUNTERS, rpcCounters);
+#if CONFIG_STICKC || CONFIG_STICKC_PLUS
+	rpc_register(RPC_BATTERY, rpcBattery);
+#endif
+	rpc_register(RPC_CONFIG, rpcConfig);
+	// The acceptor splits the latency of every message with this
+	rpc_register(RPC_CLOCK, probe_clock);
+
+#if CONFIG_STICK
+	boot_init(BOOT_BIT(BOOT_NVS) | BOOT_BIT(BOOT_BT) | BOOT_BIT(BOOT_PANEL) |
+		BOOT_BIT(BOOT_FIRST_PIXEL) | BOOT_BIT(BOOT_CONNECTABLE));
+#else
+	boot_init(BOOT_BIT(BOOT_NVS) | BOOT_BIT(BOOT_BT) | BOOT_BIT(BOOT_SPIFFS) | BOOT_BIT(BOOT_PANEL) |
+		BOOT_BIT(BOOT_FONT) | BOOT_BIT(BOOT_FIRST_PIXEL) | BOOT_BIT(BOOT_CONNECTABLE));
+#endif
+
+#if CONFIG_STICKC
+	// power on
+	i2c_master_init();
+	AXP192_PowerOn();
+#endif
 
+#if CONFIG_STICKC_PLUS
+	// power on
+	i2c_master_init();
+	AXP192_PowerOn();
+	AXP192_ScreenBreath(11);
+#endif
+
+	// The panel resets and initializes alongside the BT bringup.
+	// tft waits for SPIFFS only when it needs the fonts.
+	memplan_task_create(MEMPLAN_TASK_TFT, tft, NULL);
+
+	boot_begin(BOOT_NVS);
 	esp_err_t ret = nvs_flash_init();
 	if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
 		ESP_ERROR_CHECK(nvs_flash_erase());
 		ret = nvs_flash_init();
 	}
 	ESP_ERROR_CHECK( ret );
+	boot_end(BOOT_NVS);
+
+	boot_begin(BOOT_BT);
 
 	ESP_ERROR_CHECK(esp_bt_controller_mem_release(ESP_BT_MODE_BLE));
 
@@ -807,9 +1120,12 @@ void app_main()
 	esp_bt_pin_code_t pin_code;
 	esp_bt_gap_set_pin(pin_type, 0, pin_code);
 	ESP_LOGI(SPP_TAG, "esp_bt_gap_set_pin");
+	boot_end(BOOT_BT);
 
 
 #if CONFIG_STICKC || CONFIG_STICKC_PLUS || CONFIG_STACK
+	// Mounted while Bluedroid initializes SPP in its own task
+	boot_begin(BOOT_SPIFFS);
 	ESP_LOGI(SPP_TAG, "Initializing SPIFFS");
 	esp_vfs_spiffs_conf_t conf = {
 		.base_path = "/spiffs",
@@ -840,41 +1156,48 @@ void app_main()
 	} else {
 		ESP_LOGI(SPP_TAG,"Partition size: total: %d, used: %d", total, used);
 	}
+	boot_end(BOOT_SPIFFS);
 
 	SPIFFS_Directory("/spiffs");
 #endif
-
-	/* Create Queue */
-	xQueueCmd = xQueueCreate( 10, sizeof(CMD_t) );
-	configASSERT( xQueueCmd );
-
-#if CONFIG_STICKC
-	// power on
-	i2c_master_init();
-	AXP192_PowerOn();
-#endif
-
-#if CONFIG_STICKC_PLUS
-	// power on
-	i2c_master_init();
-	AXP192_PowerOn();
-	AXP192_ScreenBreath(11);
+#if CONFIG_STICKC || CONFIG_STICKC_PLUS
+	xfer_tx_init();
 #endif
 
-	xTaskCreate(tft, "TFT", 1024*4, NULL, 2, NULL);
-
 #if CONFIG_STACK
-	xTaskCreate(buttonA, "ButtonA", 1024*4, NULL, 2, NULL);
-	xTaskCreate(buttonB, "ButtonB", 1024*4, NULL, 2, NULL);
-	xTaskCreate(buttonC, "ButtonC", 1024*4, NULL, 2, NULL);
+	button_add(GPIO_INPUT_A, CMD_SEND, CMD_SEND, "abcdefghijk");
+	button_add(GPIO_INPUT_B, CMD_SEND, CMD_SEND, "01234567890");
+	button_add(GPIO_INPUT_C, CMD_SEND, CMD_SEND, "ABCDEFGHIJK");
+	memplan_task_create(MEMPLAN_TASK_BUTTON, button_task, xQueueCmd);
 #endif
 
 
 #if CONFIG_STICK || CONFIG_STICKC || CONFIG_STICKC_PLUS
-	TimerHandle_t timer = xTimerCreate("send_timer", 2000 / portTICK_PERIOD_MS, true, NULL, timer_cb);
-	xTimerStart(timer, 0);
-	xTaskCreate(buttonStick, "BUTTON", 1024*4, NULL, 2, NULL);
+	TimerHandle_t timer = xTimerCreate("send_timer", pdMS_TO_TICKS(1000000 / SEND_RATE_FLOOR), true, NULL, timer_cb);
+	RATEMGR_CONFIG_t rateConfig = {
+		.timer = timer,
+		.queue = xQueueCmd,
+		.window = RELIABLE_WINDOW,
+		.floor = SEND_RATE_FLOOR,
+		.ceiling = SEND_RATE_CEILING,
+	};
+	ratemgr_init(&rateConfig);
+	// Short press starts sending, long press stops
+	button_add(GPIO_INPUT, CMD_START, CMD_STOP, NULL);
+#if CONFIG_STICKC || CONFIG_STICKC_PLUS
+	// Button B cycles the telemetry and power pages, long press sends the files
+	button_add(GPIO_INPUT_B, CMD_STATS, CMD_XFER, NULL);
+#endif
+	memplan_task_create(MEMPLAN_TASK_BUTTON, button_task, xQueueCmd);
 #endif
+
+	telemetry_init(xQueueCmd, pdMS_TO_TICKS(5000));
+#if CONFIG_STICKC || CONFIG_STICKC_PLUS
+	memplan_task_create(MEMPLAN_TASK_SENSOR, sensor_task, NULL);
+	power_init(pdMS_TO_TICKS(SENSOR_PERIOD_MS));
+#endif
+
+	memplan_report_start(pdMS_TO_TICKS(60*1000));
 }
 
 
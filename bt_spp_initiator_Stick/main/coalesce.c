@@ -0,0 +1,140 @@
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/timers.h"
+#include "esp_log.h"
+
+#include "frame.h"
+#include "coalesce.h"
+
+#define TAG "COALESCE"
+
+typedef enum {
+	COALESCE_FULL,
+	COALESCE_URGENT,
+	COALESCE_TIMER,
+} coalesce_reason_t;
+
+static link_write_t coalesceWrite;
+static size_t coalesceMtu;
+
+// The mutex keeps the buffer and the order of the writes.
+// The timer flushes from the timer service task.
+static uint8_t buf[FRAME_HEADER + FRAME_MAX_PAYLOAD];
+static size_t have;
+static uint32_t pendingHandle;
+static SemaphoreHandle_t bufMutex;
+static StaticSemaphore_t bufMutexBuffer;
+static TimerHandle_t delayTimer;
+static StaticTimer_t delayTimerBuffer;
+
+static COALESCE_STATS_t stats;
+static portMUX_TYPE coalesceMux = portMUX_INITIALIZER_UNLOCKED;
+
+static void coalesce_put(uint32_t handle, const uint8_t *data, size_t length, coalesce_reason_t reason)
+{
+	coalesceWrite(handle, data, length);
+	taskENTER_CRITICAL(&coalesceMux);
+	stats.writes++;
+	stats.bytes += length;
+	if (reason == COALESCE_FULL) stats.full++;
+	else if (reason == COALESCE_URGENT) stats.urgent++;
+	else stats.timer++;
+	COALESCE_STATS_t current = stats;
+	taskEXIT_CRITICAL(&coalesceMux);
+
+	if (current.writes % COALESCE_REPORT) return;
+	uint32_t average = (uint64_t)current.bytes * 10 / current.writes;
+	uint32_t packing = (uint64_t)current.frames * 10 / current.writes;
+	ESP_LOGI(TAG, "%"PRIu32" writes avg %"PRIu32".%"PRIu32" bytes %"PRIu32".%"PRIu32" frames/write full %"PRIu32" urgent %"PRIu32" timer %"PRIu32,
+		current.writes, average / 10, average % 10, packing / 10, packing % 10,
+		current.full, current.urgent, current.timer);
+}
+
+// With the mutex held
+static void coalesce_drain(coalesce_reason_t reason)
+{
+	if (have == 0) return;
+	coalesce_put(pendingHandle, buf, have, reason);
+	have = 0;
+}
+
+static void coalesce_timer_cb(TimerHandle_t arg)
+{
+	xSemaphoreTake(bufMutex, portMAX_DELAY);
+	coalesce_drain(COALESCE_TIMER);
+	xSemaphoreGive(bufMutex);
+}
+
+void coalesce_init(link_write_t write, size_t mtu)
+{
+	configASSERT( mtu > 0 && mtu <= sizeof(buf) );
+	coalesceWrite = write;
+	coalesceMtu = mtu;
+	bufMutex = xSemaphoreCreateMutexStatic(&bufMutexBuffer);
+	configASSERT( bufMutex );
+	delayTimer = xTimerCreateStatic("coalesce", pdMS_TO_TICKS(COALESCE_DELAY_MS), false, NULL,
+		coalesce_timer_cb, &delayTimerBuffer);
+	configASSERT( delayTimer );
+}
+
+// DATA and CHUNK may wait, everything else is somebody waiting for an answer
+static bool coalesce_urgent(const uint8_t *data, size_t length)
+{
+	if (length < FRAME_HEADER || data[0] != FRAME_MAGIC) return false;
+	uint8_t type = data[1] & FRAME_TYPE_MASK;
+	return type != FRAME_DATA && type != FRAME_CHUNK;
+}
+
+bool coalesce_write(uint32_t handle, const uint8_t *data, size_t length)
+{
+	bool urgent = coalesce_urgent(data, length);
+	taskENTER_CRITICAL(&coalesceMux);
+	stats.frames++;
+	taskEXIT_CRITICAL(&coalesceMux);
+
+	xSemaphoreTake(bufMutex, portMAX_DELAY);
+	if (have && handle != pendingHandle) coalesce_drain(COALESCE_URGENT);
+	pendingHandle = handle;
+	while (length) {
+		if (have == 0 && length >= coalesceMtu) {
+			// Whole MTUs go straight from the caller
+			coalesce_put(handle, data, coalesceMtu, COALESCE_FULL);
+			data += coalesceMtu;
+			length -= coalesceMtu;
+			continue;
+		}
+		size_t n = coalesceMtu - have;
+		if (n > length) n = length;
+		memcpy(&buf[have], data, n);
+		have += n;
+		data += n;
+		length -= n;
+		if (have == coalesceMtu) coalesce_drain(COALESCE_FULL);
+	}
+	if (urgent) {
+		coalesce_drain(COALESCE_URGENT);
+	} else if (have && xTimerIsTimerActive(delayTimer) == pdFALSE) {
+		// Bounds the wait of the oldest byte. Without a timer it goes now.
+		if (xTimerStart(delayTimer, 0) != pdPASS) coalesce_drain(COALESCE_TIMER);
+	}
+	xSemaphoreGive(bufMutex);
+	return true;
+}
+
+void coalesce_close(void)
+{
+	xSemaphoreTake(bufMutex, portMAX_DELAY);
+	have = 0;
+	xSemaphoreGive(bufMutex);
+}
+
+void coalesce_stats(COALESCE_STATS_t *current)
+{
+	taskENTER_CRITICAL(&coalesceMux);
+	*current = stats;
+	taskEXIT_CRITICAL(&coalesceMux);
+}
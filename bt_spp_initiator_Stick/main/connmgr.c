@@ -0,0 +1,217 @@
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/timers.h"
+#include "esp_idf_version.h"
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+#include "esp_random.h"
+#else
+#include "esp_system.h"
+#endif
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "esp_gap_bt_api.h"
+
+#include "memplan.h"
+#include "msgpool.h"
+#include "peer.h"
+#include "connmgr.h"
+
+#define TAG "CONNMGR"
+
+static const esp_spp_sec_t sec_mask = ESP_SPP_SEC_AUTHENTICATE;
+static const esp_spp_role_t role_master = ESP_SPP_ROLE_MASTER;
+static const esp_bt_inq_mode_t inq_mode = ESP_BT_INQ_MODE_GENERAL_INQUIRY;
+static const uint8_t inq_len = 30;
+static const uint8_t inq_num_rsps = 0;
+
+static const char * stateName[] = {
+	"idle", "discovering", "sdp", "connecting", "open", "backoff"
+};
+
+// Transitions run in the BTC task. The backoff timer only leaves BACKOFF,
+// where no BT request is outstanding, so the two never race on the state.
+static conn_state_t state = CONN_IDLE;
+static bool cached; // CONNECTING with the peer from NVS
+static PEER_t peer;
+static uint32_t backoff = CONNMGR_BACKOFF_MIN_MS;
+static int64_t connectStart;
+static int64_t downSince; // 0 unless an open link dropped
+
+static CONNMGR_STATS_t stats;
+static portMUX_TYPE connMux = portMUX_INITIALIZER_UNLOCKED;
+
+static TimerHandle_t backoffTimer;
+static StaticTimer_t backoffTimerBuffer;
+static QueueHandle_t xQueueBacklog;
+
+static void connmgr_set(conn_state_t next)
+{
+	ESP_LOGI(TAG, "%s -> %s", stateName[state], stateName[next]);
+	state = next;
+}
+
+static void connmgr_discover(void)
+{
+	cached = false;
+	connmgr_set(CONN_DISCOVERING);
+	esp_bt_gap_start_discovery(inq_mode, inq_len, inq_num_rsps);
+}
+
+// Try the cached peer first, discovery only when there is none
+static void connmgr_connect(void)
+{
+	connectStart = esp_timer_get_time();
+	taskENTER_CRITICAL(&connMux);
+	stats.attempts++;
+	taskEXIT_CRITICAL(&connMux);
+	if (peer_load(&peer)) {
+		cached = true;
+		connmgr_set(CONN_CONNECTING);
+		esp_spp_connect(sec_mask, role_master, peer.scn, peer.bda);
+	} else {
+		connmgr_discover();
+	}
+}
+
+static void connmgr_backoff(void)
+{
+	// Random delay between half and all of the current backoff,
+	// so several initiators don't retry in lockstep
+	uint32_t delay = backoff / 2 + esp_random() % (backoff / 2 + 1);
+	backoff = backoff * 2;
+	if (backoff > CONNMGR_BACKOFF_MAX_MS) backoff = CONNMGR_BACKOFF_MAX_MS;
+	connmgr_set(CONN_BACKOFF);
+	ESP_LOGI(TAG, "retry in %"PRIu32" ms", delay);
+	// Also starts the one-shot timer
+	xTimerChangePeriod(backoffTimer, pdMS_TO_TICKS(delay), 0);
+}
+
+static void connmgr_timer_cb(TimerHandle_t arg)
+{
+	if (state != CONN_BACKOFF) return;
+	connmgr_connect();
+}
+
+void connmgr_init(void)
+{
+	xQueueBacklog = memplan_queue_create(MEMPLAN_QUEUE_BACKLOG);
+	backoffTimer = xTimerCreateStatic("connmgr", pdMS_TO_TICKS(CONNMGR_BACKOFF_MIN_MS), false, NULL,
+		connmgr_timer_cb, &backoffTimerBuffer);
+	configASSERT( backoffTimer );
+}
+
+void connmgr_start(void)
+{
+	if (state != CONN_IDLE) return;
+	connmgr_connect();
+}
+
+void connmgr_found(esp_bd_addr_t bda)
+{
+	if (state != CONN_DISCOVERING) return;
+	memcpy(peer.bda, bda, ESP_BD_ADDR_LEN);
+	connmgr_set(CONN_SDP);
+	esp_spp_start_discovery(peer.bda);
+	esp_bt_gap_cancel_discovery();
+}
+
+void connmgr_discovery_stopped(void)
+{
+	// The inquiry ran out without finding the acceptor
+	if (state == CONN_DISCOVERING) connmgr_backoff();
+}
+
+void connmgr_sdp_done(esp_spp_status_t status, uint8_t scn)
+{
+	if (state != CONN_SDP) return;
+	if (status != ESP_SPP_SUCCESS) {
+		connmgr_backoff();
+		return;
+	}
+	peer.scn = scn;
+	connmgr_set(CONN_CONNECTING);
+	esp_spp_connect(sec_mask, role_master, peer.scn, peer.bda);
+}
+
+void connmgr_open(void)
+{
+	int64_t now = esp_timer_get_time();
+	ESP_LOGI(TAG, "connected in %"PRId64" ms (%s), %"PRId64" ms after boot",
+		(now - connectStart) / 1000, cached ? "cached" : "discovery", now / 1000);
+	connmgr_set(CONN_OPEN);
+	backoff = CONNMGR_BACKOFF_MIN_MS;
+	peer_save(&peer);
+
+	taskENTER_CRITICAL(&connMux);
+	bool recovered = (downSince != 0);
+	if (recovered) {
+		stats.reconnects++;
+		stats.lastRecovery = now - downSince;
+		if (stats.lastRecovery > stats.maxRecovery) stats.maxRecovery = stats.lastRecovery;
+		downSince = 0;
+	}
+	CONNMGR_STATS_t current = stats;
+	stats.attempts = 0;
+	taskEXIT_CRITICAL(&connMux);
+
+	if (recovered) {
+		ESP_LOGI(TAG, "recovered in %"PRId64" ms after %"PRIu32" attempts, disconnects=%"PRIu32" reconnects=%"PRIu32" max=%"PRId64" ms",
+			current.lastRecovery / 1000, current.attempts, current.disconnects, current.reconnects, current.maxRecovery / 1000);
+	}
+}
+
+void connmgr_close(void)
+{
+	if (state == CONN_OPEN) {
+		taskENTER_CRITICAL(&connMux);
+		stats.disconnects++;
+		stats.attempts = 0;
+		downSince = esp_timer_get_time();
+		taskEXIT_CRITICAL(&connMux);
+		ESP_LOGW(TAG, "link lost");
+		// Range drops often heal at once, so retry the same peer without delay
+		connmgr_connect();
+	} else if (state == CONN_CONNECTING && cached) {
+		// The cached peer is off, moved or has a new channel
+		ESP_LOGW(TAG, "cached peer did not answer");
+		connmgr_discover();
+	} else if (state == CONN_CONNECTING) {
+		connmgr_backoff();
+	}
+}
+
+conn_state_t connmgr_state(void)
+{
+	return state;
+}
+
+void connmgr_stats(CONNMGR_STATS_t *current)
+{
+	taskENTER_CRITICAL(&connMux);
+	*current = stats;
+	taskEXIT_CRITICAL(&connMux);
+}
+
+void connmgr_backlog_push(CMD_t *cmd)
+{
+	if (xQueueSend(xQueueBacklog, &cmd, 0) == pdTRUE) return;
+	CMD_t *oldest;
+	if (xQueueReceive(xQueueBacklog, &oldest, 0) == pdTRUE) {
+		msgpool_free(oldest);
+		taskENTER_CRITICAL(&connMux);
+		stats.backlogDrops++;
+		taskEXIT_CRITICAL(&connMux);
+	}
+	if (xQueueSend(xQueueBacklog, &cmd, 0) != pdTRUE) msgpool_free(cmd);
+}
+
+CMD_t *connmgr_backlog_pop(void)
+{
+	CMD_t *cmd;
+	if (xQueueReceive(xQueueBacklog, &cmd, 0) != pdTRUE) return NULL;
+	return cmd;
+}
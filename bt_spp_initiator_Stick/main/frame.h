@@ -0,0 +1,70 @@
+#ifndef MAIN_FRAME_H_
+#define MAIN_FRAME_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Frames on the SPP stream. RFCOMM keeps the byte order but not the
+// write boundaries, so the receiver reassembles frames from the stream.
+//
+//  0      1            2..3          4..
+//  magic  type|flags   length (LE)   payload
+#define FRAME_MAGIC 0xA5
+#define FRAME_HEADER 4
+#define FRAME_MAX_PAYLOAD 1024
+#define FRAME_TYPE_MASK 0x3F
+#define FRAME_STAMP 0x40	// DATA starts with send stamps, see reliable.h
+#define FRAME_LZ 0x80	// payload is LZ compressed
+
+typedef enum {
+	FRAME_HELLO = 1,	// version, capabilities, flags
+	FRAME_DATA,			// one message, see reliable.h
+	FRAME_ACK,
+	FRAME_SYNC,
+	FRAME_REQUEST,		// see rpc.h
+	FRAME_RESPONSE,
+	FRAME_FILE,			// see xfer.h
+	FRAME_CHUNK,
+} frame_type_t;
+
+// Fields inside payloads are little endian
+static inline void frame_put16(uint8_t *dst, uint16_t value)
+{
+	dst[0] = value & 0xFF;
+	dst[1] = value >> 8;
+}
+
+static inline void frame_put32(uint8_t *dst, uint32_t value)
+{
+	frame_put16(dst, value & 0xFFFF);
+	frame_put16(&dst[2], value >> 16);
+}
+
+static inline uint16_t frame_get16(const uint8_t *src)
+{
+	return src[0] | (src[1] << 8);
+}
+
+static inline uint32_t frame_get32(const uint8_t *src)
+{
+	return frame_get16(src) | ((uint32_t)frame_get16(&src[2]) << 16);
+}
+
+// Writes the header for a payload of length bytes. Returns FRAME_HEADER.
+size_t frame_header(uint8_t *dst, uint8_t type, size_t length);
+
+typedef void (*frame_cb_t)(void *ctx, uint8_t type, const uint8_t *payload, size_t length);
+
+typedef struct {
+	uint8_t buf[FRAME_HEADER + FRAME_MAX_PAYLOAD];
+	size_t have;
+	uint32_t skipped;	// bytes dropped while looking for the next magic
+} FRAME_PARSER_t;
+
+void frame_parser_reset(FRAME_PARSER_t *parser);
+// Calls cb for every complete frame. A frame that arrives in one piece
+// is passed straight from data, a split one is gathered in the parser.
+void frame_parse(FRAME_PARSER_t *parser, const uint8_t *data, size_t len, frame_cb_t cb, void *ctx);
+
+#endif /* MAIN_FRAME_H_ */
@@ -0,0 +1,27 @@
+#ifndef MAIN_HIST_H_
+#define MAIN_HIST_H_
+
+#include <stdint.h>
+
+// Log-linear histogram of microseconds, in the spirit of HdrHistogram.
+// Every power of two is split into HIST_SUB buckets, so a percentile is
+// off by at most 1/HIST_SUB of its value, from 1us up to about 16s.
+#define HIST_SUB_BITS 2
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_OCTAVES 24
+#define HIST_BUCKETS (HIST_OCTAVES * HIST_SUB)
+
+typedef struct {
+	uint32_t counts[HIST_BUCKETS];
+	uint32_t total;
+	uint32_t max;
+	uint64_t sum;
+} HIST_t;
+
+void hist_reset(HIST_t *hist);
+void hist_add(HIST_t *hist, uint32_t value);
+// Upper bound of the bucket that holds percent of the values, 0 when empty
+uint32_t hist_percentile(const HIST_t *hist, uint8_t percent);
+uint32_t hist_mean(const HIST_t *hist);
+
+#endif /* MAIN_HIST_H_ */
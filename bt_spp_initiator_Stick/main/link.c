@@ -0,0 +1,254 @@
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+
+#include "lz.h"
+#include "link.h"
+
+#define TAG "LINK"
+
+static uint8_t localCaps;
+static link_write_t linkWrite;
+static link_data_t linkData;
+
+// The receive side runs in the BTC task. link_send may be called from
+// any task; the mutex keeps frames and the LZ history in order.
+static volatile uint8_t sessionCaps;
+static bool framed;	// the peer sent a frame on this connection
+static bool opener;	// this end sent the first HELLO
+static volatile bool restarting;	// the receive history is lost, waiting for a new HELLO
+static bool txReset;	// a DATA frame was dropped, the peer's history is behind ours
+static FRAME_PARSER_t parser;
+static LZ_t lzTx;
+static LZ_t lzRx;
+static uint8_t txBuf[FRAME_HEADER + FRAME_MAX_PAYLOAD];
+static uint8_t rxBuf[FRAME_MAX_PAYLOAD];
+
+static SemaphoreHandle_t txMutex;
+static StaticSemaphore_t txMutexBuffer;
+
+static LINK_STATS_t stats;
+static portMUX_TYPE linkMux = portMUX_INITIALIZER_UNLOCKED;
+
+void link_init(uint8_t caps, link_write_t write, link_data_t data)
+{
+	localCaps = caps;
+	linkWrite = write;
+	linkData = data;
+	txMutex = xSemaphoreCreateMutexStatic(&txMutexBuffer);
+	configASSERT( txMutex );
+	link_close();
+}
+
+static bool link_put(uint32_t handle, uint8_t type, const uint8_t *payload, size_t length);
+
+// resetTx starts a new send history, with the mutex held so no frame
+// slips in between the reset and the HELLO
+static void link_hello(uint32_t handle, uint8_t caps, uint8_t flags, bool resetTx)
+{
+	uint8_t hello[3] = {LINK_VERSION, caps, flags};
+	xSemaphoreTake(txMutex, portMAX_DELAY);
+	if (resetTx) lz_reset(&lzTx);
+	link_put(handle, FRAME_HELLO, hello, sizeof(hello));
+	xSemaphoreGive(txMutex);
+}
+
+void link_open(uint32_t handle)
+{
+	sessionCaps = 0;
+	opener = true;
+	restarting = false;
+	txReset = false;
+	link_hello(handle, localCaps, 0, true);
+}
+
+// Both histories start over: the opener sends HELLO again, the acceptor
+// asks it to, and answers the HELLO that follows like at connect.
+static void link_restart(uint32_t handle)
+{
+	restarting = true;
+	if (opener) {
+		sessionCaps = 0;
+		link_hello(handle, localCaps, 0, true);
+	} else {
+		link_hello(handle, sessionCaps, LINK_HELLO_RESTART, false);
+	}
+}
+
+void link_close(void)
+{
+	sessionCaps = 0;
+	framed = false;
+	opener = false;
+	restarting = false;
+	txReset = false;
+	frame_parser_reset(&parser);
+}
+
+uint8_t link_caps(void)
+{
+	return sessionCaps;
+}
+
+bool link_framed(void)
+{
+	return framed;
+}
+
+static void link_count(size_t plain, size_t wire, bool lz, int64_t us)
+{
+	taskENTER_CRITICAL(&linkMux);
+	stats.frames++;
+	stats.plainBytes += plain;
+	stats.wireBytes += wire;
+	if (lz) stats.lzFrames++;
+	stats.lzUs += us;
+	LINK_STATS_t current = stats;
+	taskEXIT_CRITICAL(&linkMux);
+
+	if (current.frames % LINK_REPORT_FRAMES || current.wireBytes == 0) return;
+	uint32_t ratio = (uint64_t)current.plainBytes * 100 / current.wireBytes;
+	ESP_LOGI(TAG, "%"PRIu32" frames %"PRIu32" -> %"PRIu32" bytes x%"PRIu32".%02"PRIu32" lz %"PRIu32" %"PRId64" us/frame",
+		current.frames, current.plainBytes, current.wireBytes, ratio / 100, ratio % 100,
+		current.lzFrames, current.lzUs / current.frames);
+}
+
+// With the mutex held. Both histories start over in front of the next DATA,
+// in its channel, so the peer resets when it has everything sent before.
+static void link_reset(uint32_t handle)
+{
+	uint8_t hello[3] = {LINK_VERSION, sessionCaps, LINK_HELLO_RESET};
+	lz_reset(&lzTx);
+	txReset = link_put(handle, FRAME_HELLO, hello, sizeof(hello)) == false;
+	if (txReset == false) ESP_LOGW(TAG, "DATA dropped, LZ history reset");
+}
+
+// With the mutex held
+static bool link_put(uint32_t handle, uint8_t type, const uint8_t *payload, size_t length)
+{
+	uint8_t *body = &txBuf[FRAME_HEADER];
+	size_t wire = length;
+	uint8_t flags = 0;
+	bool data = (type & FRAME_TYPE_MASK) == FRAME_DATA;
+	if (data && txReset) link_reset(handle);
+	if (data) {
+		// Everything since HELLO goes into the history, in case the peer agrees to LZ.
+		// Until the reset got through the frames go plain, they decode with any history.
+		int64_t start = esp_timer_get_time();
+		size_t packed = 0;
+		if ((sessionCaps & LINK_CAP_LZ) && txReset == false) {
+			packed = lz_compress(&lzTx, payload, length, body, length ? length - 1 : 0);
+		} else {
+			lz_push(&lzTx, payload, length);
+		}
+		int64_t us = esp_timer_get_time() - start;
+		if (packed) {
+			wire = packed;
+			flags = FRAME_LZ;
+		}
+		link_count(length, wire, packed != 0, us);
+	}
+	if (flags == 0 && length) memcpy(body, payload, length);
+	frame_header(txBuf, type | flags, wire);
+	bool written = linkWrite(handle, txBuf, FRAME_HEADER + wire);
+	if (data && written == false) txReset = true;
+	return written;
+}
+
+bool link_send(uint32_t handle, uint8_t type, const uint8_t *payload, size_t length)
+{
+	if (length > FRAME_MAX_PAYLOAD) return false;
+	xSemaphoreTake(txMutex, portMAX_DELAY);
+	link_put(handle, type, payload, length);
+	xSemaphoreGive(txMutex);
+	return true;
+}
+
+static void link_frame(void *ctx, uint8_t type, const uint8_t *payload, size_t length)
+{
+	uint32_t handle = *(uint32_t *)ctx;
+	if ((type & FRAME_TYPE_MASK) == FRAME_HELLO) {
+		if (length < 2) return;
+		if (length > 2 && (payload[2] & LINK_HELLO_RESTART)) {
+			// The acceptor lost its history. A restart on the way answers it too.
+			if (opener && restarting == false) {
+				ESP_LOGW(TAG, "HELLO restart asked");
+				link_restart(handle);
+			}
+			return;
+		}
+		if (length > 2 && (payload[2] & LINK_HELLO_RESET)) {
+			lz_reset(&lzRx);
+			return;
+		}
+		uint8_t caps = payload[1] & localCaps;
+		if (payload[0] != LINK_VERSION) caps = 0;
+		ESP_LOGI(TAG, "HELLO version %d caps 0x%02x, agreed 0x%02x", payload[0], payload[1], caps);
+		lz_reset(&lzRx);
+		// The acceptor answers with what both ends have
+		if (opener == false) link_hello(handle, caps, 0, true);
+		sessionCaps = caps;
+		restarting = false;
+		return;
+	}
+
+	if ((type & FRAME_TYPE_MASK) != FRAME_DATA) {
+		if (linkData) linkData(handle, type, payload, length);
+		return;
+	}
+	const uint8_t *plain = payload;
+	int plainLength = length;
+	int64_t start = esp_timer_get_time();
+	if (type & FRAME_LZ) {
+		if ((sessionCaps & LINK_CAP_LZ) == 0) plainLength = -1;
+		else plainLength = lz_decompress(&lzRx, payload, length, rxBuf, sizeof(rxBuf));
+		plain = rxBuf;
+	} else {
+		lz_push(&lzRx, payload, length);
+	}
+	if (plainLength < 0) {
+		// The history is lost with this frame, so both ends start over.
+		// Frames compressed before the peer hears of it are lost too,
+		// reliable.c sends them again.
+		taskENTER_CRITICAL(&linkMux);
+		stats.errors++;
+		taskEXIT_CRITICAL(&linkMux);
+		sessionCaps &= ~LINK_CAP_LZ;
+		if (restarting) return;
+		ESP_LOGE(TAG, "corrupt DATA frame, restarting the session");
+		link_restart(handle);
+		return;
+	}
+	link_count(plainLength, length, type & FRAME_LZ, esp_timer_get_time() - start);
+	if (linkData) linkData(handle, FRAME_DATA | (type & FRAME_STAMP), plain, plainLength);
+}
+
+bool link_receive(uint32_t handle, const uint8_t *data, size_t length)
+{
+	if (length == 0) return framed;
+	// The first byte of a connection tells frames from plain text
+	if (framed == false) {
+		if (data[0] != FRAME_MAGIC) return false;
+		framed = true;
+	}
+	uint32_t skipped = parser.skipped;
+	frame_parse(&parser, data, length, link_frame, &handle);
+	if (parser.skipped != skipped) {
+		taskENTER_CRITICAL(&linkMux);
+		stats.errors += parser.skipped - skipped;
+		taskEXIT_CRITICAL(&linkMux);
+	}
+	return true;
+}
+
+void link_stats(LINK_STATS_t *current)
+{
+	taskENTER_CRITICAL(&linkMux);
+	*current = stats;
+	taskEXIT_CRITICAL(&linkMux);
+}
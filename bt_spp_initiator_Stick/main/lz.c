@@ -0,0 +1,118 @@
+#include <string.h>
+
+#include "lz.h"
+
+#define LZ_MASK (LZ_WINDOW - 1)
+
+void lz_reset(LZ_t *lz)
+{
+	lz->head = 0;
+	lz->filled = 0;
+}
+
+static inline void lz_put(LZ_t *lz, uint8_t byte)
+{
+	lz->history[lz->head] = byte;
+	lz->head = (lz->head + 1) & LZ_MASK;
+	if (lz->filled < LZ_WINDOW) lz->filled++;
+}
+
+void lz_push(LZ_t *lz, const uint8_t *src, size_t len)
+{
+	for (size_t i=0;i<len;i++) lz_put(lz, src[i]);
+}
+
+// Byte k of a match that starts distance bytes back from src[0].
+// The history already holds everything before src[0].
+static inline uint8_t lz_at(const LZ_t *lz, const uint8_t *src, uint16_t distance, size_t k)
+{
+	if (k < distance) return lz->history[(lz->head - distance + k) & LZ_MASK];
+	return src[k - distance];
+}
+
+size_t lz_compress(LZ_t *lz, const uint8_t *src, size_t len, uint8_t *dst, size_t dstSize)
+{
+	size_t out = 0;
+	size_t flagPos = 0;
+	int bit = 8;
+	size_t p = 0;
+	bool full = false;
+	while (p < len) {
+		size_t remain = len - p;
+		size_t limit = remain < LZ_MAX_MATCH ? remain : LZ_MAX_MATCH;
+		size_t bestLen = 0;
+		uint16_t bestDistance = 0;
+		if (limit >= LZ_MIN_MATCH) {
+			for (uint16_t d=1;d<=lz->filled;d++) {
+				// Cheap rejects before the full compare
+				if (lz_at(lz, &src[p], d, 0) != src[p]) continue;
+				if (bestLen && lz_at(lz, &src[p], d, bestLen) != src[p + bestLen]) continue;
+				size_t k = 1;
+				while (k < limit && lz_at(lz, &src[p], d, k) == src[p + k]) k++;
+				if (k > bestLen) {
+					bestLen = k;
+					bestDistance = d;
+					if (k == limit) break;
+				}
+			}
+		}
+
+		if (bit == 8) {
+			if (out >= dstSize) full = true;
+			else {
+				flagPos = out++;
+				dst[flagPos] = 0;
+			}
+			bit = 0;
+		}
+		if (bestLen >= LZ_MIN_MATCH) {
+			if (out + 2 > dstSize) full = true;
+			else {
+				dst[flagPos] |= 1 << bit;
+				dst[out++] = bestDistance - 1;
+				dst[out++] = bestLen - LZ_MIN_MATCH;
+			}
+			lz_push(lz, &src[p], bestLen);
+			p += bestLen;
+		} else {
+			if (out + 1 > dstSize) full = true;
+			else dst[out++] = src[p];
+			lz_put(lz, src[p]);
+			p++;
+		}
+		bit++;
+		if (full) {
+			// Keep the history in step with the peer, which gets src raw
+			lz_push(lz, &src[p], len - p);
+			return 0;
+		}
+	}
+	return out;
+}
+
+int lz_decompress(LZ_t *lz, const uint8_t *src, size_t len, uint8_t *dst, size_t dstSize)
+{
+	size_t in = 0;
+	size_t out = 0;
+	while (in < len) {
+		uint8_t flags = src[in++];
+		for (int bit=0;bit<8 && in<len;bit++) {
+			if ((flags & (1 << bit)) == 0) {
+				if (out >= dstSize) return -1;
+				dst[out] = src[in++];
+				lz_put(lz, dst[out++]);
+				continue;
+			}
+			if (in + 2 > len) return -1;
+			uint16_t distance = src[in++] + 1;
+			size_t length = src[in++] + LZ_MIN_MATCH;
+			if (distance > lz->filled) return -1;
+			if (out + length > dstSize) return -1;
+			for (size_t k=0;k<length;k++) {
+				dst[out] = lz->history[(lz->head - distance) & LZ_MASK];
+				lz_put(lz, dst[out++]);
+			}
+		}
+	}
+	return out;
+}
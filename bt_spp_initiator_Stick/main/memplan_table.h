@@ -0,0 +1,26 @@
+#ifndef MAIN_MEMPLAN_TABLE_H_
+#define MAIN_MEMPLAN_TABLE_H_
+
+#include "cmd.h"
+
+// X(name, stack bytes, priority)
+#define MEMPLAN_TASKS(X) \
+	X(TFT, 1024*4, 2) \
+	X(BUTTON, 1024*2, 2)
+
+// X(name, item type, length)
+// The RAM the polling button tasks gave back holds messages for the
+// link instead: a deeper backlog and the LINE slabs to fill it.
+#define MEMPLAN_QUEUES(X) \
+	X(CMD, CMD_t *, 32) \
+	X(BACKLOG, CMD_t *, 16)
+
+// X(name, payload bytes, count), smallest payload first
+#define MSGPOOL_SLABS(X) \
+	X(EVENT, 0, 16) \
+	X(LINE, 64, 36) \
+	X(BULK, 512, 2)
+
+#define MEMPLAN_BUDGET (1024*15)
+
+#endif /* MAIN_MEMPLAN_TABLE_H_ */
@@ -0,0 +1,22 @@
+#ifndef MAIN_MSGPOOL_H_
+#define MAIN_MSGPOOL_H_
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "cmd.h"
+
+// Messages live in static slabs listed in memplan_table.h as MSGPOOL_SLABS.
+// Queues carry CMD_t pointers. Whoever holds the pointer owns the message:
+// the producer until the queue accepts it, then the consumer, which returns
+// it with msgpool_free() when done.
+
+void msgpool_init(void);
+// Smallest free message whose payload holds size bytes, NULL when the pool is exhausted.
+// Safe from tasks and timer callbacks, not from interrupts.
+CMD_t *msgpool_alloc(uint16_t command, size_t size);
+// NULL is ignored
+void msgpool_free(CMD_t *cmd);
+void msgpool_report(void);
+
+#endif /* MAIN_MSGPOOL_H_ */
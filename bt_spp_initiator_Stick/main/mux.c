@@ -0,0 +1,272 @@
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+
+#include "frame.h"
+#include "mux.h"
+
+#define TAG "MUX"
+
+// Every queued frame starts with its length and the time it was queued
+#define MUX_ENTRY 6
+// Stretches of bytes in the stack, of one channel each, oldest first
+#define MUX_SEGMENTS 64
+
+#define MUX_CHANNEL_NAME(name, bytes, credit) #name,
+static const char * channelName[MUX_CHANNEL_MAX] = {
+	MUX_CHANNELS(MUX_CHANNEL_NAME)
+};
+#undef MUX_CHANNEL_NAME
+
+#define MUX_CHANNEL_CREDIT(name, bytes, credit) credit,
+static const uint32_t channelCredit[MUX_CHANNEL_MAX] = {
+	MUX_CHANNELS(MUX_CHANNEL_CREDIT)
+};
+#undef MUX_CHANNEL_CREDIT
+
+#define MUX_QUEUE_BUFFER(name, bytes, credit) static uint8_t queue##name[bytes];
+MUX_CHANNELS(MUX_QUEUE_BUFFER)
+#undef MUX_QUEUE_BUFFER
+
+typedef struct {
+	uint8_t *buf;
+	size_t size;
+	size_t head;		// next byte to read
+	size_t used;
+	uint32_t inflight;	// bytes written and not yet returned
+} CHANNEL_t;
+
+#define MUX_CHANNEL_INIT(name, bytes, credit) { .buf = queue##name, .size = bytes },
+static CHANNEL_t channel[MUX_CHANNEL_MAX] = {
+	MUX_CHANNELS(MUX_CHANNEL_INIT)
+};
+#undef MUX_CHANNEL_INIT
+
+typedef struct {
+	uint8_t channel;
+	uint32_t bytes;
+} SEGMENT_t;
+
+static link_write_t muxWrite;
+static uint32_t muxHandle;
+
+// The mutex covers the queues, the credit and the order of the writes.
+// mux_write runs in any task, mux_write_done in the BTC task.
+static SemaphoreHandle_t muxMutex;
+static StaticSemaphore_t muxMutexBuffer;
+static SEGMENT_t segment[MUX_SEGMENTS];
+static int segmentHead;
+static int segmentNum;
+static uint8_t txBuf[FRAME_HEADER + FRAME_MAX_PAYLOAD];
+
+static MUX_STATS_t stats[MUX_CHANNEL_MAX];
+static uint32_t frames;
+static portMUX_TYPE muxMux = portMUX_INITIALIZER_UNLOCKED;
+
+void mux_init(link_write_t write)
+{
+	muxWrite = write;
+	muxMutex = xSemaphoreCreateMutexStatic(&muxMutexBuffer);
+	configASSERT( muxMutex );
+}
+
+static mux_channel_t mux_channel(const uint8_t *data, size_t length)
+{
+	if (length < FRAME_HEADER || data[0] != FRAME_MAGIC) return MUX_CONTROL;
+	switch (data[1] & FRAME_TYPE_MASK) {
+	case FRAME_HELLO:
+	case FRAME_DATA:
+		return MUX_TELEMETRY;
+	case FRAME_CHUNK:
+		return MUX_BULK;
+	default:
+		return MUX_CONTROL;
+	}
+}
+
+static void mux_report(void)
+{
+	MUX_STATS_t current[MUX_CHANNEL_MAX];
+	mux_stats(current);
+	for (int i=0;i<MUX_CHANNEL_MAX;i++) {
+		if (current[i].frames == 0) continue;
+		ESP_LOGI(TAG, "%-9s %"PRIu32" frames %"PRIu32" bytes queued %"PRIu32" drops %"PRIu32" wait avg %"PRId64" max %"PRIu32" us",
+			channelName[i], current[i].frames, current[i].bytes, current[i].queued, current[i].drops,
+			current[i].queued ? current[i].waitSumUs / current[i].queued : 0, current[i].waitMaxUs);
+	}
+}
+
+// With the mutex held. Hands one frame to the writer and takes its credit.
+// false when the stack can't track another stretch.
+static bool mux_put(mux_channel_t c, const uint8_t *data, size_t length)
+{
+	int last = (segmentHead + segmentNum - 1) % MUX_SEGMENTS;
+	if (segmentNum && segment[last].channel == c) {
+		segment[last].bytes += length;
+	} else if (segmentNum < MUX_SEGMENTS) {
+		last = (segmentHead + segmentNum) % MUX_SEGMENTS;
+		segment[last].channel = c;
+		segment[last].bytes = length;
+		segmentNum++;
+	} else {
+		return false;
+	}
+	channel[c].inflight += length;
+	muxWrite(muxHandle, data, length);
+
+	taskENTER_CRITICAL(&muxMux);
+	stats[c].frames++;
+	stats[c].bytes += length;
+	bool report = (++frames % MUX_REPORT) == 0;
+	taskEXIT_CRITICAL(&muxMux);
+	if (report) mux_report();
+	return true;
+}
+
+// A frame bigger than the whole credit still goes, alone
+static bool mux_credit(mux_channel_t c, size_t length)
+{
+	return channel[c].inflight == 0 || channel[c].inflight + length <= channelCredit[c];
+}
+
+// With the mutex held
+static void mux_copy_out(CHANNEL_t *ch, uint8_t *dst, size_t length)
+{
+	size_t first = ch->size - ch->head < length ? ch->size - ch->head : length;
+	memcpy(dst, &ch->buf[ch->head], first);
+	memcpy(&dst[first], ch->buf, length - first);
+	ch->head = (ch->head + length) % ch->size;
+	ch->used -= length;
+}
+
+static void mux_copy_in(CHANNEL_t *ch, const uint8_t *src, size_t length)
+{
+	size_t tail = (ch->head + ch->used) % ch->size;
+	size_t first = ch->size - tail < length ? ch->size - tail : length;
+	memcpy(&ch->buf[tail], src, first);
+	memcpy(ch->buf, &src[first], length - first);
+	ch->used += length;
+}
+
+// Length of the first queued frame
+static size_t mux_peek(const CHANNEL_t *ch)
+{
+	uint8_t length[2] = {ch->buf[ch->head], ch->buf[(ch->head + 1) % ch->size]};
+	return frame_get16(length);
+}
+
+// With the mutex held. Sends queued frames, highest priority first,
+// as long as their channels have credit.
+static void mux_drain(void)
+{
+	for (int c=0;c<MUX_CHANNEL_MAX;) {
+		CHANNEL_t *ch = &channel[c];
+		if (ch->used == 0 || mux_credit(c, mux_peek(ch)) == false) {
+			c++;
+			continue;
+		}
+		uint8_t entry[MUX_ENTRY];
+		size_t save = ch->head;
+		mux_copy_out(ch, entry, MUX_ENTRY);
+		size_t length = frame_get16(entry);
+		mux_copy_out(ch, txBuf, length);
+		if (mux_put(c, txBuf, length) == false) {
+			// Put back, it goes once the stack returns some bytes
+			ch->head = save;
+			ch->used += MUX_ENTRY + length;
+			return;
+		}
+		uint32_t wait = (uint32_t)esp_timer_get_time() - frame_get32(&entry[2]);
+		taskENTER_CRITICAL(&muxMux);
+		stats[c].waitSumUs += wait;
+		if (wait > stats[c].waitMaxUs) stats[c].waitMaxUs = wait;
+		taskEXIT_CRITICAL(&muxMux);
+		// Start over, a channel above may have credit again
+		c = 0;
+	}
+}
+
+bool mux_write(uint32_t handle, const uint8_t *data, size_t length)
+{
+	mux_channel_t c = mux_channel(data, length);
+	CHANNEL_t *ch = &channel[c];
+	xSemaphoreTake(muxMutex, portMAX_DELAY);
+	muxHandle = handle;
+	// Nothing ahead of it in its channel, straight on
+	if (ch->used == 0 && mux_credit(c, length) && mux_put(c, data, length)) {
+		xSemaphoreGive(muxMutex);
+		return true;
+	}
+	if (ch->size - ch->used < MUX_ENTRY + length) {
+		xSemaphoreGive(muxMutex);
+		taskENTER_CRITICAL(&muxMux);
+		stats[c].drops++;
+		taskEXIT_CRITICAL(&muxMux);
+		ESP_LOGW(TAG, "%s queue full, %d bytes dropped", channelName[c], (int)length);
+		return false;
+	}
+	uint8_t entry[MUX_ENTRY];
+	frame_put16(entry, length);
+	frame_put32(&entry[2], esp_timer_get_time());
+	mux_copy_in(ch, entry, MUX_ENTRY);
+	mux_copy_in(ch, data, length);
+	taskENTER_CRITICAL(&muxMux);
+	stats[c].queued++;
+	taskEXIT_CRITICAL(&muxMux);
+	mux_drain();
+	xSemaphoreGive(muxMutex);
+	return true;
+}
+
+void mux_write_done(int length)
+{
+	if (length <= 0) return;
+	size_t left = length;
+	xSemaphoreTake(muxMutex, portMAX_DELAY);
+	while (left && segmentNum) {
+		SEGMENT_t *s = &segment[segmentHead];
+		uint32_t n = s->bytes < left ? s->bytes : left;
+		s->bytes -= n;
+		channel[s->channel].inflight -= n;
+		left -= n;
+		if (s->bytes) break;
+		segmentHead = (segmentHead + 1) % MUX_SEGMENTS;
+		segmentNum--;
+	}
+	mux_drain();
+	xSemaphoreGive(muxMutex);
+}
+
+size_t mux_room(mux_channel_t c)
+{
+	xSemaphoreTake(muxMutex, portMAX_DELAY);
+	size_t room = channel[c].size - channel[c].used;
+	xSemaphoreGive(muxMutex);
+	return room > MUX_ENTRY ? room - MUX_ENTRY : 0;
+}
+
+void mux_close(void)
+{
+	xSemaphoreTake(muxMutex, portMAX_DELAY);
+	// Writes of a closed link never complete
+	for (int c=0;c<MUX_CHANNEL_MAX;c++) {
+		channel[c].head = 0;
+		channel[c].used = 0;
+		channel[c].inflight = 0;
+	}
+	segmentHead = 0;
+	segmentNum = 0;
+	xSemaphoreGive(muxMutex);
+}
+
+void mux_stats(MUX_STATS_t current[MUX_CHANNEL_MAX])
+{
+	taskENTER_CRITICAL(&muxMux);
+	memcpy(current, stats, sizeof(stats));
+	taskEXIT_CRITICAL(&muxMux);
+}
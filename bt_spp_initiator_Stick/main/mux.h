@@ -0,0 +1,60 @@
+#ifndef MAIN_MUX_H_
+#define MAIN_MUX_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "link.h"
+
+// Channels over the one SPP connection, between link.c and coalesce.c.
+//
+// Each channel has its own queue and its own credit: the bytes it may
+// have handed to the BT stack that ESP_SPP_WRITE_EVT hasn't returned
+// yet. The next frame comes from the first channel in the table that
+// has a frame waiting and credit left, so a file transfer fills the
+// stack with at most its credit and a remote call never waits behind
+// more than that.
+//
+// Frames of one channel keep their order, which keeps the LZ history
+// of DATA and the offsets of CHUNK in step with the receiver. HELLO
+// resets that history, so it goes with DATA.
+//
+// X(name, queue, credit), in bytes, highest priority first.
+#define MUX_CHANNELS(X) \
+	X(CONTROL, 2048, 2048) \
+	X(TELEMETRY, 2048, 2048) \
+	X(BULK, 2048, 1980)
+
+#define MUX_REPORT 500	// log every so many frames
+
+#define MUX_CHANNEL_ENUM(name, queue, credit) MUX_##name,
+typedef enum {
+	MUX_CHANNELS(MUX_CHANNEL_ENUM)
+	MUX_CHANNEL_MAX
+} mux_channel_t;
+#undef MUX_CHANNEL_ENUM
+
+typedef struct {
+	uint32_t frames;
+	uint32_t bytes;
+	uint32_t drops;			// frames that found the queue full
+	uint32_t queued;		// frames that had to wait for credit
+	uint32_t waitMaxUs;		// in the queue
+	int64_t waitSumUs;
+} MUX_STATS_t;
+
+// write takes the frames in the order they go out, e.g. coalesce_write
+void mux_init(link_write_t write);
+// A link_write_t, for link_init. Thread safe.
+// The channel follows from the frame type, bytes that aren't a frame are CONTROL.
+// false when the queue of the channel is full and the frame is dropped.
+bool mux_write(uint32_t handle, const uint8_t *data, size_t length);
+// ESP_SPP_WRITE_EVT, returns the credit of these bytes. length <= 0 is ignored.
+void mux_write_done(int length);
+// Bytes a frame of this channel may have to be queued without a drop
+size_t mux_room(mux_channel_t channel);
+// The link is gone, drops everything queued
+void mux_close(void);
+void mux_stats(MUX_STATS_t stats[MUX_CHANNEL_MAX]);
+
+#endif /* MAIN_MUX_H_ */
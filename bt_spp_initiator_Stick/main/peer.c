@@ -0,0 +1,45 @@
+#include <stdio.h>
+#include <string.h>
+#include "nvs.h"
+#include "esp_log.h"
+
+#include "peer.h"
+
+#define TAG "PEER"
+#define PEER_NAMESPACE "spp"
+#define PEER_KEY "peer"
+
+bool peer_load(PEER_t *peer)
+{
+	nvs_handle_t handle;
+	esp_err_t ret = nvs_open(PEER_NAMESPACE, NVS_READONLY, &handle);
+	if (ret != ESP_OK) return false;
+	size_t length = sizeof(PEER_t);
+	ret = nvs_get_blob(handle, PEER_KEY, peer, &length);
+	nvs_close(handle);
+	if (ret != ESP_OK || length != sizeof(PEER_t)) return false;
+	ESP_LOGI(TAG, "cached peer %02x:%02x:%02x:%02x:%02x:%02x scn=%d",
+		peer->bda[0], peer->bda[1], peer->bda[2], peer->bda[3], peer->bda[4], peer->bda[5], peer->scn);
+	return true;
+}
+
+void peer_save(const PEER_t *peer)
+{
+	PEER_t stored;
+	if (peer_load(&stored) && memcmp(&stored, peer, sizeof(PEER_t)) == 0) return;
+
+	nvs_handle_t handle;
+	esp_err_t ret = nvs_open(PEER_NAMESPACE, NVS_READWRITE, &handle);
+	if (ret != ESP_OK) {
+		ESP_LOGE(TAG, "nvs_open fail %s", esp_err_to_name(ret));
+		return;
+	}
+	ret = nvs_set_blob(handle, PEER_KEY, peer, sizeof(PEER_t));
+	if (ret == ESP_OK) ret = nvs_commit(handle);
+	nvs_close(handle);
+	if (ret != ESP_OK) {
+		ESP_LOGE(TAG, "nvs_set_blob fail %s", esp_err_to_name(ret));
+		return;
+	}
+	ESP_LOGI(TAG, "peer saved scn=%d", peer->scn);
+}
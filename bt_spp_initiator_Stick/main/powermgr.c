@@ -0,0 +1,199 @@
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/timers.h"
+#include "esp_idf_version.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "esp_gap_bt_api.h"
+#if CONFIG_PM_ENABLE
+#include "esp_pm.h"
+#endif
+
+#include "powermgr.h"
+
+#define TAG "POWERMGR"
+
+#define POWERMGR_INFLIGHT 8 // writes waiting for ESP_SPP_WRITE_EVT
+
+static const char * modeName[POWERMGR_MODE_MAX] = { "idle", "active" };
+static const char * linkName[] = { "active", "hold", "sniff", "park" };
+
+typedef struct {
+	int64_t start;
+	powermgr_mode_t mode;
+	bool sniff;
+} INFLIGHT_t;
+
+// Transitions only run in the timer service task, so the pm locks
+// are taken and given in order. The mux covers the rest.
+static powermgr_mode_t mode = POWERMGR_IDLE;
+static bool linkOpen = false;
+static bool linkSniff = false;
+static esp_bd_addr_t peer;
+static int64_t lastTraffic;
+static INFLIGHT_t inflight[POWERMGR_INFLIGHT];
+static int inflightHead;
+static int inflightNum;
+static POWERMGR_STATS_t stats[POWERMGR_MODE_MAX];
+static portMUX_TYPE powermgrMux = portMUX_INITIALIZER_UNLOCKED;
+
+static TimerHandle_t quietTimer;
+static StaticTimer_t quietTimerBuffer;
+#if CONFIG_PM_ENABLE
+static esp_pm_lock_handle_t cpuLock;
+static esp_pm_lock_handle_t sleepLock;
+#endif
+
+static void powermgr_log(powermgr_mode_t m)
+{
+	POWERMGR_STATS_t s;
+	powermgr_stats(m, &s);
+	if (s.writes == 0) return;
+	ESP_LOGI(TAG, "%s: writes=%"PRIu32" sniff=%"PRIu32" latency avg=%"PRId64" max=%"PRId64" us",
+		modeName[m], s.writes, s.sniffWrites, s.sumLatency / s.writes, s.maxLatency);
+}
+
+// Runs in the timer service task
+static void powermgr_set(void *arg1, uint32_t next)
+{
+	if (next == mode) return;
+	ESP_LOGI(TAG, "%s -> %s", modeName[mode], modeName[next]);
+	powermgr_log(mode);
+#if CONFIG_PM_ENABLE
+	if (next == POWERMGR_ACTIVE) {
+		esp_pm_lock_acquire(cpuLock);
+		esp_pm_lock_acquire(sleepLock);
+	} else {
+		esp_pm_lock_release(sleepLock);
+		esp_pm_lock_release(cpuLock);
+	}
+#endif
+	taskENTER_CRITICAL(&powermgrMux);
+	mode = next;
+	bool open = linkOpen;
+	taskEXIT_CRITICAL(&powermgrMux);
+	if (open) esp_bt_gap_set_qos(peer, next == POWERMGR_ACTIVE ? POWERMGR_POLL_ACTIVE : POWERMGR_POLL_IDLE);
+}
+
+static void powermgr_timer_cb(TimerHandle_t arg)
+{
+	powermgr_set(NULL, POWERMGR_IDLE);
+}
+
+void powermgr_init(void)
+{
+#if CONFIG_PM_ENABLE
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+	esp_pm_config_t pm_config = {
+		.max_freq_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+#else
+	esp_pm_config_esp32_t pm_config = {
+		.max_freq_mhz = CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ,
+#endif
+		// The BT controller needs the 80MHz APB clock while it is awake
+		.min_freq_mhz = 80,
+		.light_sleep_enable = true
+	};
+	esp_err_t ret = esp_pm_configure(&pm_config);
+	assert(ret==ESP_OK);
+	ret = esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "spp_burst", &cpuLock);
+	assert(ret==ESP_OK);
+	ret = esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "spp_burst", &sleepLock);
+	assert(ret==ESP_OK);
+#else
+	ESP_LOGW(TAG, "CONFIG_PM_ENABLE is not set, the CPU never sleeps");
+#endif
+	quietTimer = xTimerCreateStatic("powermgr", pdMS_TO_TICKS(POWERMGR_QUIET_MS), false, NULL,
+		powermgr_timer_cb, &quietTimerBuffer);
+	configASSERT( quietTimer );
+}
+
+void powermgr_open(esp_bd_addr_t bda)
+{
+	taskENTER_CRITICAL(&powermgrMux);
+	memcpy(peer, bda, ESP_BD_ADDR_LEN);
+	linkOpen = true;
+	linkSniff = false;
+	inflightNum = 0;
+	powermgr_mode_t current = mode;
+	taskEXIT_CRITICAL(&powermgrMux);
+	esp_bt_gap_set_qos(peer, current == POWERMGR_ACTIVE ? POWERMGR_POLL_ACTIVE : POWERMGR_POLL_IDLE);
+}
+
+void powermgr_close(void)
+{
+	taskENTER_CRITICAL(&powermgrMux);
+	linkOpen = false;
+	inflightNum = 0;
+	taskEXIT_CRITICAL(&powermgrMux);
+}
+
+void powermgr_link_mode(esp_bt_pm_mode_t link)
+{
+	ESP_LOGI(TAG, "link %s", link <= ESP_BT_PM_MD_PARK ? linkName[link] : "?");
+	taskENTER_CRITICAL(&powermgrMux);
+	linkSniff = (link == ESP_BT_PM_MD_SNIFF);
+	taskEXIT_CRITICAL(&powermgrMux);
+}
+
+void powermgr_traffic(void)
+{
+	int64_t now = esp_timer_get_time();
+	taskENTER_CRITICAL(&powermgrMux);
+	bool burst = (now - lastTraffic) < POWERMGR_BURST_MS * 1000LL;
+	lastTraffic = now;
+	powermgr_mode_t current = mode;
+	taskEXIT_CRITICAL(&powermgrMux);
+	if (burst == false) return;
+	// Every burst pushes the return to IDLE further away
+	xTimerReset(quietTimer, 0);
+	if (current != POWERMGR_ACTIVE) xTimerPendFunctionCall(powermgr_set, NULL, POWERMGR_ACTIVE, 0);
+}
+
+void powermgr_write_start(void)
+{
+	powermgr_traffic();
+	taskENTER_CRITICAL(&powermgrMux);
+	// Writes complete in order, so a ring is enough
+	if (inflightNum < POWERMGR_INFLIGHT) {
+		INFLIGHT_t *w = &inflight[(inflightHead + inflightNum) % POWERMGR_INFLIGHT];
+		w->start = esp_timer_get_time();
+		w->mode = mode;
+		w->sniff = linkSniff;
+		inflightNum++;
+	}
+	taskEXIT_CRITICAL(&powermgrMux);
+}
+
+void powermgr_write_done(void)
+{
+	int64_t now = esp_timer_get_time();
+	taskENTER_CRITICAL(&powermgrMux);
+	if (inflightNum) {
+		INFLIGHT_t *w = &inflight[inflightHead];
+		inflightHead = (inflightHead + 1) % POWERMGR_INFLIGHT;
+		inflightNum--;
+		POWERMGR_STATS_t *s = &stats[w->mode];
+		int64_t latency = now - w->start;
+		s->writes++;
+		if (w->sniff) s->sniffWrites++;
+		s->sumLatency += latency;
+		if (latency > s->maxLatency) s->maxLatency = latency;
+	}
+	taskEXIT_CRITICAL(&powermgrMux);
+}
+
+powermgr_mode_t powermgr_mode(void)
+{
+	return mode;
+}
+
+void powermgr_stats(powermgr_mode_t m, POWERMGR_STATS_t *current)
+{
+	taskENTER_CRITICAL(&powermgrMux);
+	*current = stats[m];
+	taskEXIT_CRITICAL(&powermgrMux);
+}
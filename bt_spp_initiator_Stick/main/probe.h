@@ -0,0 +1,68 @@
+#ifndef MAIN_PROBE_H_
+#define MAIN_PROBE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "cmd.h"
+#include "hist.h"
+#include "reliable.h"
+#include "telemetry.h"
+
+// Latency of the messages from the initiator to the acceptor's screen.
+//
+//  initiator  timer_cb -> queue -> tft -> esp_spp_write
+//  acceptor   esp_spp_cb -> queue -> tft -> lcdDrawString
+//
+// The acceptor calls RPC_CLOCK every PROBE_PERIOD_MS with its own time.
+// The initiator echoes it and adds its time, which gives the round trip
+// and, taking the link as symmetric, the offset between the two clocks.
+// The offset of the probe with the shortest round trip among the last
+// PROBE_SAMPLES is used, as it waited the least in queues.
+//
+// With the offset, the stamps of a DATA frame (see reliable.h) split
+// the latency of every message into stages:
+//  queue   created -> sent, on the initiator
+//  air     sent -> arrived, one way across the link
+//  render  arrived -> drawn, on the acceptor
+//  total   created -> drawn
+// Clocks are compared in their low 32 bits, so all of this works across
+// the wrap of esp_timer_get_time() at 71 minutes.
+// The histograms start over with every connection.
+#define PROBE_PERIOD_MS 1000
+#define PROBE_SAMPLES 8
+#define PROBE_REPORT 100	// log the histograms every so many drawn messages
+
+typedef enum {
+	PROBE_RTT,
+	PROBE_QUEUE,
+	PROBE_AIR,
+	PROBE_RENDER,
+	PROBE_TOTAL,
+	PROBE_STAGE_MAX
+} probe_stage_t;
+
+// RPC_CLOCK handler of the initiator
+int probe_clock(const uint8_t *args, size_t length, uint8_t *result, size_t size);
+
+// Acceptor
+void probe_open(void);
+// Logs what the connection measured
+void probe_close(void);
+// Sends the next probe when it is due. Returns the ticks until then.
+TickType_t probe_poll(uint32_t handle);
+// In the BTC task, for every fresh DATA frame.
+// Returns the microseconds from creation to arrival, 0 when not known yet.
+uint32_t probe_receive(const RELIABLE_STAMP_t *stamp);
+// Once the message is on the screen
+void probe_drawn(const CMD_t *cmd);
+void probe_get(probe_stage_t stage, HIST_t *hist);
+// Initiator clock minus acceptor clock. false before the first probe.
+bool probe_offset(int32_t *offset);
+// p50/p99/max in milliseconds, in lines of TELEMETRY_LINE bytes. Returns the number of lines.
+int probe_format(char lines[][TELEMETRY_LINE], int maxLines);
+// p50/p95/p99/max of every stage in microseconds
+void probe_report(void);
+
+#endif /* MAIN_PROBE_H_ */
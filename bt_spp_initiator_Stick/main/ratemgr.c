@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/timers.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+
+#include "reliable.h"
+#include "ratemgr.h"
+
+#define TAG "RATEMGR"
+
+static const char * reasonName[RATEMGR_REASON_MAX] = {
+	"cong", "loss", "window", "queue", "rtt"
+};
+
+// Everything but the congestion and offer counts runs in the timer service task
+static RATEMGR_CONFIG_t config;
+static uint32_t rate;
+static bool slowStart = true;
+static int64_t lastTick;
+static int64_t lastDecrease;
+static int64_t lastReport;
+static uint32_t lastOffered;
+static uint32_t lastTimeouts;
+static uint32_t minRtt;		// microseconds, 0 before the first ACK
+static uint32_t congestion;	// since the last tick
+static uint32_t offered;
+static RATEMGR_STATS_t stats;
+static portMUX_TYPE rateMux = portMUX_INITIALIZER_UNLOCKED;
+
+static TickType_t ratemgr_ticks(uint32_t r)
+{
+	TickType_t ticks = pdMS_TO_TICKS(1000000 / r);
+	return ticks ? ticks : 1;
+}
+
+void ratemgr_init(const RATEMGR_CONFIG_t *c)
+{
+	config = *c;
+	rate = config.floor;
+	stats.rate = rate;
+	// Also starts the timer
+	xTimerChangePeriod(config.timer, ratemgr_ticks(rate), 0);
+	ESP_LOGI(TAG, "floor %"PRIu32".%03"PRIu32"/s ceiling %"PRIu32".%03"PRIu32"/s",
+		config.floor / 1000, config.floor % 1000, config.ceiling / 1000, config.ceiling % 1000);
+}
+
+void ratemgr_congestion(void)
+{
+	taskENTER_CRITICAL(&rateMux);
+	congestion++;
+	stats.congestion++;
+	taskEXIT_CRITICAL(&rateMux);
+}
+
+void ratemgr_offer(void)
+{
+	taskENTER_CRITICAL(&rateMux);
+	offered++;
+	taskEXIT_CRITICAL(&rateMux);
+}
+
+// The first sign of congestion that shows, -1 for none
+static int ratemgr_signal(const RELIABLE_STATS_t *r, uint32_t cong, uint32_t timeouts)
+{
+	if (cong) return RATEMGR_CONG;
+	if (timeouts) return RATEMGR_LOSS;
+	if (r->inflight >= config.window) return RATEMGR_WINDOW;
+	if (uxQueueMessagesWaiting(config.queue) > RATEMGR_QUEUE_MAX) return RATEMGR_QUEUE;
+	if (minRtt && r->srttUs > minRtt * 2 && r->srttUs > minRtt + RATEMGR_RTT_SLACK_MS * 1000) return RATEMGR_RTT;
+	return -1;
+}
+
+void ratemgr_tick(void)
+{
+	int64_t now = esp_timer_get_time();
+	int64_t elapsed = lastTick ? now - lastTick : 0;
+	if (elapsed > 1000000) elapsed = 1000000;
+	lastTick = now;
+
+	RELIABLE_STATS_t r;
+	reliable_stats(&r);
+	uint32_t timeouts = r.timeouts - lastTimeouts;
+	lastTimeouts = r.timeouts;
+	taskENTER_CRITICAL(&rateMux);
+	uint32_t cong = congestion;
+	congestion = 0;
+	// Not r.sent: with the window full messages wait in the backlog,
+	// which is the window signal, not a stop
+	bool sending = (offered != lastOffered);
+	lastOffered = offered;
+	taskEXIT_CRITICAL(&rateMux);
+
+	uint32_t next = rate;
+	if (sending == false) {
+		// Stopped or no link, nothing to learn from
+		next = config.floor;
+		slowStart = true;
+		minRtt = 0;
+	} else {
+		if (r.srttUs && (minRtt == 0 || r.srttUs < minRtt)) minRtt = r.srttUs;
+		int reason = ratemgr_signal(&r, cong, timeouts);
+		int64_t hold = r.srttUs > RATEMGR_HOLD_MS * 1000 ? r.srttUs : RATEMGR_HOLD_MS * 1000;
+		if (reason >= 0 && now - lastDecrease >= hold) {
+			next = rate / 2;
+			slowStart = false;
+			lastDecrease = now;
+			stats.decreases[reason]++;
+			ESP_LOGI(TAG, "%s: %"PRIu32".%03"PRIu32"/s -> %"PRIu32".%03"PRIu32"/s srtt %"PRIu32" us",
+				reasonName[reason], rate / 1000, rate % 1000, next / 1000, next % 1000, r.srttUs);
+		} else if (reason < 0 && slowStart) {
+			// Doubles every second
+			next = rate + (uint64_t)rate * elapsed / 1000000;
+		} else if (reason < 0) {
+			next = rate + (uint64_t)RATEMGR_STEP * elapsed / 1000000;
+		}
+	}
+	if (next < config.floor) next = config.floor;
+	if (next > config.ceiling) next = config.ceiling;
+
+	if (ratemgr_ticks(next) != ratemgr_ticks(rate)) {
+		xTimerChangePeriod(config.timer, ratemgr_ticks(next), 0);
+	}
+	rate = next;
+	taskENTER_CRITICAL(&rateMux);
+	stats.rate = rate;
+	taskEXIT_CRITICAL(&rateMux);
+
+	if (now - lastReport < RATEMGR_REPORT_MS * 1000 || sending == false) return;
+	lastReport = now;
+	ESP_LOGI(TAG, "rate %"PRIu32".%03"PRIu32"/s srtt %"PRIu32" us min %"PRIu32" us inflight %d%s",
+		rate / 1000, rate % 1000, r.srttUs, minRtt, r.inflight, slowStart ? " slow start" : "");
+}
+
+uint32_t ratemgr_period_ms(void)
+{
+	taskENTER_CRITICAL(&rateMux);
+	uint32_t current = stats.rate;
+	taskEXIT_CRITICAL(&rateMux);
+	return 1000000 / current;
+}
+
+void ratemgr_stats(RATEMGR_STATS_t *current)
+{
+	taskENTER_CRITICAL(&rateMux);
+	*current = stats;
+	taskEXIT_CRITICAL(&rateMux);
+}
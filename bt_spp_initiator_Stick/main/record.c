@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include "record.h"
+
+#define RECORD_ALL ((1UL << RECORD_FIELD_MAX) - 1)
+
+static const char * deviceName[] = {
+	"?", "M5Stick", "M5StickC", "M5StickC+"
+};
+
+#define RECORD_UNIT(name, kind, scale, unit) unit,
+static const char * fieldUnit[RECORD_FIELD_MAX] = {
+	RECORD_FIELDS(RECORD_UNIT)
+};
+
+static size_t put_varint(uint8_t *dst, uint64_t value)
+{
+	size_t n = 0;
+	while (value >= 0x80) {
+		dst[n++] = value | 0x80;
+		value >>= 7;
+	}
+	dst[n++] = value;
+	return n;
+}
+
+static bool get_varint(const uint8_t **src, const uint8_t *end, uint64_t *value)
+{
+	uint64_t result = 0;
+	for (int shift=0;shift<64;shift+=7) {
+		if (*src == end) return false;
+		uint8_t byte = *(*src)++;
+		result |= (uint64_t)(byte & 0x7F) << shift;
+		if ((byte & 0x80) == 0) {
+			*value = result;
+			return true;
+		}
+	}
+	return false;
+}
+
+// Small magnitudes of either sign take few bytes
+#define put_VARINT(dst, value) put_varint(dst, value)
+#define put_FIXED(dst, value) put_varint(dst, ((uint32_t)(value) << 1) ^ (uint32_t)((value) >> 31))
+#define put_TIME(dst, value) put_varint(dst, (value) / 1000)
+#define get_VARINT(value) ((uint32_t)(value))
+#define get_FIXED(value) ((int32_t)(((uint32_t)(value) >> 1) ^ -((uint32_t)(value) & 1)))
+#define get_TIME(value) ((int64_t)(value) * 1000)
+
+size_t record_encode(const RECORD_t *rec, uint8_t *dst)
+{
+	size_t n = 0;
+	dst[n++] = RECORD_MARK;
+	n += put_varint(&dst[n], rec->fields & RECORD_ALL);
+#define RECORD_ENCODE(name, kind, scale, unit) \
+	if (rec->fields & RECORD_HAS(name)) n += put_##kind(&dst[n], rec->name);
+	RECORD_FIELDS(RECORD_ENCODE)
+#undef RECORD_ENCODE
+	return n;
+}
+
+bool record_is(const uint8_t *src, size_t length)
+{
+	return length && src[0] == RECORD_MARK;
+}
+
+bool record_decode(const uint8_t *src, size_t length, RECORD_t *rec)
+{
+	if (record_is(src, length) == false) return false;
+	const uint8_t *end = &src[length];
+	src++;
+	uint64_t value;
+	if (get_varint(&src, end, &value) == false || (value & ~(uint64_t)RECORD_ALL)) return false;
+	memset(rec, 0, sizeof(*rec));
+	rec->fields = value;
+#define RECORD_DECODE(name, kind, scale, unit) \
+	if (rec->fields & RECORD_HAS(name)) { \
+		if (get_varint(&src, end, &value) == false) return false; \
+		rec->name = get_##kind(value); \
+	}
+	RECORD_FIELDS(RECORD_DECODE)
+#undef RECORD_DECODE
+	return src == end;
+}
+
+static int format_VARINT(char *dst, size_t size, uint32_t value, int scale, const char *unit)
+{
+	return snprintf(dst, size, " %"PRIu32"%s", value, unit);
+}
+
+static int format_FIXED(char *dst, size_t size, int32_t value, int scale, const char *unit)
+{
+	if (scale == 0) return snprintf(dst, size, " %"PRId32"%s", value, unit);
+	uint32_t divisor = 1;
+	for (int i=0;i<scale;i++) divisor *= 10;
+	uint32_t magnitude = value < 0 ? -(uint32_t)value : (uint32_t)value;
+	return snprintf(dst, size, " %s%"PRIu32".%0*"PRIu32"%s", value < 0 ? "-" : "",
+		magnitude / divisor, scale, magnitude % divisor, unit);
+}
+
+static int format_TIME(char *dst, size_t size, int64_t value, int scale, const char *unit)
+{
+	return snprintf(dst, size, " %"PRId64"%s", value / 1000000, unit);
+}
+
+size_t record_format(const RECORD_t *rec, char *line, size_t size)
+{
+	if (size == 0) return 0;
+	uint32_t device = rec->fields & RECORD_HAS(device) ? rec->device : RECORD_UNKNOWN;
+	if (device >= sizeof(deviceName)/sizeof(deviceName[0])) device = RECORD_UNKNOWN;
+	int n = snprintf(line, size, "%s", deviceName[device]);
+	if (n < size && (rec->fields & RECORD_HAS(counter))) {
+		n += snprintf(&line[n], size - n, ":%"PRIu32, rec->counter);
+	}
+#define RECORD_FORMAT(name, kind, scale, unit) \
+	if (n < size && (rec->fields & RECORD_HAS(name)) && fieldUnit[RECORD_FIELD_##name]) { \
+		n += format_##kind(&line[n], size - n, rec->name, scale, fieldUnit[RECORD_FIELD_##name]); \
+	}
+	RECORD_FIELDS(RECORD_FORMAT)
+#undef RECORD_FORMAT
+	return n < size ? n : size - 1;
+}
@@ -0,0 +1,291 @@
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+
+#include "msgpool.h"
+#include "link.h"
+#include "reliable.h"
+
+#define TAG "RELIABLE"
+
+#define RELIABLE_RTO_INIT_MS 1000
+
+static RELIABLE_STATS_t stats;
+static portMUX_TYPE reliableMux = portMUX_INITIALIZER_UNLOCKED;
+
+// Initiator
+
+typedef struct {
+	CMD_t *cmd;		// NULL once acknowledged
+	uint16_t seq;
+	uint8_t tries;	// transmissions so far
+	int64_t sentAt;	// 0 when not sent on this connection
+} SLOT_t;
+
+// Indexed by seq, base..nextSeq are in flight
+static SLOT_t slots[RELIABLE_WINDOW_MAX];
+static uint8_t window;
+static uint32_t stream;
+static uint16_t base;
+static uint16_t nextSeq;
+static int64_t srtt;	// smoothed round trip in microseconds, 0 before the first sample
+static int64_t rttvar;
+static uint32_t rtoMs = RELIABLE_RTO_INIT_MS;
+static uint8_t txBuf[FRAME_MAX_PAYLOAD];
+
+#define SLOT(seq) (&slots[(seq) % RELIABLE_WINDOW_MAX])
+
+void reliable_init(uint8_t size, uint32_t id)
+{
+	window = size > RELIABLE_WINDOW_MAX ? RELIABLE_WINDOW_MAX : size;
+	stream = id;
+	ESP_LOGI(TAG, "window %d stream %08"PRIx32, window, stream);
+}
+
+bool reliable_full(void)
+{
+	return (uint16_t)(nextSeq - base) >= window;
+}
+
+static void reliable_transmit(uint32_t handle, SLOT_t *slot)
+{
+	int64_t now = esp_timer_get_time();
+	uint8_t type = FRAME_DATA;
+	size_t header = RELIABLE_HEADER;
+	frame_put16(txBuf, slot->seq);
+	if (link_caps() & LINK_CAP_STAMP) {
+		type |= FRAME_STAMP;
+		frame_put32(&txBuf[header], slot->cmd->stamp);
+		frame_put32(&txBuf[header+4], now);
+		header += RELIABLE_STAMP;
+	}
+	memcpy(&txBuf[header], slot->cmd->payload, slot->cmd->length);
+	taskENTER_CRITICAL(&reliableMux);
+	if (slot->tries) stats.retransmits++;
+	else stats.sent++;
+	taskEXIT_CRITICAL(&reliableMux);
+	if (slot->tries < UINT8_MAX) slot->tries++;
+	slot->sentAt = now;
+	link_send(handle, type, txBuf, header + slot->cmd->length);
+}
+
+bool reliable_send(uint32_t handle, CMD_t *cmd)
+{
+	if (cmd->length > sizeof(txBuf) - RELIABLE_HEADER - RELIABLE_STAMP) {
+		ESP_LOGE(TAG, "message of %d bytes does not fit in a frame", (int)cmd->length);
+		msgpool_free(cmd);
+		return true;
+	}
+	if (reliable_full()) return false;
+	SLOT_t *slot = SLOT(nextSeq);
+	slot->cmd = cmd;
+	slot->seq = nextSeq++;
+	slot->tries = 0;
+	slot->sentAt = 0;
+	taskENTER_CRITICAL(&reliableMux);
+	stats.inflight = nextSeq - base;
+	taskEXIT_CRITICAL(&reliableMux);
+	if (handle) reliable_transmit(handle, slot);
+	return true;
+}
+
+void reliable_open(uint32_t handle)
+{
+	uint8_t sync[6];
+	frame_put32(sync, stream);
+	frame_put16(&sync[4], base);
+	link_send(handle, FRAME_SYNC, sync, sizeof(sync));
+	// Whatever the lost connection swallowed
+	for (uint16_t seq=base;seq!=nextSeq;seq++) {
+		SLOT_t *slot = SLOT(seq);
+		if (slot->cmd) reliable_transmit(handle, slot);
+	}
+}
+
+// Jacobson/Karels, from messages that went out once
+static void reliable_rtt(int64_t rtt)
+{
+	if (srtt == 0) {
+		srtt = rtt;
+		rttvar = rtt / 2;
+	} else {
+		int64_t delta = rtt > srtt ? rtt - srtt : srtt - rtt;
+		rttvar = (rttvar * 3 + delta) / 4;
+		srtt = (srtt * 7 + rtt) / 8;
+	}
+	uint32_t rto = (srtt + 4 * rttvar) / 1000;
+	if (rto < RELIABLE_RTO_MIN_MS) rto = RELIABLE_RTO_MIN_MS;
+	if (rto > RELIABLE_RTO_MAX_MS) rto = RELIABLE_RTO_MAX_MS;
+	rtoMs = rto;
+}
+
+void reliable_ack(const uint8_t *payload, size_t length)
+{
+	if (length < 6) return;
+	uint16_t expected = frame_get16(payload);
+	uint32_t received = frame_get32(&payload[2]);
+	int64_t now = esp_timer_get_time();
+	uint32_t acked = 0;
+	for (uint16_t seq=base;seq!=nextSeq;seq++) {
+		SLOT_t *slot = SLOT(seq);
+		if (slot->cmd == NULL) continue;
+		int16_t d = seq - expected;
+		if (d >= 0 && (d >= 32 || (received & (1UL << d)) == 0)) continue;
+		if (slot->tries == 1 && slot->sentAt) reliable_rtt(now - slot->sentAt);
+		msgpool_free(slot->cmd);
+		slot->cmd = NULL;
+		acked++;
+	}
+	while (base != nextSeq && SLOT(base)->cmd == NULL) base++;
+	if (acked == 0) return;
+
+	taskENTER_CRITICAL(&reliableMux);
+	uint32_t before = stats.acked;
+	stats.acked += acked;
+	stats.inflight = nextSeq - base;
+	stats.rtoMs = rtoMs;
+	stats.srttUs = srtt;
+	RELIABLE_STATS_t current = stats;
+	taskEXIT_CRITICAL(&reliableMux);
+	if (before / RELIABLE_REPORT == current.acked / RELIABLE_REPORT) return;
+	ESP_LOGI(TAG, "acked %"PRIu32" sent %"PRIu32" retransmits %"PRIu32" timeouts %"PRIu32" rto %"PRIu32" ms inflight %d",
+		current.acked, current.sent, current.retransmits, current.timeouts, current.rtoMs, current.inflight);
+}
+
+TickType_t reliable_poll(uint32_t handle)
+{
+	// Nothing can go out until reliable_open
+	if (handle == 0) return portMAX_DELAY;
+	int64_t now = esp_timer_get_time();
+	int64_t next = INT64_MAX;
+	bool backedOff = false;
+	for (uint16_t seq=base;seq!=nextSeq;seq++) {
+		SLOT_t *slot = SLOT(seq);
+		if (slot->cmd == NULL) continue;
+		if (slot->sentAt == 0) {
+			reliable_transmit(handle, slot);
+		} else if (now - slot->sentAt >= (int64_t)rtoMs * 1000) {
+			// Back off once per round until an ACK brings a fresh sample
+			if (backedOff == false) rtoMs = rtoMs * 2 > RELIABLE_RTO_MAX_MS ? RELIABLE_RTO_MAX_MS : rtoMs * 2;
+			backedOff = true;
+			taskENTER_CRITICAL(&reliableMux);
+			stats.timeouts++;
+			stats.rtoMs = rtoMs;
+			taskEXIT_CRITICAL(&reliableMux);
+			reliable_transmit(handle, slot);
+		}
+		int64_t deadline = slot->sentAt + (int64_t)rtoMs * 1000;
+		if (deadline < next) next = deadline;
+	}
+	if (next == INT64_MAX) return portMAX_DELAY;
+	if (next <= now) return 0;
+	return pdMS_TO_TICKS((next - now) / 1000) + 1;
+}
+
+// Acceptor
+
+static bool synced;
+static uint32_t rxStream;
+static uint16_t expected;
+static uint32_t received;	// bit i: seq expected+i arrived
+
+static void reliable_send_ack(uint32_t handle)
+{
+	uint8_t ack[6];
+	frame_put16(ack, expected);
+	frame_put32(&ack[2], received);
+	link_send(handle, FRAME_ACK, ack, sizeof(ack));
+}
+
+// Moves expected up to seq, counting the numbers that never arrived
+static uint32_t reliable_skip(uint16_t seq)
+{
+	uint32_t lost = 0;
+	while (expected != seq) {
+		if ((received & 1) == 0) lost++;
+		received >>= 1;
+		expected++;
+	}
+	return lost;
+}
+
+void reliable_sync(uint32_t handle, const uint8_t *payload, size_t length)
+{
+	if (length < 6) return;
+	uint32_t id = frame_get32(payload);
+	uint16_t first = frame_get16(&payload[4]);
+	uint32_t lost = 0;
+	if (synced == false || id != rxStream) {
+		// A new boot of the initiator, or the first one this acceptor sees
+		ESP_LOGI(TAG, "stream %08"PRIx32" from seq %d", id, first);
+		synced = true;
+		rxStream = id;
+		expected = first;
+		received = 0;
+	} else if ((int16_t)(first - expected) > 0) {
+		lost = reliable_skip(first);
+	}
+	if (lost) {
+		taskENTER_CRITICAL(&reliableMux);
+		stats.lost += lost;
+		taskEXIT_CRITICAL(&reliableMux);
+	}
+	reliable_send_ack(handle);
+}
+
+const uint8_t *reliable_receive(uint32_t handle, uint8_t type, const uint8_t *payload, size_t *length, RELIABLE_STAMP_t *stamp)
+{
+	size_t header = RELIABLE_HEADER;
+	stamp->valid = false;
+	if (type & FRAME_STAMP) {
+		if (*length < RELIABLE_HEADER + RELIABLE_STAMP) return NULL;
+		stamp->valid = true;
+		stamp->created = frame_get32(&payload[header]);
+		stamp->sent = frame_get32(&payload[header+4]);
+		header += RELIABLE_STAMP;
+	}
+	if (*length < header) return NULL;
+	uint16_t seq = frame_get16(payload);
+	if (synced == false) {
+		synced = true;
+		expected = seq;
+	}
+	int16_t d = seq - expected;
+	bool fresh = false;
+	if (d >= 0 && d < 32 && (received & (1UL << d)) == 0) {
+		fresh = true;
+		received |= 1UL << d;
+		while (received & 1) {
+			received >>= 1;
+			expected++;
+		}
+	}
+	// Beyond the bitmap is neither new nor a duplicate, the initiator sends it again
+
+	taskENTER_CRITICAL(&reliableMux);
+	if (fresh) stats.delivered++;
+	else if (d < 32) stats.duplicates++;
+	RELIABLE_STATS_t current = stats;
+	taskEXIT_CRITICAL(&reliableMux);
+	reliable_send_ack(handle);
+
+	if (fresh && current.delivered % RELIABLE_REPORT == 0) {
+		uint32_t permille = (uint64_t)current.lost * 1000 / (current.delivered + current.lost);
+		ESP_LOGI(TAG, "delivered %"PRIu32" duplicates %"PRIu32" lost %"PRIu32" (%"PRIu32".%"PRIu32"%%)",
+			current.delivered, current.duplicates, current.lost, permille / 10, permille % 10);
+	}
+	if (fresh == false) return NULL;
+	*length -= header;
+	return &payload[header];
+}
+
+void reliable_stats(RELIABLE_STATS_t *current)
+{
+	taskENTER_CRITICAL(&reliableMux);
+	*current = stats;
+	taskEXIT_CRITICAL(&reliableMux);
+}
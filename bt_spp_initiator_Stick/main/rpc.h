@@ -0,0 +1,59 @@
+#ifndef MAIN_RPC_H_
+#define MAIN_RPC_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "freertos/FreeRTOS.h"
+#include "hist.h"
+
+// Request/response calls over link.c, in both directions.
+//
+//  REQUEST   id (LE16), method, arguments
+//  RESPONSE  id (LE16), status, result
+//
+// The id matches a response to its call, so up to RPC_MAX_PENDING calls
+// can be on the link at once and answers may come back in any order.
+// Handlers run in the task that feeds link_receive (the BTC task) and
+// must be quick.
+#define RPC_MAX_PENDING 8
+#define RPC_MAX_ARGS 32
+#define RPC_MAX_RESULT 64
+#define RPC_REPORT 50	// log the latency of a method every so many calls
+
+typedef enum {
+	RPC_PING,		// echoes the arguments
+	RPC_COUNTERS,	// telemetry and reliable delivery counters
+	RPC_BATTERY,	// AXP192 readings
+	RPC_CONFIG,		// send period, link settings and device name
+	RPC_CLOCK,		// the callee's esp_timer_get_time(), see probe.h
+	RPC_METHOD_MAX
+} rpc_method_t;
+
+typedef enum {
+	RPC_OK,
+	RPC_UNKNOWN,	// no handler for the method on the peer
+	RPC_FAILED,		// the handler returned an error
+	RPC_TIMEOUT,
+	RPC_CLOSED,		// the link went down first
+} rpc_status_t;
+
+// Returns the result length, or -1 for RPC_FAILED
+typedef int (*rpc_handler_t)(const uint8_t *args, size_t length, uint8_t *result, size_t size);
+// Called once per call, with the result when status is RPC_OK
+typedef void (*rpc_done_t)(void *ctx, rpc_method_t method, rpc_status_t status, const uint8_t *result, size_t length);
+
+void rpc_register(rpc_method_t method, rpc_handler_t handler);
+// Returns the call id, or -1 when RPC_MAX_PENDING calls are out already
+int rpc_call(uint32_t handle, rpc_method_t method, const uint8_t *args, size_t length,
+	uint32_t timeoutMs, rpc_done_t done, void *ctx);
+// REQUEST and RESPONSE frames from link.c
+void rpc_receive(uint32_t handle, uint8_t type, const uint8_t *payload, size_t length);
+// Fails calls that timed out. Returns the ticks until the next deadline.
+TickType_t rpc_poll(void);
+// Fails every pending call with RPC_CLOSED
+void rpc_close(void);
+// Round trip of the answered calls, in microseconds
+void rpc_latency(rpc_method_t method, HIST_t *hist);
+void rpc_report(void);
+
+#endif /* MAIN_RPC_H_ */
@@ -1,11 +1,15 @@
 #include <string.h>
+#include <stdbool.h>
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
 
 #include "driver/i2c.h"
 #include "esp_log.h"
 
+#include "axp192.h"
+
 //#include "ssd1306.h"
 
 #define TAG "AXP192"
@@ -13,6 +17,12 @@
 #define	SDA_AXP192	21
 #define	SCL_AXP192	22
 
+static uint8_t shadow[256];
+static uint8_t shadowValid[256 / 8];
+static AXP192_BUS_STATS_t busStats;
+static SemaphoreHandle_t xMutexAXP192 = NULL;
+static StaticSemaphore_t mutexBuffer;
+
 void i2c_master_init()
 {
 	esp_err_t ret;
@@ -29,21 +39,53 @@ void i2c_master_init()
 	assert(ret==ESP_OK);
 	ret = i2c_driver_install(I2C_NUM_0, I2C_MODE_MASTER, 0, 0, 0);
 	assert(ret==ESP_OK);
+	xMutexAXP192 = xSemaphoreCreateMutexStatic(&mutexBuffer);
+	configASSERT( xMutexAXP192 );
 }
 
-uint8_t i2c_read(uint8_t reg) {
+// Registers that keep what was written, so a read can come from the shadow
+// copy and a write of the same value can be skipped. Power status, ADC and
+// coulomb data change by themselves, and the clear bit of the coulomb
+// control register (0xB8) resets itself, so those always go to the chip.
+static bool axp192_cacheable(uint8_t reg) {
+	if (reg >= 0x10 && reg <= 0x3F) return true;
+	if (reg >= 0x80 && reg <= 0x9F) return true;
+	return false;
+}
+
+static bool shadow_get(uint8_t reg, uint8_t *data) {
+	if (axp192_cacheable(reg) == false) return false;
+	if ((shadowValid[reg / 8] & (1 << (reg % 8))) == 0) return false;
+	*data = shadow[reg];
+	return true;
+}
+
+static void shadow_set(uint8_t reg, uint8_t data) {
+	if (axp192_cacheable(reg) == false) return;
+	shadow[reg] = data;
+	shadowValid[reg / 8] |= (1 << (reg % 8));
+}
+
+static void shadow_invalidate(uint8_t reg) {
+	shadowValid[reg / 8] &= ~(1 << (reg % 8));
+}
+
+static esp_err_t axp192_transfer(uint8_t reg, uint8_t *data, size_t len, bool write) {
 	esp_err_t espRc;
-	uint8_t data[1];
-	
+
 	i2c_cmd_handle_t cmd = i2c_cmd_link_create();
 
 	i2c_master_start(cmd);
 	i2c_master_write_byte(cmd, (I2C_AXP192 << 1) | I2C_MASTER_WRITE, true);
 	i2c_master_write_byte(cmd, reg, true);
-
-	i2c_master_start(cmd);
-	i2c_master_write_byte(cmd, (I2C_AXP192 << 1) | I2C_MASTER_READ, true);
-	i2c_master_read_byte(cmd, data, I2C_MASTER_LAST_NACK);
+	if (write) {
+		i2c_master_write(cmd, data, len, true);
+	} else {
+		// The register address increments after every byte
+		i2c_master_start(cmd);
+		i2c_master_write_byte(cmd, (I2C_AXP192 << 1) | I2C_MASTER_READ, true);
+		i2c_master_read(cmd, data, len, I2C_MASTER_LAST_NACK);
+	}
 	i2c_master_stop(cmd);
 
 	espRc = i2c_master_cmd_begin(I2C_NUM_0, cmd, 10/portTICK_PERIOD_MS);
@@ -53,27 +95,52 @@ uint8_t i2c_read(uint8_t reg) {
 		ESP_LOGE(TAG, "AXP192 configuration failed. code: 0x%.2X", espRc);
 	}
 	i2c_cmd_link_delete(cmd);
-	return data[0];
+	busStats.transactions++;
+	busStats.bytes += len;
+	return espRc;
 }
 
-void i2c_write(uint8_t reg, uint8_t data) {
-	esp_err_t espRc;
-	
-	i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+// Reads len registers from reg in one transaction
+esp_err_t i2c_read_bytes(uint8_t reg, uint8_t *data, size_t len) {
+	xSemaphoreTake(xMutexAXP192, portMAX_DELAY);
+	esp_err_t espRc = axp192_transfer(reg, data, len, false);
+	if (espRc == ESP_OK) {
+		for (size_t i=0;i<len;i++) shadow_set(reg + i, data[i]);
+	}
+	xSemaphoreGive(xMutexAXP192);
+	return espRc;
+}
 
-	i2c_master_start(cmd);
-	i2c_master_write_byte(cmd, (I2C_AXP192 << 1) | I2C_MASTER_WRITE, true);
-	i2c_master_write_byte(cmd, reg, true);
-	i2c_master_write_byte(cmd, data, true);
-	i2c_master_stop(cmd);
+uint8_t i2c_read(uint8_t reg) {
+	uint8_t data = 0;
+	xSemaphoreTake(xMutexAXP192, portMAX_DELAY);
+	if (shadow_get(reg, &data)) {
+		busStats.cachedReads++;
+	} else if (axp192_transfer(reg, &data, 1, false) == ESP_OK) {
+		shadow_set(reg, data);
+	}
+	xSemaphoreGive(xMutexAXP192);
+	return data;
+}
 
-	espRc = i2c_master_cmd_begin(I2C_NUM_0, cmd, 10/portTICK_PERIOD_MS);
-	if (espRc == ESP_OK) {
-		ESP_LOGD(TAG, "AXP192 configured successfully");
+void i2c_write(uint8_t reg, uint8_t data) {
+	uint8_t current;
+	xSemaphoreTake(xMutexAXP192, portMAX_DELAY);
+	if (shadow_get(reg, &current) && current == data) {
+		busStats.skippedWrites++;
+	} else if (axp192_transfer(reg, &data, 1, true) == ESP_OK) {
+		shadow_set(reg, data);
 	} else {
-		ESP_LOGE(TAG, "AXP192 configuration failed. code: 0x%.2X", espRc);
+		// The chip may or may not have taken it
+		shadow_invalidate(reg);
 	}
-	i2c_cmd_link_delete(cmd);
+	xSemaphoreGive(xMutexAXP192);
+}
+
+void AXP192_GetBusStats(AXP192_BUS_STATS_t *stats) {
+	xSemaphoreTake(xMutexAXP192, portMAX_DELAY);
+	*stats = busStats;
+	xSemaphoreGive(xMutexAXP192);
 }
 
 // Power On
@@ -174,3 +241,55 @@ void AXP192_StopCoulombcounter() {
 void AXP192_ClearCoulombcounter() {
 	i2c_write(0xB8, 0xA0);
 }
+
+// 12 and 13 bit ADC values are split into high 8 bits and low 4 or 5 bits
+#define ADC12(b, reg) (((b)[(reg) - 0x56] << 4) | ((b)[(reg) - 0x56 + 1] & 0x0f))
+#define ADC13(b, reg) (((b)[(reg) - 0x56] << 5) | ((b)[(reg) - 0x56 + 1] & 0x1f))
+
+// Every ADC result in one transaction
+esp_err_t AXP192_ReadAdc(AXP192_ADC_t *adc) {
+	uint8_t b[0x80 - 0x56];
+	esp_err_t espRc = i2c_read_bytes(0x56, b, sizeof(b));
+	if (espRc != ESP_OK) return espRc;
+	adc->vbusVoltage = ADC12(b, 0x5A) * 17 / 10;
+	adc->vbusCurrent = ADC12(b, 0x5C) * 375;
+	adc->temperature = ADC12(b, 0x5E) - 1447;
+	adc->batVoltage = ADC12(b, 0x78) * 11 / 10;
+	adc->batCurrent = (ADC13(b, 0x7A) - ADC13(b, 0x7C)) * 500;
+	adc->apsVoltage = ADC12(b, 0x7E) * 14 / 10;
+	return ESP_OK;
+}
+
+// Battery voltage in mV, 1.1mV per step
+uint16_t AXP192_GetBatVoltage() {
+	uint8_t b[2] = {0};
+	i2c_read_bytes(0x78, b, 2);
+	return ((b[0] << 4) | (b[1] & 0x0f)) * 11 / 10;
+}
+
+// Battery current in uA, 0.5mA per step. Negative while discharging.
+int32_t AXP192_GetBatCurrent() {
+	uint8_t b[4] = {0};
+	i2c_read_bytes(0x7A, b, 4);
+	int32_t charge = (b[0] << 5) | (b[1] & 0x1f);
+	int32_t discharge = (b[2] << 5) | (b[3] & 0x1f);
+	return (charge - discharge) * 500;
+}
+
+// USB or 5V input present, the battery is then charging rather than discharging
+bool AXP192_IsVbusPresent() {
+	return (i2c_read(0x00) & 0x20) != 0;
+}
+
+// Coulomb counter in uAh, charged minus discharged since the last clear.
+// Each count is 65536 * 0.5mA for one ADC sample period.
+int32_t AXP192_GetCoulombData() {
+	uint8_t b[8] = {0};
+	i2c_read_bytes(0xB0, b, 8);
+	uint32_t charge = (b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3];
+	uint32_t discharge = (b[4] << 24) | (b[5] << 16) | (b[6] << 8) | b[7];
+	// ADC sample rate 25Hz, 50Hz, 100Hz or 200Hz, normally from the shadow copy
+	uint32_t rate = 25 << ((i2c_read(0x84) >> 6) & 0x03);
+	int64_t counts = (int64_t)charge - (int64_t)discharge;
+	return counts * 65536 * 500 / 3600 / rate;
+}
@@ -1,8 +1,32 @@
 #ifndef MAIN_AXP192_H_
 #define MAIN_AXP192_H_
 
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+// Register traffic since boot
+typedef struct {
+	uint32_t transactions;
+	uint32_t bytes;
+	uint32_t cachedReads;	// served from the shadow copy
+	uint32_t skippedWrites;	// same value as the shadow copy
+} AXP192_BUS_STATS_t;
+
+// ADC results, all from one burst read
+typedef struct {
+	uint16_t vbusVoltage;	// mV
+	int32_t vbusCurrent;	// uA
+	int16_t temperature;	// internal, 0.1 degC
+	uint16_t batVoltage;	// mV
+	int32_t batCurrent;		// uA, negative while discharging
+	uint16_t apsVoltage;	// mV
+} AXP192_ADC_t;
+
 void i2c_master_init(void);
 uint8_t i2c_read(uint8_t reg);
+esp_err_t i2c_read_bytes(uint8_t reg, uint8_t *data, size_t len);
 void i2c_write(uint8_t reg, uint8_t data);
 void AXP192_PowerOn(void);
 void AXP192_ScreenBreath(uint8_t brightness);
@@ -10,6 +34,12 @@ void AXP192_EnableCoulombcounter(void);
 void AXP192_DisableCoulombcounter(void);
 void AXP192_StopCoulombcounter(void);
 void AXP192_ClearCoulombcounter(void);
+uint16_t AXP192_GetBatVoltage(void);
+int32_t AXP192_GetBatCurrent(void);
+bool AXP192_IsVbusPresent(void);
+int32_t AXP192_GetCoulombData(void);
+esp_err_t AXP192_ReadAdc(AXP192_ADC_t *adc);
+void AXP192_GetBusStats(AXP192_BUS_STATS_t *stats);
 
 #endif /* MAIN_AXP192_H_ */
 
@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "driver/gpio.h"
+#include "esp_log.h"
+
+#include "button.h"
+#include "telemetry.h"
+#include "msgpool.h"
+
+#define TAG "BUTTON"
+
+// One task serves every button.
+// The edge interrupt wakes it, so nothing runs while no button is touched.
+
+typedef struct {
+	gpio_num_t gpio;
+	uint16_t shortCommand;
+	uint16_t longCommand;
+	const char * payload;
+	bool pressed;
+	TickType_t pressTick;
+} BUTTON_t;
+
+typedef struct {
+	int index;
+	TickType_t tick;
+} EDGE_t;
+
+static BUTTON_t buttons[BUTTON_MAX];
+static int buttonNum = 0;
+static QueueHandle_t xQueueEdge = NULL;
+static StaticQueue_t edgeQueueBuffer;
+static uint8_t edgeQueueStorage[BUTTON_MAX * 2 * sizeof(EDGE_t)];
+
+static void IRAM_ATTR button_isr_handler(void *arg)
+{
+	int index = (intptr_t)arg;
+	EDGE_t edge;
+	edge.index = index;
+	edge.tick = xTaskGetTickCountFromISR();
+	// Masked until the task has debounced this edge
+	gpio_intr_disable(buttons[index].gpio);
+	BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+	xQueueSendFromISR(xQueueEdge, &edge, &xHigherPriorityTaskWoken);
+	if (xHigherPriorityTaskWoken) portYIELD_FROM_ISR();
+}
+
+void button_add(gpio_num_t gpio, uint16_t shortCommand, uint16_t longCommand, const char * payload)
+{
+	assert(buttonNum < BUTTON_MAX);
+	buttons[buttonNum].gpio = gpio;
+	buttons[buttonNum].shortCommand = shortCommand;
+	buttons[buttonNum].longCommand = longCommand;
+	buttons[buttonNum].payload = payload;
+	buttons[buttonNum].pressed = false;
+	buttonNum++;
+}
+
+void button_task(void *pvParameters)
+{
+	ESP_LOGI(pcTaskGetName(NULL), "Start");
+	QueueHandle_t xQueueCmd = (QueueHandle_t)pvParameters;
+
+	xQueueEdge = xQueueCreateStatic(BUTTON_MAX * 2, sizeof(EDGE_t), edgeQueueStorage, &edgeQueueBuffer);
+	configASSERT( xQueueEdge );
+
+	esp_err_t ret = gpio_install_isr_service(0);
+	// Another driver may have installed the service already
+	assert(ret==ESP_OK || ret==ESP_ERR_INVALID_STATE);
+
+	for (int i=0;i<buttonNum;i++) {
+		// set the GPIO as a input
+		gpio_reset_pin(buttons[i].gpio);
+		gpio_set_direction(buttons[i].gpio, GPIO_MODE_DEF_INPUT);
+		gpio_set_intr_type(buttons[i].gpio, GPIO_INTR_ANYEDGE);
+		gpio_isr_handler_add(buttons[i].gpio, button_isr_handler, (void *)(intptr_t)i);
+		ESP_LOGI(TAG, "GPIO%d short=%d long=%d", buttons[i].gpio, buttons[i].shortCommand, buttons[i].longCommand);
+	}
+
+	EDGE_t edge;
+	while(1) {
+		xQueueReceive(xQueueEdge, &edge, portMAX_DELAY);
+		BUTTON_t *button = &buttons[edge.index];
+
+		// Let the contact settle, then trust the level rather than the edge
+		vTaskDelay(pdMS_TO_TICKS(BUTTON_DEBOUNCE_MS));
+		int level = gpio_get_level(button->gpio);
+		gpio_intr_enable(button->gpio);
+
+		if (level == 0 && button->pressed == false) {
+			ESP_LOGI(TAG, "Push Button GPIO%d", button->gpio);
+			button->pressed = true;
+			button->pressTick = edge.tick;
+		} else if (level == 1 && button->pressed == true) {
+			button->pressed = false;
+			TickType_t diffTick = edge.tick - button->pressTick;
+			ESP_LOGI(TAG, "Release Button GPIO%d diffTick=%"PRIu32, button->gpio, diffTick);
+			uint16_t command = button->shortCommand;
+			if (diffTick > BUTTON_LONG_PRESS) command = button->longCommand;
+			size_t length = button->payload ? strlen(button->payload) : 0;
+			CMD_t *cmd = msgpool_alloc(command, length + 1);
+			if (cmd != NULL) {
+				cmd->taskHandle = xTaskGetCurrentTaskHandle();
+				if (button->payload) strcpy((char *)cmd->payload, button->payload);
+				cmd->length = length;
+			}
+			telemetry_send(xQueueCmd, cmd, 0);
+		}
+
+		// An edge that came in while the interrupt was masked
+		if (gpio_get_level(button->gpio) != (button->pressed ? 0 : 1)) {
+			edge.tick = xTaskGetTickCount();
+			xQueueSend(xQueueEdge, &edge, 0);
+		}
+	}
+
+	// nerver reach
+	vTaskDelete(NULL);
+}
@@ -0,0 +1,56 @@
+#ifndef MAIN_CONNMGR_H_
+#define MAIN_CONNMGR_H_
+
+#include "esp_bt_defs.h"
+#include "esp_spp_api.h"
+#include "cmd.h"
+
+// Connection manager of the initiator.
+//
+//            +-> CONNECTING (cached peer) --+
+//  IDLE -----+                              +--> OPEN
+//            +-> DISCOVERING -> SDP -> CONNECTING
+//
+// Every failure, and every drop of an open link that the cached peer
+// can't restore right away, goes to BACKOFF. A timer with jittered
+// exponential delay starts the next attempt from there.
+typedef enum {
+	CONN_IDLE,
+	CONN_DISCOVERING,
+	CONN_SDP,
+	CONN_CONNECTING,
+	CONN_OPEN,
+	CONN_BACKOFF,
+} conn_state_t;
+
+#define CONNMGR_BACKOFF_MIN_MS 500
+#define CONNMGR_BACKOFF_MAX_MS (30*1000)
+
+typedef struct {
+	uint32_t disconnects;	// open links that dropped
+	uint32_t reconnects;	// dropped links that came back
+	uint32_t attempts;		// connect attempts since the last drop
+	int64_t lastRecovery;	// time to recover in microseconds
+	int64_t maxRecovery;
+	uint32_t backlogDrops;
+} CONNMGR_STATS_t;
+
+void connmgr_init(void);
+// Driven by the SPP and GAP callbacks
+void connmgr_start(void);
+void connmgr_found(esp_bd_addr_t bda);
+void connmgr_discovery_stopped(void);
+void connmgr_sdp_done(esp_spp_status_t status, uint8_t scn);
+void connmgr_open(void);
+void connmgr_close(void);
+conn_state_t connmgr_state(void);
+void connmgr_stats(CONNMGR_STATS_t *stats);
+
+// Outbound messages kept while the link is down. The queue is bounded;
+// when it is full the oldest message is dropped, since fresh data is
+// worth more than old data.
+void connmgr_backlog_push(CMD_t *cmd);
+// NULL when empty
+CMD_t *connmgr_backlog_pop(void);
+
+#endif /* MAIN_CONNMGR_H_ */
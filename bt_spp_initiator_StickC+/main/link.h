@@ -0,0 +1,58 @@
+#ifndef MAIN_LINK_H_
+#define MAIN_LINK_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "frame.h"
+
+// Session layer over one SPP connection.
+// The initiator opens every connection with HELLO, the acceptor answers
+// with the capabilities both ends have. Only then may DATA go compressed.
+// A corrupt compressed frame restarts the session: the opener sends
+// HELLO again, or the acceptor asks it to with LINK_HELLO_RESTART.
+// A DATA frame the writer drops is in the send history but never
+// reaches the peer: the next DATA is preceded by LINK_HELLO_RESET.
+// A peer that starts without a magic byte is a plain SPP terminal; the
+// acceptor keeps talking raw text to it.
+#define LINK_VERSION 1
+#define LINK_CAP_LZ 0x01	// DATA payloads share one LZ history per connection
+#define LINK_CAP_STAMP 0x02	// DATA may carry FRAME_STAMP for the latency probes
+#define LINK_HELLO_RESTART 0x01	// HELLO flags: start the session over
+#define LINK_HELLO_RESET 0x02	// the sender's history starts over here, nothing else changes
+
+#define LINK_REPORT_FRAMES 100	// log the compression ratio every so many DATA frames
+
+// Puts bytes on the link, e.g. with esp_spp_write.
+// Returns false when the bytes were dropped.
+typedef bool (*link_write_t)(uint32_t handle, const uint8_t *data, size_t length);
+// Every frame but HELLO, DATA payloads decompressed.
+// type keeps FRAME_STAMP, the other flags are stripped.
+typedef void (*link_data_t)(uint32_t handle, uint8_t type, const uint8_t *payload, size_t length);
+
+typedef struct {
+	uint32_t frames;		// DATA frames
+	uint32_t plainBytes;	// DATA payloads before compression
+	uint32_t wireBytes;		// DATA payloads on the link
+	uint32_t lzFrames;		// frames that went compressed
+	int64_t lzUs;			// time spent compressing or decompressing
+	uint32_t errors;		// corrupt frames and skipped bytes
+} LINK_STATS_t;
+
+// caps: LINK_CAP_ bits this end supports. data may be NULL.
+void link_init(uint8_t caps, link_write_t write, link_data_t data);
+// Initiator, from the task that sends: starts a session with HELLO
+void link_open(uint32_t handle);
+void link_close(void);
+// Thread safe. Frames go out whole, in the order of the calls.
+// type is a frame_type_t, DATA may add FRAME_STAMP.
+bool link_send(uint32_t handle, uint8_t type, const uint8_t *payload, size_t length);
+// Feeds received bytes. Returns false when the peer doesn't speak frames.
+bool link_receive(uint32_t handle, const uint8_t *data, size_t length);
+// Capabilities agreed for this connection
+uint8_t link_caps(void);
+// The peer speaks frames, i.e. it isn't a plain SPP terminal
+bool link_framed(void);
+void link_stats(LINK_STATS_t *stats);
+
+#endif /* MAIN_LINK_H_ */
@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+
+#include "memplan.h"
+#include "msgpool.h"
+
+#define TAG "MSGPOOL"
+
+#define MSGPOOL_STORAGE(name, size, count) \
+	static CMD_t name##_msg[count]; \
+	static uint8_t name##_payload[(count) * (size) + 1]; \
+	static uint8_t name##_free[(count) * sizeof(CMD_t *)];
+MSGPOOL_SLABS(MSGPOOL_STORAGE)
+
+typedef struct {
+	const char * name;
+	CMD_t * msg;
+	uint8_t * payload;
+	uint8_t * free;
+	uint16_t size;
+	uint16_t count;
+} SLAB_PLAN_t;
+
+#define MSGPOOL_SLAB_PLAN(name, size, count) \
+	{ #name, name##_msg, name##_payload, name##_free, size, count },
+static const SLAB_PLAN_t slabPlan[] = {
+	MSGPOOL_SLABS(MSGPOOL_SLAB_PLAN)
+};
+
+#define MSGPOOL_SLAB_MAX (sizeof(slabPlan) / sizeof(slabPlan[0]))
+
+typedef struct {
+	uint16_t used;
+	uint16_t highWater;
+	uint32_t empty; // requests that found this slab empty
+} SLAB_STAT_t;
+
+// The free list of each slab is a queue of pointers
+static StaticQueue_t freeBuffer[MSGPOOL_SLAB_MAX];
+static QueueHandle_t freeList[MSGPOOL_SLAB_MAX];
+static SLAB_STAT_t slabStat[MSGPOOL_SLAB_MAX];
+static portMUX_TYPE poolMux = portMUX_INITIALIZER_UNLOCKED;
+
+void msgpool_init(void)
+{
+	for (int i=0;i<MSGPOOL_SLAB_MAX;i++) {
+		const SLAB_PLAN_t *plan = &slabPlan[i];
+		// msgpool_alloc takes the first slab that fits
+		if (i > 0) assert(plan->size >= slabPlan[i-1].size);
+		freeList[i] = xQueueCreateStatic(plan->count, sizeof(CMD_t *), plan->free, &freeBuffer[i]);
+		configASSERT( freeList[i] );
+		for (int j=0;j<plan->count;j++) {
+			CMD_t *cmd = &plan->msg[j];
+			cmd->slab = i;
+			cmd->size = plan->size;
+			cmd->payload = plan->size ? &plan->payload[j * plan->size] : NULL;
+			xQueueSend(freeList[i], &cmd, 0);
+		}
+	}
+}
+
+CMD_t *msgpool_alloc(uint16_t command, size_t size)
+{
+	CMD_t *cmd = NULL;
+	for (int i=0;i<MSGPOOL_SLAB_MAX;i++) {
+		if (slabPlan[i].size < size) continue;
+		BaseType_t ret = xQueueReceive(freeList[i], &cmd, 0);
+		taskENTER_CRITICAL(&poolMux);
+		if (ret == pdTRUE) {
+			slabStat[i].used++;
+			if (slabStat[i].used > slabStat[i].highWater) slabStat[i].highWater = slabStat[i].used;
+		} else {
+			slabStat[i].empty++;
+		}
+		taskEXIT_CRITICAL(&poolMux);
+		if (ret == pdTRUE) break;
+	}
+	if (cmd == NULL) return NULL;
+
+	cmd->sppHandle = 0;
+	cmd->command = command;
+	cmd->length = 0;
+	cmd->taskHandle = NULL;
+	cmd->stamp = esp_timer_get_time();
+	cmd->upstream = 0;
+	return cmd;
+}
+
+void msgpool_free(CMD_t *cmd)
+{
+	if (cmd == NULL) return;
+	taskENTER_CRITICAL(&poolMux);
+	slabStat[cmd->slab].used--;
+	taskEXIT_CRITICAL(&poolMux);
+	xQueueSend(freeList[cmd->slab], &cmd, 0);
+}
+
+void msgpool_report(void)
+{
+	for (int i=0;i<MSGPOOL_SLAB_MAX;i++) {
+		taskENTER_CRITICAL(&poolMux);
+		SLAB_STAT_t stat = slabStat[i];
+		taskEXIT_CRITICAL(&poolMux);
+		ESP_LOGI(TAG, "slab %-8s %4d bytes x %2d, used %2d peak %2d empty %"PRIu32,
+			slabPlan[i].name, slabPlan[i].size, slabPlan[i].count, stat.used, stat.highWater, stat.empty);
+	}
+}
@@ -0,0 +1,17 @@
+#ifndef MAIN_PEER_H_
+#define MAIN_PEER_H_
+
+#include <stdbool.h>
+#include "esp_bt_defs.h"
+
+// Last acceptor we were connected to, kept in NVS across reboots
+typedef struct {
+	esp_bd_addr_t bda;
+	uint8_t scn; // RFCOMM server channel from SDP
+} PEER_t;
+
+bool peer_load(PEER_t *peer);
+// Writes only when the peer differs from the stored one
+void peer_save(const PEER_t *peer);
+
+#endif /* MAIN_PEER_H_ */
@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/timers.h"
+#include "esp_log.h"
+
+#include "axp192.h"
+#include "sensor.h"
+#include "telemetry.h"
+#include "power.h"
+
+#define TAG "POWER"
+
+#define POWER_LOG 30 // samples between two log records
+
+static portMUX_TYPE powerMux = portMUX_INITIALIZER_UNLOCKED;
+static POWER_t current;
+static StaticTimer_t timerBuffer;
+static uint32_t periodMs;
+static uint32_t baseMessages;
+static uint32_t lastMessages;
+static uint32_t samples;
+static uint32_t lastSample;
+
+// Sums of discharge current over the samples of each kind
+static int64_t idleSum;
+static uint32_t idleCount;
+static int64_t busySum;
+static uint32_t busyCount;
+
+// uA or uAh as mA or mAh with decimals
+static int power_milli(char *buf, size_t size, int32_t micro, int decimals)
+{
+	int32_t scale = 1;
+	for (int i=decimals;i<3;i++) scale *= 10;
+	int32_t value = abs(micro) / scale;
+	int32_t unit = 1;
+	for (int i=0;i<decimals;i++) unit *= 10;
+	return snprintf(buf, size, "%s%"PRId32".%0*"PRId32, micro < 0 ? "-" : "",
+		value / unit, decimals, value % unit);
+}
+
+static void power_timer_cb(TimerHandle_t arg)
+{
+	POWER_t p;
+	taskENTER_CRITICAL(&powerMux);
+	p = current;
+	taskEXIT_CRITICAL(&powerMux);
+
+	// No I2C here, sensor_task reads the AXP192
+	SENSOR_t s;
+	if (sensor_get(&s) == false || s.sample == lastSample) return;
+	lastSample = s.sample;
+	p.batVoltage = s.adc.batVoltage;
+	p.batCurrent = s.adc.batCurrent;
+	p.vbus = s.vbus;
+	p.usedUah = -s.coulomb;
+	uint32_t messages = telemetry_messages();
+	bool busy = (messages != lastMessages);
+	lastMessages = messages;
+	samples++;
+	p.seconds = samples * periodMs / 1000;
+	p.messages = messages - baseMessages;
+
+	// Charging current says nothing about the radio
+	if (p.vbus == false) {
+		int32_t draw = p.batCurrent < 0 ? -p.batCurrent : 0;
+		if (busy) {
+			busySum += draw;
+			busyCount++;
+		} else {
+			idleSum += draw;
+			idleCount++;
+		}
+	}
+	p.idleUa = idleCount ? idleSum / idleCount : 0;
+	p.busyUa = busyCount ? busySum / busyCount : 0;
+	p.totalPer1000 = 0;
+	p.trafficPer1000 = 0;
+	if (p.messages) {
+		p.totalPer1000 = (int64_t)p.usedUah * 1000 / p.messages;
+		if (idleCount && busyCount) {
+			// Extra current while busy, times the busy time, in uAh
+			int64_t extra = (int64_t)(p.busyUa - p.idleUa) * busyCount * periodMs / 1000 / 3600;
+			p.trafficPer1000 = extra * 1000 / p.messages;
+		}
+	}
+
+	taskENTER_CRITICAL(&powerMux);
+	current = p;
+	taskEXIT_CRITICAL(&powerMux);
+
+	if (samples % POWER_LOG) return;
+	char lines[10][TELEMETRY_LINE];
+	int num = power_format(&p, lines, 10);
+	char record[10 * (TELEMETRY_LINE + 1) + 1];
+	int len = 0;
+	record[0] = 0;
+	for (int i=0;i<num;i++) {
+		len += snprintf(&record[len], sizeof(record)-len, " %s", lines[i]);
+	}
+	ESP_LOGI(TAG, "%"PRIu32"s%s", p.seconds, record);
+}
+
+void power_init(TickType_t period)
+{
+	periodMs = period * portTICK_PERIOD_MS;
+	AXP192_EnableCoulombcounter();
+	AXP192_ClearCoulombcounter();
+	baseMessages = lastMessages = telemetry_messages();
+	TimerHandle_t timer = xTimerCreateStatic("power", period, true, NULL, power_timer_cb, &timerBuffer);
+	configASSERT( timer );
+	xTimerStart(timer, 0);
+}
+
+void power_get(POWER_t *p)
+{
+	taskENTER_CRITICAL(&powerMux);
+	*p = current;
+	taskEXIT_CRITICAL(&powerMux);
+}
+
+int power_format(const POWER_t *p, char lines[][TELEMETRY_LINE], int maxLines)
+{
+	int num = 0;
+	char value[12];
+#define LINE(...) if (num < maxLines) snprintf(lines[num++], TELEMETRY_LINE, __VA_ARGS__)
+	LINE("bat %"PRIu16"mV", p->batVoltage);
+	power_milli(value, sizeof(value), p->batCurrent, 1);
+	LINE("%s %smA", p->vbus ? "usb" : "cur", value);
+	power_milli(value, sizeof(value), p->usedUah, 3);
+	LINE("used %smAh", value);
+	LINE("msgs %"PRIu32, p->messages);
+	power_milli(value, sizeof(value), p->idleUa, 1);
+	LINE("idle %smA", value);
+	power_milli(value, sizeof(value), p->busyUa, 1);
+	LINE("busy %smA", value);
+	// mAh per 1000 messages
+	power_milli(value, sizeof(value), p->totalPer1000, 3);
+	LINE("1k %smAh", value);
+	power_milli(value, sizeof(value), p->trafficPer1000, 3);
+	LINE("1k+ %smAh", value);
+#undef LINE
+	return num;
+}
@@ -0,0 +1,30 @@
+#ifndef MAIN_POWER_H_
+#define MAIN_POWER_H_
+
+#include "freertos/FreeRTOS.h"
+#include "telemetry.h"
+
+// Energy per message, measured with the AXP192 ADC and coulomb counter.
+// Every sample period the battery current goes to the idle or the busy
+// average, depending on whether any SPP message moved in that period.
+// The figures only mean something on battery; on USB the PMIC charges.
+typedef struct {
+	uint16_t batVoltage;	// mV
+	int32_t batCurrent;		// uA, negative while discharging
+	bool vbus;				// USB powered
+	uint32_t seconds;		// since power_init
+	uint32_t messages;		// rx + tx since power_init
+	int32_t usedUah;		// coulomb counter, discharged minus charged
+	int32_t idleUa;			// mean discharge current without traffic
+	int32_t busyUa;			// mean discharge current with traffic
+	int32_t totalPer1000;	// usedUah per 1000 messages, idle draw included
+	int32_t trafficPer1000;	// the part above idle draw per 1000 messages
+} POWER_t;
+
+// Reads the snapshots of sensor_task. Clears the coulomb counter.
+void power_init(TickType_t period);
+void power_get(POWER_t *p);
+// Formats a sample into lines of TELEMETRY_LINE bytes. Returns the number of lines.
+int power_format(const POWER_t *p, char lines[][TELEMETRY_LINE], int maxLines);
+
+#endif /* MAIN_POWER_H_ */
@@ -0,0 +1,66 @@
+#ifndef MAIN_RATEMGR_H_
+#define MAIN_RATEMGR_H_
+
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/timers.h"
+
+// Send rate of the initiator, as the period of the send timer.
+//
+// AIMD, as TCP does it: the rate doubles every second until the first
+// sign of congestion (slow start), then grows by RATEMGR_STEP every
+// second and halves on every sign of congestion:
+//  cong    ESP_SPP_CONG_EVT, the stack has no room for another write
+//  loss    a message was not acknowledged within the retransmission timeout
+//  window  every message of the reliable window is waiting for its ACK
+//  queue   messages wait in the command queue of the tft task
+//  rtt     the smoothed ACK round trip is twice its minimum, so a queue
+//          builds up somewhere on the path
+// The rate halves at most once per round trip, as one queue shows up
+// in several signals.
+// While no message is offered (stopped or no link) the rate starts
+// over from the floor.
+//
+// Rates are in messages per 1000 seconds.
+#define RATEMGR_STEP 1000
+#define RATEMGR_QUEUE_MAX 4
+#define RATEMGR_RTT_SLACK_MS 20	// an rtt this close to the minimum is never inflated
+#define RATEMGR_HOLD_MS 200		// least time between two decreases
+#define RATEMGR_REPORT_MS 10000
+
+typedef enum {
+	RATEMGR_CONG,
+	RATEMGR_LOSS,
+	RATEMGR_WINDOW,
+	RATEMGR_QUEUE,
+	RATEMGR_RTT,
+	RATEMGR_REASON_MAX
+} ratemgr_reason_t;
+
+typedef struct {
+	TimerHandle_t timer;	// the send timer
+	QueueHandle_t queue;	// where the messages wait for the tft task
+	uint8_t window;			// of reliable.c
+	uint32_t floor;
+	uint32_t ceiling;
+} RATEMGR_CONFIG_t;
+
+typedef struct {
+	uint32_t rate;
+	uint32_t decreases[RATEMGR_REASON_MAX];
+	uint32_t congestion;	// ESP_SPP_CONG_EVT
+} RATEMGR_STATS_t;
+
+// Starts the timer at the floor rate
+void ratemgr_init(const RATEMGR_CONFIG_t *config);
+// ESP_SPP_CONG_EVT with cong set, from the BTC task
+void ratemgr_congestion(void);
+// From the task that sends, for every message it takes while the link is up
+void ratemgr_offer(void);
+// From the send timer callback, once per message
+void ratemgr_tick(void);
+uint32_t ratemgr_period_ms(void);
+void ratemgr_stats(RATEMGR_STATS_t *stats);
+
+#endif /* MAIN_RATEMGR_H_ */
@@ -0,0 +1,23 @@
+#ifndef MAIN_SENSOR_H_
+#define MAIN_SENSOR_H_
+
+#include "axp192.h"
+
+#define SENSOR_PERIOD_MS 1000
+
+// One reading of the AXP192
+typedef struct {
+	uint32_t sample;	// counts up from 1
+	int64_t time;		// esp_timer_get_time() of the reading
+	bool vbus;			// USB or 5V input present
+	AXP192_ADC_t adc;
+	int32_t coulomb;	// uAh, charged minus discharged
+} SENSOR_t;
+
+// Low priority task that reads the AXP192 every SENSOR_PERIOD_MS.
+// It is the only task on the I2C bus after startup.
+void sensor_task(void *pvParameters);
+// Latest reading, from any task and without a lock. false until the first one.
+bool sensor_get(SENSOR_t *s);
+
+#endif /* MAIN_SENSOR_H_ */
@@ -26,6 +26,24 @@ static const int SPI_Frequency = SPI_MASTER_FREQ_20M;
 //static const int SPI_Frequency = SPI_MASTER_FREQ_80M;
 
 
+static esp_err_t spi_master_add_device(TFT_t * dev, int clock_speed_hz)
+{
+	spi_device_interface_config_t devcfg={
+		.clock_speed_hz = clock_speed_hz,
+		.spics_io_num = dev->_cs,
+		.queue_size = 7,
+		.mode = 2,
+		.flags = SPI_DEVICE_NO_DUMMY,
+	};
+
+	spi_device_handle_t handle;
+	esp_err_t ret = spi_bus_add_device( HSPI_HOST, &devcfg, &handle);
+	if (ret != ESP_OK) return ret;
+	dev->_SPIHandle = handle;
+	dev->_clock = clock_speed_hz;
+	return ESP_OK;
+}
+
 void spi_master_init(TFT_t * dev, int16_t GPIO_MOSI, int16_t GPIO_SCLK, int16_t GPIO_CS, int16_t GPIO_DC, int16_t GPIO_RESET, int16_t GPIO_BL)
 {
 	esp_err_t ret;
@@ -79,26 +97,25 @@ void spi_master_init(TFT_t * dev, int16_t GPIO_MOSI, int16_t GPIO_SCLK, int16_t
 	ESP_LOGD(TAG, "spi_bus_initialize=%d",ret);
 	assert(ret==ESP_OK);
 
-	spi_device_interface_config_t devcfg={
-		.clock_speed_hz = SPI_Frequency,
-		.queue_size = 7,
-		.mode = 2,
-		.flags = SPI_DEVICE_NO_DUMMY,
-	};
-
-	if ( GPIO_CS >= 0 ) {
-		devcfg.spics_io_num = GPIO_CS;
-	} else {
-		devcfg.spics_io_num = -1;
-	}
-	
-	spi_device_handle_t handle;
-	ret = spi_bus_add_device( HSPI_HOST, &devcfg, &handle);
-	ESP_LOGD(TAG, "spi_bus_add_device=%d",ret);
-	assert(ret==ESP_OK);
 	dev->_dc = GPIO_DC;
 	dev->_bl = GPIO_BL;
-	dev->_SPIHandle = handle;
+	dev->_cs = GPIO_CS >= 0 ? GPIO_CS : -1;
+	ret = spi_master_add_device(dev, SPI_Frequency);
+	ESP_LOGD(TAG, "spi_bus_add_device=%d",ret);
+	assert(ret==ESP_OK);
+}
+
+// Replaces the SPI device with one clocked at clock_speed_hz.
+// Returns false and keeps the previous clock when the bus refuses it.
+bool spi_master_set_clock(TFT_t * dev, int clock_speed_hz)
+{
+	int previous = dev->_clock;
+	esp_err_t ret = spi_bus_remove_device(dev->_SPIHandle);
+	assert(ret==ESP_OK);
+	if (spi_master_add_device(dev, clock_speed_hz) == ESP_OK) return true;
+	ret = spi_master_add_device(dev, previous);
+	assert(ret==ESP_OK);
+	return false;
 }
 
 
@@ -0,0 +1,94 @@
+#ifndef MAIN_XFER_H_
+#define MAIN_XFER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "frame.h"
+
+// File transfer from an initiator (xfer_tx.c) to the acceptor (xfer_rx.c).
+//
+//  sender                      receiver
+//  FILE OFFER size crc name -->
+//                           <-- FILE ACCEPT offset
+//  CHUNK offset data        -->
+//  CHUNK offset data        -->    blocks go to flash in the background
+//                           <-- FILE PROGRESS offset on flash
+//  ...
+//                           <-- FILE RESULT status
+//
+// RFCOMM doesn't lose or reorder bytes, so chunks aren't acknowledged one
+// by one. PROGRESS only opens the window, which keeps the sender at most
+// XFER_WINDOW bytes ahead of the flash. After a drop the receiver answers
+// the same OFFER with the offset it already has. A receiver that can't
+// take a chunk stops with RESULT AGAIN, and the sender offers the file
+// again, up to XFER_RETRIES times in a row.
+#define XFER_BLOCK 4096		// flash write and file read size
+#define XFER_WINDOW (2*XFER_BLOCK)	// one block on flash, one filling
+#define XFER_CHUNK 976		// a CHUNK frame fills one 990 byte RFCOMM packet
+#define XFER_NAME 24
+#define XFER_TIMEOUT_MS 5000
+#define XFER_RETRIES 5
+#define XFER_FIRMWARE "firmware.bin"	// goes to the inactive OTA slot, see ota.h
+
+typedef enum {
+	XFER_OFFER = 1,		// size (LE32), crc32 (LE32), name
+	XFER_ACCEPT,		// offset (LE32)
+	XFER_REFUSE,		// status
+	XFER_PROGRESS,		// offset (LE32)
+	XFER_RESULT,		// status
+} xfer_op_t;
+
+typedef enum {
+	XFER_OK,
+	XFER_BAD_CRC,
+	XFER_IO_ERROR,
+	XFER_BUSY,
+	XFER_AGAIN,		// stopped, offer it again to resume
+} xfer_status_t;
+
+typedef enum {
+	XFER_IDLE,
+	XFER_RUNNING,
+	XFER_DONE,
+	XFER_FAILED,
+} xfer_state_t;
+
+typedef struct {
+	char name[XFER_NAME];
+	xfer_state_t state;
+	uint32_t offset;	// bytes on flash
+	uint32_t size;
+	uint32_t bytesPerSec;	// since the transfer (or resume) started
+} XFER_PROGRESS_t;
+
+uint32_t xfer_crc32(uint32_t crc, const uint8_t *data, size_t length);
+
+// Sender. Runs its own task; files wait in a queue while the link is down.
+#define XFER_PATH 40
+typedef char XFER_PATH_t[XFER_PATH];
+
+void xfer_tx_init(void);
+// path: a file on /spiffs. false when the queue is full.
+bool xfer_send(const char *path);
+void xfer_tx_open(uint32_t handle);
+void xfer_tx_close(void);
+// ESP_SPP_WRITE_EVT, after mux_write_done: the BULK channel may have room
+void xfer_write_done(void);
+void xfer_tx_receive(uint32_t handle, uint8_t type, const uint8_t *payload, size_t length);
+
+// Receiver. Files are written by their own task, under /spiffs.
+typedef struct {
+	uint8_t op;		// XFER_OFFER, XFER_PROGRESS (a block to write) or 0 (link closed)
+	uint8_t buffer;
+	uint16_t length;
+} XFER_JOB_t;
+
+// progress is called from that task after every block.
+typedef void (*xfer_progress_t)(const XFER_PROGRESS_t *progress);
+void xfer_rx_init(xfer_progress_t progress);
+void xfer_rx_close(void);
+void xfer_rx_receive(uint32_t handle, uint8_t type, const uint8_t *payload, size_t length);
+void xfer_rx_progress(XFER_PROGRESS_t *progress);
+
+#endif /* MAIN_XFER_H_ */
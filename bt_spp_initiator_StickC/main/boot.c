@@ -0,0 +1,87 @@
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/event_groups.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+
+#include "boot.h"
+
+#define TAG "BOOT"
+
+#define BOOT_BAR 32 // width of the timeline bars
+
+static const char * stageName[BOOT_STAGE_MAX] = {
+	"nvs", "bt", "spiffs", "panel", "font", "first pixel", "connectable"
+};
+
+typedef struct {
+	int64_t start;
+	int64_t end;
+} STAGE_TIME_t;
+
+static STAGE_TIME_t stageTime[BOOT_STAGE_MAX];
+static uint32_t stageExpected = 0;
+static uint32_t stageEnded = 0;
+static bool reported = false;
+static EventGroupHandle_t xEventBoot = NULL;
+static StaticEventGroup_t eventBootBuffer;
+static portMUX_TYPE bootMux = portMUX_INITIALIZER_UNLOCKED;
+
+static void boot_report(void)
+{
+	int64_t last = 1;
+	for (int i=0;i<BOOT_STAGE_MAX;i++) {
+		if (stageTime[i].end > last) last = stageTime[i].end;
+	}
+	ESP_LOGI(TAG, "%-12s %8s %8s", "stage", "start", "end(ms)");
+	for (int i=0;i<BOOT_STAGE_MAX;i++) {
+		if ((stageExpected & BOOT_BIT(i)) == 0) continue;
+		char bar[BOOT_BAR+1];
+		int from = stageTime[i].start * BOOT_BAR / last;
+		int to = stageTime[i].end * BOOT_BAR / last;
+		for (int j=0;j<BOOT_BAR;j++) {
+			bar[j] = (j >= from && j <= to) ? '#' : '.';
+		}
+		bar[BOOT_BAR] = 0;
+		ESP_LOGI(TAG, "%-12s %8"PRId64" %8"PRId64" %s", stageName[i],
+			stageTime[i].start / 1000, stageTime[i].end / 1000, bar);
+	}
+}
+
+void boot_init(uint32_t stages)
+{
+	stageExpected = stages;
+	xEventBoot = xEventGroupCreateStatic(&eventBootBuffer);
+	configASSERT( xEventBoot );
+}
+
+void boot_begin(boot_stage_t stage)
+{
+	taskENTER_CRITICAL(&bootMux);
+	stageTime[stage].start = esp_timer_get_time();
+	taskEXIT_CRITICAL(&bootMux);
+}
+
+void boot_end(boot_stage_t stage)
+{
+	bool report = false;
+	taskENTER_CRITICAL(&bootMux);
+	stageTime[stage].end = esp_timer_get_time();
+	stageEnded |= BOOT_BIT(stage);
+	// Whoever ends the last stage prints the timeline
+	if (stageEnded == stageExpected && reported == false) {
+		reported = true;
+		report = true;
+	}
+	taskEXIT_CRITICAL(&bootMux);
+	xEventGroupSetBits(xEventBoot, BOOT_BIT(stage));
+	if (report) boot_report();
+}
+
+void boot_wait(boot_stage_t stage)
+{
+	xEventGroupWaitBits(xEventBoot, BOOT_BIT(stage), pdFALSE, pdTRUE, portMAX_DELAY);
+}
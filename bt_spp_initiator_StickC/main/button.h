@@ -0,0 +1,19 @@
+#ifndef MAIN_BUTTON_H_
+#define MAIN_BUTTON_H_
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "driver/gpio.h"
+#include "cmd.h"
+
+#define BUTTON_MAX 3
+#define BUTTON_DEBOUNCE_MS 20
+#define BUTTON_LONG_PRESS 200 // ticks
+
+// shortCommand is posted when the button is released within BUTTON_LONG_PRESS ticks,
+// longCommand otherwise. payload may be NULL.
+void button_add(gpio_num_t gpio, uint16_t shortCommand, uint16_t longCommand, const char * payload);
+// pvParameters:queue that receives CMD_t
+void button_task(void *pvParameters);
+
+#endif /* MAIN_BUTTON_H_ */
@@ -1,16 +1,32 @@
+#ifndef MAIN_CMD_H_
+#define MAIN_CMD_H_
+
 typedef enum {
 	CMD_OPEN,
 	CMD_SEND,
 	CMD_START,
 	CMD_STOP,
 	CMD_RECEIVE,
-	CMD_CLOSE
+	CMD_CLOSE,
+	CMD_STATS,
+	CMD_TELEMETRY,
+	CMD_ACK,
+	CMD_QUERY,
+	CMD_RESULT,
+	CMD_XFER,
+	CMD_MAX
 } command_t;
 
+// Allocated from msgpool.c, queues carry pointers
 typedef struct {
 	uint32_t sppHandle;
 	uint16_t command;
+	uint8_t slab;
+	uint16_t size; // payload capacity
 	size_t length;
-	uint8_t payload[64];
+	uint8_t *payload;
 	TaskHandle_t taskHandle;
+	int64_t stamp; // esp_timer_get_time() when allocated
+	uint32_t upstream; // microseconds from creation on the peer to arrival, 0 when unknown
 } CMD_t;
+#endif /* MAIN_CMD_H_ */
@@ -0,0 +1,38 @@
+#ifndef MAIN_COALESCE_H_
+#define MAIN_COALESCE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "link.h"
+
+// Gathers small writes into writes of up to one RFCOMM MTU.
+// RFCOMM doesn't keep write boundaries, so frames may be split or
+// packed together freely; the receiver reassembles them anyway.
+// Bytes go out when
+//  full    the buffer holds a whole MTU
+//  urgent  a frame other than DATA or CHUNK was added (HELLO, ACK, RPC),
+//          so the round trips the reliable layer and RPC measure stay short
+//  timer   the oldest byte has waited COALESCE_DELAY_MS
+#define COALESCE_DELAY_MS 10
+#define COALESCE_REPORT 100	// log every so many writes
+
+typedef struct {
+	uint32_t frames;	// calls of coalesce_write
+	uint32_t writes;	// calls of the write below
+	uint32_t bytes;
+	uint32_t full;
+	uint32_t urgent;
+	uint32_t timer;
+} COALESCE_STATS_t;
+
+// write puts the gathered bytes on the link, e.g. with esp_spp_write.
+// mtu is the most it takes at once.
+void coalesce_init(link_write_t write, size_t mtu);
+// A link_write_t, for link_init. Thread safe.
+// Always true, a write that fails below ends the connection instead.
+bool coalesce_write(uint32_t handle, const uint8_t *data, size_t length);
+// The link is gone, drops what is pending
+void coalesce_close(void);
+void coalesce_stats(COALESCE_STATS_t *stats);
+
+#endif /* MAIN_COALESCE_H_ */
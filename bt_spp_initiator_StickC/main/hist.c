@@ -0,0 +1,56 @@
+#include <string.h>
+
+#include "hist.h"
+
+void hist_reset(HIST_t *hist)
+{
+	memset(hist, 0, sizeof(HIST_t));
+}
+
+static int hist_bucket(uint32_t value)
+{
+	if (value < HIST_SUB) return value;
+	int msb = 31 - __builtin_clz(value);
+	int shift = msb - HIST_SUB_BITS;
+	int bucket = (shift + 1) * HIST_SUB + ((value >> shift) & (HIST_SUB - 1));
+	return bucket < HIST_BUCKETS ? bucket : HIST_BUCKETS - 1;
+}
+
+static uint32_t hist_upper(int bucket)
+{
+	if (bucket < HIST_SUB) return bucket;
+	int shift = bucket / HIST_SUB - 1;
+	uint32_t lower = (uint32_t)(HIST_SUB + bucket % HIST_SUB) << shift;
+	return lower + (1UL << shift) - 1;
+}
+
+void hist_add(HIST_t *hist, uint32_t value)
+{
+	hist->counts[hist_bucket(value)]++;
+	hist->total++;
+	hist->sum += value;
+	if (value > hist->max) hist->max = value;
+}
+
+uint32_t hist_percentile(const HIST_t *hist, uint8_t percent)
+{
+	if (hist->total == 0) return 0;
+	// Rank of the value, rounded up
+	uint64_t rank = ((uint64_t)hist->total * percent + 99) / 100;
+	if (rank == 0) rank = 1;
+	uint64_t seen = 0;
+	for (int i=0;i<HIST_BUCKETS;i++) {
+		seen += hist->counts[i];
+		if (seen >= rank) {
+			uint32_t upper = hist_upper(i);
+			return upper < hist->max ? upper : hist->max;
+		}
+	}
+	return hist->max;
+}
+
+uint32_t hist_mean(const HIST_t *hist)
+{
+	if (hist->total == 0) return 0;
+	return hist->sum / hist->total;
+}
@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/timers.h"
+#include "esp_system.h"
+#include "esp_log.h"
+
+#include "memplan.h"
+#include "msgpool.h"
+
+#define TAG "MEMPLAN"
+
+// Stack sizes in the table are bytes, as for xTaskCreate on ESP-IDF
+#define MEMPLAN_STACK(name, stack, priority) \
+	static StackType_t name##_stack[(stack) / sizeof(StackType_t)];
+MEMPLAN_TASKS(MEMPLAN_STACK)
+
+#define MEMPLAN_STORAGE(name, type, length) \
+	static uint8_t name##_storage[(length) * sizeof(type)];
+MEMPLAN_QUEUES(MEMPLAN_STORAGE)
+
+typedef struct {
+	const char * name;
+	StackType_t * stack;
+	uint32_t depth;
+	UBaseType_t priority;
+} TASK_PLAN_t;
+
+typedef struct {
+	const char * name;
+	uint8_t * storage;
+	UBaseType_t length;
+	UBaseType_t size;
+} QUEUE_PLAN_t;
+
+#define MEMPLAN_TASK_PLAN(name, stack, priority) \
+	{ #name, name##_stack, (stack) / sizeof(StackType_t), priority },
+static const TASK_PLAN_t taskPlan[] = {
+	MEMPLAN_TASKS(MEMPLAN_TASK_PLAN)
+};
+
+#define MEMPLAN_QUEUE_PLAN(name, type, length) \
+	{ #name, name##_storage, length, sizeof(type) },
+static const QUEUE_PLAN_t queuePlan[] = {
+	MEMPLAN_QUEUES(MEMPLAN_QUEUE_PLAN)
+};
+
+static StaticTask_t taskBuffer[MEMPLAN_TASK_MAX];
+static TaskHandle_t taskHandle[MEMPLAN_TASK_MAX];
+static StaticQueue_t queueBuffer[MEMPLAN_QUEUE_MAX];
+static QueueHandle_t queueHandle[MEMPLAN_QUEUE_MAX];
+static StaticTimer_t timerBuffer;
+
+#define MEMPLAN_TASK_BYTES(name, stack, priority) + (stack) + sizeof(StaticTask_t)
+#define MEMPLAN_QUEUE_BYTES(name, type, length) + (length) * sizeof(type) + sizeof(StaticQueue_t)
+#define MEMPLAN_SLAB_BYTES(name, size, count) + (count) * ((size) + sizeof(CMD_t) + sizeof(CMD_t *)) + sizeof(StaticQueue_t)
+#define MEMPLAN_TOTAL (0 MEMPLAN_TASKS(MEMPLAN_TASK_BYTES) MEMPLAN_QUEUES(MEMPLAN_QUEUE_BYTES) MSGPOOL_SLABS(MEMPLAN_SLAB_BYTES))
+
+_Static_assert(MEMPLAN_TOTAL <= MEMPLAN_BUDGET, "memplan_table.h exceeds MEMPLAN_BUDGET");
+
+const size_t memplan_static_bytes = MEMPLAN_TOTAL;
+
+TaskHandle_t memplan_task_create(memplan_task_t id, TaskFunction_t function, void * param)
+{
+	const TASK_PLAN_t *plan = &taskPlan[id];
+	taskHandle[id] = xTaskCreateStatic(function, plan->name, plan->depth, param, plan->priority,
+		plan->stack, &taskBuffer[id]);
+	configASSERT( taskHandle[id] );
+	return taskHandle[id];
+}
+
+QueueHandle_t memplan_queue_create(memplan_queue_t id)
+{
+	const QUEUE_PLAN_t *plan = &queuePlan[id];
+	queueHandle[id] = xQueueCreateStatic(plan->length, plan->size, plan->storage, &queueBuffer[id]);
+	configASSERT( queueHandle[id] );
+	return queueHandle[id];
+}
+
+// Print how deep each stack has ever been, so the table can be tightened
+void memplan_report(void)
+{
+	ESP_LOGI(TAG, "static %d/%d bytes, heap free %"PRIu32" min %"PRIu32,
+		(int)memplan_static_bytes, MEMPLAN_BUDGET, esp_get_free_heap_size(), esp_get_minimum_free_heap_size());
+	for (int i=0;i<MEMPLAN_TASK_MAX;i++) {
+		if (taskHandle[i] == NULL) continue;
+		uint32_t depth = taskPlan[i].depth * sizeof(StackType_t);
+		uint32_t unused = uxTaskGetStackHighWaterMark(taskHandle[i]) * sizeof(StackType_t);
+		ESP_LOGI(TAG, "task %-8s stack %5"PRIu32" used %5"PRIu32" unused %5"PRIu32,
+			taskPlan[i].name, depth, depth - unused, unused);
+	}
+	for (int i=0;i<MEMPLAN_QUEUE_MAX;i++) {
+		if (queueHandle[i] == NULL) continue;
+		ESP_LOGI(TAG, "queue %-8s %d x %d bytes, %d waiting",
+			queuePlan[i].name, queuePlan[i].length, queuePlan[i].size, uxQueueMessagesWaiting(queueHandle[i]));
+	}
+	msgpool_report();
+}
+
+static void memplan_timer_cb(TimerHandle_t arg)
+{
+	memplan_report();
+}
+
+void memplan_report_start(TickType_t period)
+{
+	memplan_report();
+	TimerHandle_t timer = xTimerCreateStatic("memplan", period, true, NULL, memplan_timer_cb, &timerBuffer);
+	xTimerStart(timer, 0);
+}
@@ -0,0 +1,50 @@
+#ifndef MAIN_POWERMGR_H_
+#define MAIN_POWERMGR_H_
+
+#include "esp_bt_defs.h"
+#include "esp_gap_bt_api.h"
+
+// Power policy of the initiator.
+//
+// IDLE   : sparse traffic such as one message every 2 seconds.
+//          Long ACL poll interval, light sleep and low CPU clock allowed.
+// ACTIVE : two messages closer than POWERMGR_BURST_MS.
+//          Short poll interval, CPU at full clock and awake.
+//          Falls back to IDLE after POWERMGR_QUIET_MS without a burst.
+//
+// Bluedroid puts the link into sniff mode by itself when the SPP
+// connection is idle; its mode changes are logged and counted.
+typedef enum {
+	POWERMGR_IDLE,
+	POWERMGR_ACTIVE,
+	POWERMGR_MODE_MAX
+} powermgr_mode_t;
+
+#define POWERMGR_BURST_MS 500
+#define POWERMGR_QUIET_MS 3000
+// ACL poll interval in 625us slots
+#define POWERMGR_POLL_ACTIVE 40
+#define POWERMGR_POLL_IDLE 400
+
+typedef struct {
+	uint32_t writes;		// write requests that completed
+	uint32_t sniffWrites;	// of those, started while the link was in sniff mode
+	int64_t sumLatency;		// esp_spp_write to ESP_SPP_WRITE_EVT in microseconds
+	int64_t maxLatency;
+} POWERMGR_STATS_t;
+
+// Enables light sleep and frequency scaling when CONFIG_PM_ENABLE is set
+void powermgr_init(void);
+// Driven by the SPP and GAP callbacks
+void powermgr_open(esp_bd_addr_t bda);
+void powermgr_close(void);
+void powermgr_link_mode(esp_bt_pm_mode_t mode);
+// Any message received
+void powermgr_traffic(void);
+// Call right before esp_spp_write, and on ESP_SPP_WRITE_EVT
+void powermgr_write_start(void);
+void powermgr_write_done(void);
+powermgr_mode_t powermgr_mode(void);
+void powermgr_stats(powermgr_mode_t mode, POWERMGR_STATS_t *stats);
+
+#endif /* MAIN_POWERMGR_H_ */
@@ -0,0 +1,172 @@
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+
+#include "link.h"
+#include "rpc.h"
+
+#define TAG "RPC"
+
+static const char * methodName[RPC_METHOD_MAX] = {
+	"ping", "counters", "battery", "config", "clock"
+};
+
+typedef struct {
+	bool used;
+	uint16_t id;
+	rpc_method_t method;
+	int64_t sentAt;
+	int64_t deadline;
+	rpc_done_t done;
+	void *ctx;
+} PENDING_t;
+
+static rpc_handler_t handlers[RPC_METHOD_MAX];
+static PENDING_t pending[RPC_MAX_PENDING];
+static uint16_t nextId;
+static HIST_t latency[RPC_METHOD_MAX];
+static portMUX_TYPE rpcMux = portMUX_INITIALIZER_UNLOCKED;
+
+void rpc_register(rpc_method_t method, rpc_handler_t handler)
+{
+	handlers[method] = handler;
+}
+
+int rpc_call(uint32_t handle, rpc_method_t method, const uint8_t *args, size_t length,
+	uint32_t timeoutMs, rpc_done_t done, void *ctx)
+{
+	if (length > RPC_MAX_ARGS) return -1;
+	int64_t now = esp_timer_get_time();
+	PENDING_t *call = NULL;
+	taskENTER_CRITICAL(&rpcMux);
+	for (int i=0;i<RPC_MAX_PENDING;i++) {
+		if (pending[i].used) continue;
+		call = &pending[i];
+		call->used = true;
+		call->id = nextId++;
+		call->method = method;
+		call->sentAt = now;
+		call->deadline = now + (int64_t)timeoutMs * 1000;
+		call->done = done;
+		call->ctx = ctx;
+		break;
+	}
+	taskEXIT_CRITICAL(&rpcMux);
+	if (call == NULL) return -1;
+
+	uint8_t request[3 + RPC_MAX_ARGS];
+	frame_put16(request, call->id);
+	request[2] = method;
+	if (length) memcpy(&request[3], args, length);
+	link_send(handle, FRAME_REQUEST, request, 3 + length);
+	return call->id;
+}
+
+static void rpc_answer(uint32_t handle, const uint8_t *payload, size_t length)
+{
+	static uint8_t response[3 + RPC_MAX_RESULT];
+	uint8_t method = payload[2];
+	int result = -1;
+	rpc_status_t status = RPC_UNKNOWN;
+	if (method < RPC_METHOD_MAX && handlers[method]) {
+		result = handlers[method](&payload[3], length - 3, &response[3], RPC_MAX_RESULT);
+		status = result < 0 ? RPC_FAILED : RPC_OK;
+	}
+	if (result < 0) result = 0;
+	memcpy(response, payload, 2);
+	response[2] = status;
+	link_send(handle, FRAME_RESPONSE, response, 3 + result);
+}
+
+static void rpc_log(rpc_method_t method, const HIST_t *hist)
+{
+	ESP_LOGI(TAG, "%-8s n=%"PRIu32" p50 %"PRIu32" p90 %"PRIu32" p99 %"PRIu32" max %"PRIu32" us",
+		methodName[method], hist->total, hist_percentile(hist, 50), hist_percentile(hist, 90),
+		hist_percentile(hist, 99), hist->max);
+}
+
+void rpc_receive(uint32_t handle, uint8_t type, const uint8_t *payload, size_t length)
+{
+	if (length < 3) return;
+	if (type == FRAME_REQUEST) {
+		rpc_answer(handle, payload, length);
+		return;
+	}
+	if (type != FRAME_RESPONSE) return;
+
+	uint16_t id = frame_get16(payload);
+	int64_t now = esp_timer_get_time();
+	PENDING_t call = {0};
+	HIST_t hist;
+	taskENTER_CRITICAL(&rpcMux);
+	for (int i=0;i<RPC_MAX_PENDING;i++) {
+		if (pending[i].used == false || pending[i].id != id) continue;
+		call = pending[i];
+		pending[i].used = false;
+		hist_add(&latency[call.method], now - call.sentAt);
+		hist = latency[call.method];
+		break;
+	}
+	taskEXIT_CRITICAL(&rpcMux);
+	// Late answer to a call that timed out
+	if (call.used == false) return;
+	if (call.done) call.done(call.ctx, call.method, payload[2], &payload[3], length - 3);
+	if (hist.total % RPC_REPORT == 0) rpc_log(call.method, &hist);
+}
+
+static void rpc_fail(rpc_status_t status, int64_t before)
+{
+	while (1) {
+		PENDING_t call = {0};
+		taskENTER_CRITICAL(&rpcMux);
+		for (int i=0;i<RPC_MAX_PENDING;i++) {
+			if (pending[i].used == false || pending[i].deadline > before) continue;
+			call = pending[i];
+			pending[i].used = false;
+			break;
+		}
+		taskEXIT_CRITICAL(&rpcMux);
+		if (call.used == false) return;
+		ESP_LOGW(TAG, "%s id %d %s", methodName[call.method], call.id, status == RPC_TIMEOUT ? "timed out" : "closed");
+		if (call.done) call.done(call.ctx, call.method, status, NULL, 0);
+	}
+}
+
+TickType_t rpc_poll(void)
+{
+	int64_t now = esp_timer_get_time();
+	rpc_fail(RPC_TIMEOUT, now);
+	int64_t next = INT64_MAX;
+	taskENTER_CRITICAL(&rpcMux);
+	for (int i=0;i<RPC_MAX_PENDING;i++) {
+		if (pending[i].used && pending[i].deadline < next) next = pending[i].deadline;
+	}
+	taskEXIT_CRITICAL(&rpcMux);
+	if (next == INT64_MAX) return portMAX_DELAY;
+	return pdMS_TO_TICKS((next - now) / 1000) + 1;
+}
+
+void rpc_close(void)
+{
+	rpc_fail(RPC_CLOSED, INT64_MAX);
+}
+
+void rpc_latency(rpc_method_t method, HIST_t *hist)
+{
+	taskENTER_CRITICAL(&rpcMux);
+	*hist = latency[method];
+	taskEXIT_CRITICAL(&rpcMux);
+}
+
+void rpc_report(void)
+{
+	for (int i=0;i<RPC_METHOD_MAX;i++) {
+		HIST_t hist;
+		rpc_latency(i, &hist);
+		if (hist.total) rpc_log(i, &hist);
+	}
+}
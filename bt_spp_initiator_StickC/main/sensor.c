@@ -0,0 +1,66 @@
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+
+#include "axp192.h"
+#include "sensor.h"
+
+#define TAG "SENSOR"
+
+// Sequence lock with a single writer. The sequence is odd while the
+// writer copies; readers retry when it was odd or changed under them.
+static uint32_t sequence = 0;
+static SENSOR_t published;
+
+static void sensor_publish(const SENSOR_t *s)
+{
+	uint32_t seq = __atomic_load_n(&sequence, __ATOMIC_RELAXED);
+	__atomic_store_n(&sequence, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(&published, s, sizeof(SENSOR_t));
+	__atomic_store_n(&sequence, seq + 2, __ATOMIC_RELEASE);
+}
+
+bool sensor_get(SENSOR_t *s)
+{
+	uint32_t before, after;
+	do {
+		before = __atomic_load_n(&sequence, __ATOMIC_ACQUIRE);
+		memcpy(s, &published, sizeof(SENSOR_t));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		after = __atomic_load_n(&sequence, __ATOMIC_RELAXED);
+	} while ((before & 1) || before != after);
+	return s->sample != 0;
+}
+
+void sensor_task(void *pvParameters)
+{
+	ESP_LOGI(pcTaskGetName(NULL), "Start");
+	SENSOR_t s;
+	memset(&s, 0, sizeof(s));
+	TickType_t lastWake = xTaskGetTickCount();
+	while(1) {
+		// Three transactions: status, ADC block and coulomb block
+		s.vbus = AXP192_IsVbusPresent();
+		if (AXP192_ReadAdc(&s.adc) == ESP_OK) {
+			s.coulomb = AXP192_GetCoulombData();
+			s.time = esp_timer_get_time();
+			s.sample++;
+			sensor_publish(&s);
+		}
+		if (s.sample % 60 == 0) {
+			AXP192_BUS_STATS_t stats;
+			AXP192_GetBusStats(&stats);
+			ESP_LOGI(TAG, "i2c transactions=%"PRIu32" bytes=%"PRIu32" cached reads=%"PRIu32" skipped writes=%"PRIu32,
+				stats.transactions, stats.bytes, stats.cachedReads, stats.skippedWrites);
+		}
+		vTaskDelayUntil(&lastWake, pdMS_TO_TICKS(SENSOR_PERIOD_MS));
+	}
+
+	// nerver reach
+	vTaskDelete(NULL);
+}
@@ -0,0 +1,96 @@
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include "nvs.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+
+#include "spiclock.h"
+
+#define TAG "SPICLOCK"
+#define SPICLOCK_NAMESPACE "spiclock"
+
+static uint32_t spiclock_time_fill(const SPICLOCK_PANEL_t *panel)
+{
+	int64_t start = esp_timer_get_time();
+	panel->fill(panel->dev);
+	return esp_timer_get_time() - start;
+}
+
+int spiclock_probe(const SPICLOCK_PANEL_t *panel, SPICLOCK_RESULT_t *results)
+{
+	int chosen = -1;
+	for (int i=0;i<SPICLOCK_MAX_CANDIDATES && panel->candidates[i];i++) {
+		SPICLOCK_RESULT_t *r = &results[i];
+		r->hz = panel->candidates[i];
+		r->fillUs = 0;
+		r->stable = false;
+		// The bus refuses clocks the pins can't carry
+		if (panel->set_clock(panel->dev, r->hz) == false) break;
+		r->fillUs = spiclock_time_fill(panel);
+		if (panel->verify) {
+			r->stable = true;
+			for (int j=0;j<SPICLOCK_VERIFY_ROUNDS;j++) {
+				if (panel->verify(panel->dev) == false) r->stable = false;
+			}
+		} else if (chosen < 0) {
+			r->stable = true;
+		} else {
+			// A clock that doesn't shorten the fill isn't really reaching the panel
+			uint32_t previous = results[chosen].fillUs;
+			r->stable = r->fillUs * 100 <= previous * (100 - SPICLOCK_MIN_GAIN);
+		}
+		ESP_LOGI(TAG, "%s %2d MHz fill %6"PRIu32" us %s", panel->name, r->hz / 1000000, r->fillUs,
+			r->stable ? "ok" : "unstable");
+		// Clocks above an unstable one aren't worth the risk
+		if (r->stable == false) break;
+		chosen = i;
+	}
+	if (chosen < 0) chosen = 0;
+	panel->set_clock(panel->dev, panel->candidates[chosen]);
+	return chosen;
+}
+
+int spiclock_calibrate(const SPICLOCK_PANEL_t *panel)
+{
+	nvs_handle_t handle;
+	uint32_t stored = 0;
+	esp_err_t ret = nvs_open(SPICLOCK_NAMESPACE, NVS_READONLY, &handle);
+	if (ret == ESP_OK) {
+		ret = nvs_get_u32(handle, panel->name, &stored);
+		nvs_close(handle);
+	}
+	if (ret == ESP_OK && stored && panel->set_clock(panel->dev, stored)) {
+		ESP_LOGI(TAG, "%s %"PRIu32" MHz from NVS", panel->name, stored / 1000000);
+		return stored;
+	}
+
+	SPICLOCK_RESULT_t results[SPICLOCK_MAX_CANDIDATES];
+	int chosen = spiclock_probe(panel, results);
+	int hz = panel->candidates[chosen];
+	if (results[0].fillUs && results[chosen].fillUs) {
+		ESP_LOGI(TAG, "%s %d MHz, fill rate x%"PRIu32".%02"PRIu32" of %d MHz", panel->name, hz / 1000000,
+			results[0].fillUs / results[chosen].fillUs, results[0].fillUs * 100 / results[chosen].fillUs % 100,
+			results[0].hz / 1000000);
+	}
+
+	ret = nvs_open(SPICLOCK_NAMESPACE, NVS_READWRITE, &handle);
+	if (ret != ESP_OK) {
+		ESP_LOGE(TAG, "nvs_open fail %s", esp_err_to_name(ret));
+		return hz;
+	}
+	ret = nvs_set_u32(handle, panel->name, hz);
+	if (ret == ESP_OK) ret = nvs_commit(handle);
+	nvs_close(handle);
+	if (ret != ESP_OK) ESP_LOGE(TAG, "nvs_set_u32 fail %s", esp_err_to_name(ret));
+	return hz;
+}
+
+void spiclock_forget(const char *name)
+{
+	nvs_handle_t handle;
+	if (nvs_open(SPICLOCK_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK) return;
+	nvs_erase_key(handle, name);
+	nvs_commit(handle);
+	nvs_close(handle);
+}
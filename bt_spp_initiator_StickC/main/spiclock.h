@@ -0,0 +1,40 @@
+#ifndef MAIN_SPICLOCK_H_
+#define MAIN_SPICLOCK_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SPICLOCK_MAX_CANDIDATES 6
+#define SPICLOCK_VERIFY_ROUNDS 3
+// Without readback a faster clock must cut the fill time by this many percent
+#define SPICLOCK_MIN_GAIN 10
+
+// A panel to calibrate. The callbacks get dev.
+typedef struct {
+	const char * name;			// NVS key, one per panel
+	void * dev;
+	int candidates[SPICLOCK_MAX_CANDIDATES];	// Hz, slowest first, 0 terminates
+	bool (*set_clock)(void *dev, int hz);
+	// Writes a test pattern at the current clock, reads it back and compares.
+	// NULL when the panel has no MISO line; the fill time decides then.
+	bool (*verify)(void *dev);
+	// One full screen fill
+	void (*fill)(void *dev);
+} SPICLOCK_PANEL_t;
+
+typedef struct {
+	int hz;
+	uint32_t fillUs;
+	bool stable;
+} SPICLOCK_RESULT_t;
+
+// Sets the clock stored in NVS for this panel, or probes the candidates,
+// sets the highest stable one and stores it. Returns the clock in use.
+int spiclock_calibrate(const SPICLOCK_PANEL_t *panel);
+// Probes without NVS. results needs SPICLOCK_MAX_CANDIDATES entries.
+// Returns the index of the chosen candidate, the panel is left at that clock.
+int spiclock_probe(const SPICLOCK_PANEL_t *panel, SPICLOCK_RESULT_t *results);
+// The next spiclock_calibrate probes again
+void spiclock_forget(const char *name);
+
+#endif /* MAIN_SPICLOCK_H_ */
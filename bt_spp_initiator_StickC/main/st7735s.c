@@ -23,6 +23,23 @@ static const int SPI_Frequency = SPI_MASTER_FREQ_20M;
 //static const int SPI_Frequency = SPI_MASTER_FREQ_80M;
 
 
+static esp_err_t spi_master_add_device(ST7735_t * dev, int clock_speed_hz)
+{
+	spi_device_interface_config_t devcfg={
+		.clock_speed_hz = clock_speed_hz,
+		.spics_io_num = dev->_cs,
+		.queue_size = 7,
+		.flags = SPI_DEVICE_NO_DUMMY,
+	};
+
+	spi_device_handle_t handle;
+	esp_err_t ret = spi_bus_add_device( HSPI_HOST, &devcfg, &handle);
+	if (ret != ESP_OK) return ret;
+	dev->_SPIHandle = handle;
+	dev->_clock = clock_speed_hz;
+	return ESP_OK;
+}
+
 void spi_master_init(ST7735_t * dev, int16_t GPIO_MOSI, int16_t GPIO_SCLK, int16_t GPIO_CS, int16_t GPIO_DC, int16_t GPIO_RESET)
 {
 	esp_err_t ret;
@@ -53,19 +70,24 @@ void spi_master_init(ST7735_t * dev, int16_t GPIO_MOSI, int16_t GPIO_SCLK, int16
 	ESP_LOGD(TAG, "spi_bus_initialize=%d",ret);
 	assert(ret==ESP_OK);
 
-	spi_device_interface_config_t devcfg={
-		.clock_speed_hz = SPI_Frequency,
-		.spics_io_num = GPIO_CS,
-		.queue_size = 7,
-		.flags = SPI_DEVICE_NO_DUMMY,
-	};
-
-	spi_device_handle_t handle;
-	ret = spi_bus_add_device( HSPI_HOST, &devcfg, &handle);
+	dev->_dc = GPIO_DC;
+	dev->_cs = GPIO_CS;
+	ret = spi_master_add_device(dev, SPI_Frequency);
 	ESP_LOGD(TAG, "spi_bus_add_device=%d",ret);
 	assert(ret==ESP_OK);
-	dev->_dc = GPIO_DC;
-	dev->_SPIHandle = handle;
+}
+
+// Replaces the SPI device with one clocked at clock_speed_hz.
+// Returns false and keeps the previous clock when the bus refuses it.
+bool spi_master_set_clock(ST7735_t * dev, int clock_speed_hz)
+{
+	int previous = dev->_clock;
+	esp_err_t ret = spi_bus_remove_device(dev->_SPIHandle);
+	assert(ret==ESP_OK);
+	if (spi_master_add_device(dev, clock_speed_hz) == ESP_OK) return true;
+	ret = spi_master_add_device(dev, previous);
+	assert(ret==ESP_OK);
+	return false;
 }
 
 
@@ -32,10 +32,13 @@ typedef struct {
 	uint16_t _font_underline;
 	uint16_t _font_underline_color;
 	int16_t _dc;
+	int16_t _cs;
+	int _clock;
 	spi_device_handle_t _SPIHandle;
 } ST7735_t;
 
 void spi_master_init(ST7735_t * dev, int16_t GPIO_MOSI, int16_t GPIO_SCLK, int16_t GPIO_CS, int16_t GPIO_DC, int16_t GPIO_RESET);
+bool spi_master_set_clock(ST7735_t * dev, int clock_speed_hz);
 bool spi_master_write_byte(spi_device_handle_t SPIHandle, const uint8_t* Data, size_t DataLength);
 bool spi_master_write_command(ST7735_t * dev, uint8_t cmd);
 bool spi_master_write_data_byte(ST7735_t * dev, uint8_t data);
@@ -0,0 +1,190 @@
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/timers.h"
+#include "esp_system.h"
+#include "esp_log.h"
+
+#include "telemetry.h"
+#include "msgpool.h"
+
+#define TAG "TELEMETRY"
+
+// Counters are bumped from the Bluetooth callbacks, the timer and the application tasks.
+static portMUX_TYPE telemetryMux = portMUX_INITIALIZER_UNLOCKED;
+static TELEMETRY_t counter;
+static TELEMETRY_t snapshot;
+
+static QueueHandle_t xQueueTelemetry = NULL;
+static StaticTimer_t timerBuffer;
+
+#if CONFIG_FREERTOS_USE_TRACE_FACILITY && CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+#define MAX_TASKS 24
+static TaskStatus_t taskStatus[MAX_TASKS];
+static struct {
+	TaskHandle_t handle;
+	uint32_t runTime;
+} previous[MAX_TASKS];
+static int previousNum = 0;
+static uint32_t previousTotal = 0;
+
+// CPU share of every task since the previous call, busiest first
+static int telemetry_cpu(TASK_CPU_t *task, int maxTasks)
+{
+	uint32_t totalRunTime;
+	int taskNum = uxTaskGetSystemState(taskStatus, MAX_TASKS, &totalRunTime);
+	uint32_t totalDelta = totalRunTime - previousTotal;
+	int num = 0;
+	for (int i=0;i<taskNum;i++) {
+		uint32_t runTime = taskStatus[i].ulRunTimeCounter;
+		for (int j=0;j<previousNum;j++) {
+			if (previous[j].handle == taskStatus[i].xHandle) {
+				runTime = runTime - previous[j].runTime;
+				break;
+			}
+		}
+		uint8_t cpu = 0;
+		if (totalDelta > 0) cpu = ((uint64_t)runTime * 100) / totalDelta;
+		// insert sorted by cpu, drop the least busy
+		int pos = num;
+		while (pos > 0 && task[pos-1].cpu < cpu) {
+			if (pos < maxTasks) task[pos] = task[pos-1];
+			pos--;
+		}
+		if (pos < maxTasks) {
+			strlcpy(task[pos].name, taskStatus[i].pcTaskName, configMAX_TASK_NAME_LEN);
+			task[pos].cpu = cpu;
+			if (num < maxTasks) num++;
+		}
+	}
+	for (int i=0;i<taskNum;i++) {
+		previous[i].handle = taskStatus[i].xHandle;
+		previous[i].runTime = taskStatus[i].ulRunTimeCounter;
+	}
+	previousNum = taskNum;
+	previousTotal = totalRunTime;
+	return num;
+}
+#else
+static int telemetry_cpu(TASK_CPU_t *task, int maxTasks)
+{
+	// Needs CONFIG_FREERTOS_USE_TRACE_FACILITY and CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+	return 0;
+}
+#endif
+
+static void telemetry_timer_cb(TimerHandle_t arg)
+{
+	TELEMETRY_t t;
+	taskENTER_CRITICAL(&telemetryMux);
+	t = counter;
+	taskEXIT_CRITICAL(&telemetryMux);
+	t.freeHeap = esp_get_free_heap_size();
+	t.minimumHeap = esp_get_minimum_free_heap_size();
+	t.taskNum = telemetry_cpu(t.task, TELEMETRY_TASKS);
+
+	taskENTER_CRITICAL(&telemetryMux);
+	snapshot = t;
+	taskEXIT_CRITICAL(&telemetryMux);
+
+	char cpu[TELEMETRY_TASKS * (configMAX_TASK_NAME_LEN + 6) + 1];
+	int len = 0;
+	cpu[0] = 0;
+	for (int i=0;i<t.taskNum;i++) {
+		len += snprintf(&cpu[len], sizeof(cpu)-len, " %s:%d", t.task[i].name, t.task[i].cpu);
+	}
+	ESP_LOGI(TAG, "rx=%"PRIu32"/%"PRIu32" tx=%"PRIu32"/%"PRIu32" cong=%"PRIu32" q=%d/%d drop=%"PRIu32" heap=%"PRIu32"/%"PRIu32"%s",
+		t.rxBytes, t.rxMessages, t.txBytes, t.txMessages, t.congestion,
+		t.queueHighWater, t.queueLength, t.dropTotal, t.freeHeap, t.minimumHeap, cpu);
+
+	if (xQueueTelemetry != NULL) {
+		telemetry_send(xQueueTelemetry, msgpool_alloc(CMD_TELEMETRY, 0), 0);
+	}
+}
+
+void telemetry_init(QueueHandle_t queue, TickType_t period)
+{
+	xQueueTelemetry = queue;
+	counter.queueLength = uxQueueMessagesWaiting(queue) + uxQueueSpacesAvailable(queue);
+	TimerHandle_t timer = xTimerCreateStatic("telemetry", period, true, NULL, telemetry_timer_cb, &timerBuffer);
+	xTimerStart(timer, 0);
+}
+
+BaseType_t telemetry_send(QueueHandle_t queue, CMD_t *cmd, TickType_t ticks)
+{
+	uint16_t command = CMD_MAX;
+	BaseType_t ret = pdFALSE;
+	if (cmd != NULL) {
+		command = cmd->command;
+		ret = xQueueSend(queue, &cmd, ticks);
+		if (ret != pdTRUE) msgpool_free(cmd);
+	}
+	UBaseType_t waiting = uxQueueMessagesWaiting(queue);
+	taskENTER_CRITICAL(&telemetryMux);
+	if (ret != pdTRUE) {
+		if (command < CMD_MAX) counter.drops[command]++;
+		counter.dropTotal++;
+	}
+	if (queue == xQueueTelemetry && waiting > counter.queueHighWater) counter.queueHighWater = waiting;
+	taskEXIT_CRITICAL(&telemetryMux);
+	return ret;
+}
+
+void telemetry_rx(size_t bytes)
+{
+	taskENTER_CRITICAL(&telemetryMux);
+	counter.rxBytes += bytes;
+	counter.rxMessages++;
+	taskEXIT_CRITICAL(&telemetryMux);
+}
+
+void telemetry_tx(size_t bytes)
+{
+	taskENTER_CRITICAL(&telemetryMux);
+	counter.txBytes += bytes;
+	counter.txMessages++;
+	taskEXIT_CRITICAL(&telemetryMux);
+}
+
+void telemetry_congestion(void)
+{
+	taskENTER_CRITICAL(&telemetryMux);
+	counter.congestion++;
+	taskEXIT_CRITICAL(&telemetryMux);
+}
+
+uint32_t telemetry_messages(void)
+{
+	taskENTER_CRITICAL(&telemetryMux);
+	uint32_t messages = counter.rxMessages + counter.txMessages;
+	taskEXIT_CRITICAL(&telemetryMux);
+	return messages;
+}
+
+void telemetry_get(TELEMETRY_t *t)
+{
+	taskENTER_CRITICAL(&telemetryMux);
+	*t = snapshot;
+	taskEXIT_CRITICAL(&telemetryMux);
+}
+
+int telemetry_format(const TELEMETRY_t *t, char lines[][TELEMETRY_LINE], int maxLines)
+{
+	int num = 0;
+#define LINE(...) if (num < maxLines) snprintf(lines[num++], TELEMETRY_LINE, __VA_ARGS__)
+	LINE("rx %"PRIu32"/%"PRIu32, t->rxBytes, t->rxMessages);
+	LINE("tx %"PRIu32"/%"PRIu32, t->txBytes, t->txMessages);
+	LINE("cong %"PRIu32, t->congestion);
+	LINE("queue %d/%d", t->queueHighWater, t->queueLength);
+	LINE("drop %"PRIu32, t->dropTotal);
+	LINE("heap %"PRIu32"K", t->freeHeap / 1024);
+	LINE("min %"PRIu32"K", t->minimumHeap / 1024);
+	for (int i=0;i<t->taskNum;i++) {
+		LINE("%.10s %d%%", t->task[i].name, t->task[i].cpu);
+	}
+#undef LINE
+	return num;
+}
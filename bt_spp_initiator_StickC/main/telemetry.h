@@ -0,0 +1,48 @@
+#ifndef MAIN_TELEMETRY_H_
+#define MAIN_TELEMETRY_H_
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "cmd.h"
+
+#define TELEMETRY_TASKS 8 // busiest tasks kept in a snapshot
+#define TELEMETRY_LINE 17 // 16 characters per stats page line
+
+typedef struct {
+	char name[configMAX_TASK_NAME_LEN];
+	uint8_t cpu; // percent of one core since the previous snapshot
+} TASK_CPU_t;
+
+typedef struct {
+	uint32_t rxBytes;
+	uint32_t rxMessages;
+	uint32_t txBytes;
+	uint32_t txMessages;
+	uint32_t congestion;
+	uint32_t drops[CMD_MAX];
+	uint32_t dropTotal;
+	UBaseType_t queueHighWater;
+	UBaseType_t queueLength;
+	uint32_t freeHeap;
+	uint32_t minimumHeap;
+	int taskNum;
+	TASK_CPU_t task[TELEMETRY_TASKS];
+} TELEMETRY_t;
+
+// Samples every period, logs one compact record and posts CMD_TELEMETRY to queue.
+void telemetry_init(QueueHandle_t queue, TickType_t period);
+// Posts a pool message and counts drops per command and the queue high-water mark.
+// A message the queue refuses goes back to the pool. A NULL cmd (pool exhausted) counts as a drop.
+BaseType_t telemetry_send(QueueHandle_t queue, CMD_t *cmd, TickType_t ticks);
+void telemetry_rx(size_t bytes);
+void telemetry_tx(size_t bytes);
+void telemetry_congestion(void);
+// Messages received and sent so far, counted live rather than from the snapshot
+uint32_t telemetry_messages(void);
+// Last snapshot taken by the timer
+void telemetry_get(TELEMETRY_t *t);
+// Formats a snapshot into lines of TELEMETRY_LINE bytes. Returns the number of lines.
+int telemetry_format(const TELEMETRY_t *t, char lines[][TELEMETRY_LINE], int maxLines);
+
+#endif /* MAIN_TELEMETRY_H_ */
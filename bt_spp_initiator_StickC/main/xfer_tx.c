@@ -0,0 +1,241 @@
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+
+#include "memplan.h"
+#include "link.h"
+#include "mux.h"
+#include "xfer.h"
+
+#define TAG "XFER"
+
+typedef enum {
+	SEND_DONE,		// delivered, or failed for good
+	SEND_RETRY,		// the link dropped or the receiver stopped, offer it again
+} send_result_t;
+
+// The BTC task fills these in and wakes the sender task
+static volatile uint32_t sppHandle;	// 0 while the link is down
+static volatile uint32_t acked;		// bytes the receiver has on flash
+static volatile uint8_t reply;		// last ACCEPT, REFUSE or RESULT
+static volatile uint32_t replyValue;
+static portMUX_TYPE txMux = portMUX_INITIALIZER_UNLOCKED;
+
+static TaskHandle_t senderTask;
+static QueueHandle_t xQueuePath;
+static uint8_t block[XFER_BLOCK];
+static uint8_t chunk[4 + XFER_CHUNK];
+
+static void xfer_wake(void)
+{
+	if (senderTask) xTaskNotifyGive(senderTask);
+}
+
+void xfer_tx_open(uint32_t handle)
+{
+	sppHandle = handle;
+	xfer_wake();
+}
+
+void xfer_tx_close(void)
+{
+	taskENTER_CRITICAL(&txMux);
+	sppHandle = 0;
+	taskEXIT_CRITICAL(&txMux);
+	xfer_wake();
+}
+
+void xfer_write_done(void)
+{
+	xfer_wake();
+}
+
+void xfer_tx_receive(uint32_t handle, uint8_t type, const uint8_t *payload, size_t length)
+{
+	if (type != FRAME_FILE || length < 2) return;
+	uint32_t value = length >= 5 ? frame_get32(&payload[1]) : payload[1];
+	taskENTER_CRITICAL(&txMux);
+	if (payload[0] == XFER_PROGRESS) {
+		if (value > acked) acked = value;
+	} else {
+		reply = payload[0];
+		replyValue = value;
+	}
+	taskEXIT_CRITICAL(&txMux);
+	xfer_wake();
+}
+
+// Sleeps until the BTC task has news or the deadline passes.
+// false once the deadline is over.
+static bool xfer_wait(int64_t deadline)
+{
+	int64_t left = deadline - esp_timer_get_time();
+	if (left <= 0) return false;
+	ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(left / 1000) + 1);
+	return true;
+}
+
+// Waits for the answer to OFFER or for RESULT
+static uint8_t xfer_reply(uint32_t handle, uint32_t *value)
+{
+	int64_t deadline = esp_timer_get_time() + XFER_TIMEOUT_MS * 1000LL;
+	while (1) {
+		taskENTER_CRITICAL(&txMux);
+		uint8_t op = reply;
+		*value = replyValue;
+		reply = 0;
+		taskEXIT_CRITICAL(&txMux);
+		if (op) return op;
+		if (sppHandle != handle) return 0;
+		if (xfer_wait(deadline) == false) return 0;
+	}
+}
+
+// The receiver stopped while chunks were going out
+static send_result_t xfer_stopped(const char *name, uint32_t sent)
+{
+	taskENTER_CRITICAL(&txMux);
+	uint8_t op = reply;
+	uint32_t status = replyValue;
+	reply = 0;
+	taskEXIT_CRITICAL(&txMux);
+	if (op == XFER_RESULT && status == XFER_AGAIN) {
+		ESP_LOGW(TAG, "%s stopped by the receiver at %"PRIu32", offering it again", name, sent);
+		return SEND_RETRY;
+	}
+	ESP_LOGE(TAG, "%s failed at %"PRIu32" (%d %"PRIu32")", name, sent, op, status);
+	return SEND_DONE;
+}
+
+static send_result_t xfer_file(const char *path, FILE *fp, uint32_t size, uint32_t crc)
+{
+	uint32_t handle = sppHandle;
+	if (handle == 0) return SEND_RETRY;
+
+	const char *name = strrchr(path, '/');
+	name = name ? name + 1 : path;
+	uint8_t offer[9 + XFER_NAME];
+	size_t nameLength = strnlen(name, XFER_NAME - 1);
+	offer[0] = XFER_OFFER;
+	frame_put32(&offer[1], size);
+	frame_put32(&offer[5], crc);
+	memcpy(&offer[9], name, nameLength);
+	reply = 0;
+	link_send(handle, FRAME_FILE, offer, 9 + nameLength);
+
+	uint32_t offset;
+	uint8_t op = xfer_reply(handle, &offset);
+	if (op == 0) return sppHandle == handle ? SEND_DONE : SEND_RETRY;
+	if (op != XFER_ACCEPT || offset > size) {
+		ESP_LOGE(TAG, "%s refused (%"PRIu32")", name, offset);
+		return SEND_DONE;
+	}
+	if (offset) ESP_LOGI(TAG, "%s resumes at %"PRIu32" of %"PRIu32, name, offset, size);
+	acked = offset;
+
+	int64_t start = esp_timer_get_time();
+	int64_t report = start;
+	uint32_t sent = offset;
+	fseek(fp, offset, SEEK_SET);
+	while (sent < size) {
+		// The next block is read while the previous one is still on the air
+		size_t blockLength = size - sent < XFER_BLOCK ? size - sent : XFER_BLOCK;
+		if (fread(block, 1, blockLength, fp) != blockLength) {
+			ESP_LOGE(TAG, "%s read error at %"PRIu32, name, sent);
+			return SEND_DONE;
+		}
+		for (size_t pos=0;pos<blockLength;) {
+			size_t chunkLength = blockLength - pos < XFER_CHUNK ? blockLength - pos : XFER_CHUNK;
+			// Room in the BULK channel and in the receiver's window
+			int64_t deadline = esp_timer_get_time() + XFER_TIMEOUT_MS * 1000LL;
+			while (mux_room(MUX_BULK) < FRAME_HEADER + 4 + chunkLength || sent + chunkLength > acked + XFER_WINDOW) {
+				if (sppHandle != handle) return SEND_RETRY;
+				if (reply) return xfer_stopped(name, sent);
+				if (xfer_wait(deadline) == false) {
+					ESP_LOGE(TAG, "%s stalled at %"PRIu32, name, sent);
+					return SEND_DONE;
+				}
+			}
+			frame_put32(chunk, sent);
+			memcpy(&chunk[4], &block[pos], chunkLength);
+			link_send(handle, FRAME_CHUNK, chunk, 4 + chunkLength);
+			pos += chunkLength;
+			sent += chunkLength;
+		}
+
+		int64_t now = esp_timer_get_time();
+		if (now - report >= 1000*1000) {
+			report = now;
+			ESP_LOGI(TAG, "%s %"PRIu32"/%"PRIu32" %"PRId64" KB/s", name, sent, size,
+				(int64_t)(sent - offset) * 1000 / 1024 / ((now - start) / 1000 + 1));
+		}
+	}
+
+	uint32_t status;
+	op = xfer_reply(handle, &status);
+	if (op == 0) return sppHandle == handle ? SEND_DONE : SEND_RETRY;
+	if (op == XFER_RESULT && status == XFER_AGAIN) return SEND_RETRY;
+	int64_t elapsed = esp_timer_get_time() - start;
+	ESP_LOGI(TAG, "%s %"PRIu32" bytes in %"PRId64" ms, %"PRId64" KB/s, %s", name, size - offset, elapsed / 1000,
+		(int64_t)(size - offset) * 1000 / 1024 / (elapsed / 1000 + 1), status == XFER_OK ? "ok" : "failed");
+	return SEND_DONE;
+}
+
+static void xfer_task(void *pvParameters)
+{
+	XFER_PATH_t path;
+	while (1) {
+		xQueueReceive(xQueuePath, path, portMAX_DELAY);
+		FILE *fp = fopen(path, "rb");
+		if (fp == NULL) {
+			ESP_LOGE(TAG, "can't open %s", path);
+			continue;
+		}
+		// The checksum covers the whole file, also when it is resumed
+		uint32_t size = 0;
+		uint32_t crc = 0;
+		size_t length;
+		while ((length = fread(block, 1, XFER_BLOCK, fp)) > 0) {
+			crc = xfer_crc32(crc, block, length);
+			size += length;
+		}
+		ESP_LOGI(TAG, "%s %"PRIu32" bytes crc %08"PRIx32, path, size, crc);
+
+		int again = 0;
+		while (xfer_file(path, fp, size, crc) == SEND_RETRY) {
+			// Stopped by the receiver with the link up, a drop starts the count over
+			if (sppHandle == 0) {
+				again = 0;
+			} else if (++again > XFER_RETRIES) {
+				ESP_LOGE(TAG, "%s stopped %d times, given up", path, again - 1);
+				break;
+			}
+			// Sleep until the next connect
+			while (sppHandle == 0) ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+		}
+		fclose(fp);
+	}
+
+	// nerver reach
+	while (1) {
+		vTaskDelay(2000 / portTICK_PERIOD_MS);
+	}
+}
+
+void xfer_tx_init(void)
+{
+	xQueuePath = memplan_queue_create(MEMPLAN_QUEUE_XFER);
+	senderTask = memplan_task_create(MEMPLAN_TASK_XFER, xfer_task, NULL);
+}
+
+bool xfer_send(const char *path)
+{
+	XFER_PATH_t item = {0};
+	strncpy(item, path, XFER_PATH - 1);
+	return xQueueSend(xQueuePath, item, 0) == pdTRUE;
+}
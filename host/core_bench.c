@@ -0,0 +1,231 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_timer.h"
+
+#include "fontx.h"
+#include "ili9340.h"
+#include "frame.h"
+#include "link.h"
+#include "mux.h"
+#include "coalesce.h"
+#include "spi_sim.h"
+
+// Host timings of the hardware independent core, to compare one change
+// against the next on the same machine, not to expect on the ESP32.
+// Every case runs a fixed amount of work BENCH_REPEAT times and keeps
+// the fastest run, which leaves out most of the noise of a busy host.
+// The glyph case also prints the SPI bus time the simulator estimates
+// for the ESP32, which doesn't depend on the host at all.
+#define BENCH_REPEAT 7
+#define MTU 990
+
+// M5Stack acceptor wiring, as in panel_ili9340.c
+#define SCREEN_WIDTH 320
+#define SCREEN_HEIGHT 240
+#define DC_GPIO 27
+
+typedef void (*bench_fn_t)(void);
+
+static double secondsOf(bench_fn_t fn)
+{
+	double best = 0;
+	for (int r=0;r<BENCH_REPEAT;r++) {
+		struct timespec start, end;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		fn();
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		double s = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+		if (r == 0 || s < best) best = s;
+	}
+	return best;
+}
+
+static void report(const char *name, double units, const char *unit, double bytes, double seconds)
+{
+	printf("%-14s %12.0f %-9s", name, units / seconds, unit);
+	if (bytes) printf(" %8.1f MB/s", bytes / seconds / 1e6);
+	printf("\n");
+}
+
+static volatile uint32_t sink;
+
+// Glyphs: file lookup, bitmap expansion, and the whole driver path
+#define GLYPHS 20000
+static FontxFile fx[2];
+static TFT_t dev;
+
+static void benchGetFontx(void)
+{
+	uint8_t glyph[FontxGlyphBufSize];
+	uint8_t pw, ph;
+	for (int i=0;i<GLYPHS;i++) {
+		GetFontx(fx, 0x20 + i % 0x5F, glyph, &pw, &ph);
+		sink += glyph[i % 16];
+	}
+}
+
+static void benchFont2Bitmap(void)
+{
+	uint8_t glyph[FontxGlyphBufSize];
+	uint8_t line[32*4];
+	uint8_t pw, ph;
+	GetFontx(fx, 'W', glyph, &pw, &ph);
+	for (int i=0;i<GLYPHS;i++) {
+		glyph[0] = i;
+		Font2Bitmap(glyph, line, pw, ph, 0);
+		sink += line[i % 8];
+	}
+}
+
+#define STRINGS 500
+static uint8_t text[] = "M5StickC+:12345 4.012V -52mA 38.5C 1234s";
+
+static void benchDrawString(void)
+{
+	for (int i=0;i<STRINGS;i++) {
+		int y = 16 + (i % (SCREEN_HEIGHT / 16 - 1)) * 16 - 1;
+		sink += lcdDrawString(&dev, fx, 0, y, text, WHITE);
+	}
+}
+
+// Framing and the link layer
+#define FRAMES 20000
+#define MESSAGE 24
+static uint8_t stream[FRAMES * (FRAME_HEADER + MESSAGE)];
+static size_t streamLength;
+
+static void countFrame(void *ctx, uint8_t type, const uint8_t *payload, size_t length)
+{
+	sink += length;
+}
+
+static void benchParse(void)
+{
+	FRAME_PARSER_t parser;
+	frame_parser_reset(&parser);
+	// SPP hands the stream over in pieces that don't respect frames
+	for (size_t pos=0;pos<streamLength;pos+=MTU) {
+		size_t n = streamLength - pos < MTU ? streamLength - pos : MTU;
+		frame_parse(&parser, &stream[pos], n, countFrame, NULL);
+	}
+}
+
+static uint8_t loop[2 * (FRAME_HEADER + FRAME_MAX_PAYLOAD)];
+static size_t loopLength;
+
+static bool loopWrite(uint32_t handle, const uint8_t *data, size_t length)
+{
+	memcpy(&loop[loopLength], data, length);
+	loopLength += length;
+	return true;
+}
+
+static void loopData(uint32_t handle, uint8_t type, const uint8_t *payload, size_t length)
+{
+	sink += length;
+}
+
+static char messages[64][MESSAGE + 16];
+
+static void benchLink(void)
+{
+	for (int i=0;i<FRAMES;i++) {
+		const char *m = messages[i % 64];
+		link_send(1, FRAME_DATA, (const uint8_t *)m, strlen(m));
+		link_receive(1, loop, loopLength);
+		loopLength = 0;
+	}
+}
+
+// The queues in front of esp_spp_write
+static uint32_t wireWrites;
+static size_t wireBytes;
+static size_t unreturned;
+
+static bool wireWrite(uint32_t handle, const uint8_t *data, size_t length)
+{
+	wireWrites++;
+	wireBytes += length;
+	unreturned += length;
+	return true;
+}
+
+// The stack takes every write at once
+static void wireDone(void)
+{
+	size_t n = unreturned;
+	unreturned = 0;
+	if (n) mux_write_done(n);
+}
+
+static void benchMux(void)
+{
+	uint8_t frame[FRAME_HEADER + MESSAGE];
+	frame_header(frame, FRAME_DATA, MESSAGE);
+	memset(&frame[FRAME_HEADER], 'x', MESSAGE);
+	uint8_t ack[FRAME_HEADER + 6] = {0};
+	frame_header(ack, FRAME_ACK, 6);
+	for (int i=0;i<FRAMES;i++) {
+		mux_write(1, frame, sizeof(frame));
+		if (i % 8 == 7) mux_write(1, ack, sizeof(ack));
+		wireDone();
+	}
+	sim_advance_us(COALESCE_DELAY_MS * 1000);
+	sim_run_timers();
+	wireDone();
+}
+
+int main(int argc, char **argv)
+{
+	printf("%-14s %12s %-9s %13s\n", "case", "rate", "", "bytes");
+
+	InitFontx(fx, FONT_DIR "/ILGH16XB.FNT", "");
+	report("GetFontx", GLYPHS, "glyphs/s", 0, secondsOf(benchGetFontx));
+	report("Font2Bitmap", GLYPHS, "glyphs/s", 0, secondsOf(benchFont2Bitmap));
+
+	sim_init(SIM_MIPI, DC_GPIO, SCREEN_WIDTH, SCREEN_HEIGHT, SCREEN_WIDTH, SCREEN_HEIGHT, 0, 0);
+	spi_master_init(&dev, 23, 18, 14, DC_GPIO, 33, 32, 19, -1, -1);
+	lcdInit(&dev, 0x9341, SCREEN_WIDTH, SCREEN_HEIGHT, 0, 0);
+	size_t glyphs = STRINGS * strlen((char *)text);
+	sim_begin("lcdDrawString");
+	double seconds = secondsOf(benchDrawString);
+	sim_end();
+	report("lcdDrawString", glyphs, "glyphs/s", 0, seconds);
+	const SIM_STAT_t *bus = sim_stat("lcdDrawString");
+	printf("%-14s %12.0f %-9s %8.1f bytes/glyph\n", "  ESP32 bus", glyphs * BENCH_REPEAT / (bus->us / 1e6), "glyphs/s",
+		(double)bus->bytes / (glyphs * BENCH_REPEAT));
+	sim_free();
+
+	for (int i=0;i<FRAMES;i++) {
+		uint8_t payload[MESSAGE];
+		for (int j=0;j<MESSAGE;j++) payload[j] = i + j;
+		frame_header(&stream[streamLength], FRAME_DATA, MESSAGE);
+		memcpy(&stream[streamLength + FRAME_HEADER], payload, MESSAGE);
+		streamLength += FRAME_HEADER + MESSAGE;
+	}
+	report("frame_parse", FRAMES, "frames/s", streamLength, secondsOf(benchParse));
+
+	for (int i=0;i<64;i++) snprintf(messages[i], sizeof(messages[i]), "M5StickC+:%d 4.0%02dV %ds", i, i, i * 2);
+	link_init(LINK_CAP_LZ, loopWrite, loopData);
+	link_open(1);
+	link_receive(1, loop, loopLength);
+	loopLength = 0;
+	double plain = 0;
+	for (int i=0;i<FRAMES;i++) plain += strlen(messages[i % 64]);
+	report("link LZ", FRAMES, "frames/s", plain, secondsOf(benchLink));
+
+	coalesce_init(wireWrite, MTU);
+	mux_init(coalesce_write);
+	seconds = secondsOf(benchMux);
+	double frames = FRAMES + FRAMES / 8;
+	report("mux+coalesce", frames, "frames/s", (double)wireBytes / BENCH_REPEAT, seconds);
+	printf("%-14s %12.1f bytes/write, %.1f frames/write\n", "", (double)wireBytes / wireWrites,
+		frames * BENCH_REPEAT / wireWrites);
+
+	SIM_CHECK(sink != 0);
+	SIM_CHECK(wireBytes == (size_t)BENCH_REPEAT * (FRAMES * (FRAME_HEADER + MESSAGE) + FRAMES / 8 * (FRAME_HEADER + 6)));
+	printf("%s\n", sim_failures ? "FAILED" : "PASSED");
+	return sim_failures ? 1 : 0;
+}
@@ -0,0 +1,473 @@
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_timer.h"
+
+#include "fontx.h"
+#include "frame.h"
+#include "link.h"
+#include "msgpool.h"
+#include "mux.h"
+#include "coalesce.h"
+#include "spi_sim.h"
+
+// Unit tests of the hardware independent core of the acceptor:
+// font parsing and bitmap expansion, framing, the link layer and the
+// queues between the tasks and the SPP stack.
+#define MTU 990
+
+static void testFontx(void)
+{
+	FontxFile fx[2];
+	InitFontx(fx, FONT_DIR "/ILGH16XB.FNT", "");
+	SIM_CHECK(OpenFontx(&fx[0]));
+	SIM_CHECK(fx[0].is_ank && fx[0].w == 8 && fx[0].h == 16 && fx[0].fsz == 16);
+
+	uint8_t glyph[FontxGlyphBufSize];
+	uint8_t pw, ph;
+	SIM_CHECK(GetFontx(fx, ' ', glyph, &pw, &ph));
+	SIM_CHECK(pw == 8 && ph == 16);
+	int lit = 0;
+	for (int i=0;i<16;i++) lit += glyph[i] != 0;
+	SIM_CHECK(lit == 0);
+
+	// Every pixel of every glyph lands on its bit of the column bitmap
+	for (int ascii=0;ascii<256;ascii++) {
+		uint8_t line[32*4];
+		SIM_CHECK(GetFontx(fx, ascii, glyph, &pw, &ph));
+		Font2Bitmap(glyph, line, pw, ph, 0);
+		int wrong = 0;
+		for (int y=0;y<ph;y++) {
+			for (int x=0;x<pw;x++) {
+				bool font = glyph[y * ((pw + 7) / 8) + x / 8] & (0x80 >> (x % 8));
+				bool bitmap = line[(y / 8) * 32 + x] & (0x80 >> (y % 8));
+				if (font != bitmap) wrong++;
+			}
+		}
+		SIM_CHECK(wrong == 0);
+	}
+	GetFontx(fx, 'A', glyph, &pw, &ph);
+	uint8_t line[32*4];
+	uint8_t inverse[32*4];
+	Font2Bitmap(glyph, line, pw, ph, 0);
+	Font2Bitmap(glyph, inverse, pw, ph, 1);
+	for (int x=0;x<pw;x++) SIM_CHECK(inverse[x] == RotateByte(line[x]));
+	// The underline goes into the last band only
+	uint8_t before[32*4];
+	memcpy(before, line, sizeof(line));
+	UnderlineBitmap(line, pw, ph);
+	for (int x=0;x<pw;x++) {
+		SIM_CHECK(line[x] == before[x]);
+		SIM_CHECK(line[32 + x] == (uint8_t)(before[32 + x] + 0x80));
+	}
+
+	for (int i=0;i<256;i++) SIM_CHECK(RotateByte(RotateByte(i)) == i);
+	SIM_CHECK(RotateByte(0x01) == 0x80 && RotateByte(0x0F) == 0xF0);
+	CloseFontx(&fx[0]);
+
+	// A missing file is no font
+	InitFontx(fx, FONT_DIR "/NONE.FNT", "");
+	SIM_CHECK(GetFontx(fx, 'A', glyph, &pw, &ph) == false);
+}
+
+typedef struct {
+	int frames;
+	uint8_t type[64];
+	size_t length[64];
+	uint32_t sum;
+} PARSED_t;
+
+static void parsedFrame(void *ctx, uint8_t type, const uint8_t *payload, size_t length)
+{
+	PARSED_t *p = ctx;
+	if (p->frames < 64) {
+		p->type[p->frames] = type;
+		p->length[p->frames] = length;
+	}
+	p->frames++;
+	for (size_t i=0;i<length;i++) p->sum = p->sum * 31 + payload[i];
+}
+
+static size_t makeFrame(uint8_t *dst, uint8_t type, size_t length, uint8_t seed)
+{
+	frame_header(dst, type, length);
+	for (size_t i=0;i<length;i++) dst[FRAME_HEADER + i] = seed + i * 7;
+	return FRAME_HEADER + length;
+}
+
+static void testFrame(void)
+{
+	static uint8_t stream[4 * (FRAME_HEADER + FRAME_MAX_PAYLOAD)];
+	size_t lengths[] = {0, 1, 20, FRAME_MAX_PAYLOAD};
+	size_t total = 0;
+	for (int i=0;i<4;i++) total += makeFrame(&stream[total], FRAME_DATA, lengths[i], i);
+
+	// In one piece
+	PARSED_t whole = {0};
+	FRAME_PARSER_t parser;
+	frame_parser_reset(&parser);
+	frame_parse(&parser, stream, total, parsedFrame, &whole);
+	SIM_CHECK(whole.frames == 4 && parser.skipped == 0);
+	for (int i=0;i<4;i++) SIM_CHECK(whole.type[i] == FRAME_DATA && whole.length[i] == lengths[i]);
+
+	// Cut at every offset, the same frames come out
+	for (size_t cut=1;cut<total;cut+=13) {
+		PARSED_t split = {0};
+		frame_parser_reset(&parser);
+		frame_parse(&parser, stream, cut, parsedFrame, &split);
+		frame_parse(&parser, &stream[cut], total - cut, parsedFrame, &split);
+		SIM_CHECK(split.frames == 4 && split.sum == whole.sum);
+	}
+	// Byte by byte
+	PARSED_t bytes = {0};
+	frame_parser_reset(&parser);
+	for (size_t i=0;i<total;i++) frame_parse(&parser, &stream[i], 1, parsedFrame, &bytes);
+	SIM_CHECK(bytes.frames == 4 && bytes.sum == whole.sum);
+
+	// Noise, and a magic byte with an impossible length, are skipped
+	uint8_t noisy[64];
+	size_t n = 0;
+	noisy[n++] = 'x';
+	noisy[n++] = FRAME_MAGIC;
+	noisy[n++] = FRAME_DATA;
+	noisy[n++] = 0xFF;
+	noisy[n++] = 0xFF;
+	n += makeFrame(&noisy[n], FRAME_ACK, 6, 0);
+	PARSED_t noise = {0};
+	frame_parser_reset(&parser);
+	frame_parse(&parser, noisy, n, parsedFrame, &noise);
+	SIM_CHECK(noise.frames == 1 && noise.type[0] == FRAME_ACK && noise.length[0] == 6);
+	SIM_CHECK(parser.skipped == 5);
+}
+
+// The link talks to itself: what it writes is fed back to it
+static uint8_t loop[8192];
+static size_t loopLength;
+static PARSED_t delivered;
+
+static bool loopWrite(uint32_t handle, const uint8_t *data, size_t length)
+{
+	SIM_CHECK(loopLength + length <= sizeof(loop));
+	if (loopLength + length > sizeof(loop)) return false;
+	memcpy(&loop[loopLength], data, length);
+	loopLength += length;
+	return true;
+}
+
+static void loopData(uint32_t handle, uint8_t type, const uint8_t *payload, size_t length)
+{
+	parsedFrame(&delivered, type, payload, length);
+}
+
+// The link may answer while it receives, that goes into the next round
+static void loopDeliver(void)
+{
+	static uint8_t received[sizeof(loop)];
+	size_t length = loopLength;
+	memcpy(received, loop, length);
+	loopLength = 0;
+	link_receive(1, received, length);
+}
+
+static void testLink(void)
+{
+	link_init(LINK_CAP_LZ, loopWrite, loopData);
+	link_open(1);
+	loopDeliver();
+	SIM_CHECK(link_framed() && link_caps() == LINK_CAP_LZ);
+
+	// Repeating messages go compressed and come back as sent
+	char message[64];
+	PARSED_t sent = {0};
+	for (int i=0;i<50;i++) {
+		int length = snprintf(message, sizeof(message), "M5StickC+:%d 4.012V -52mA 38.5C %ds", i, i * 2);
+		link_send(1, FRAME_DATA, (const uint8_t *)message, length);
+		parsedFrame(&sent, FRAME_DATA, (const uint8_t *)message, length);
+		loopDeliver();
+	}
+	SIM_CHECK(delivered.frames == 50 && delivered.sum == sent.sum);
+	LINK_STATS_t stats;
+	link_stats(&stats);
+	SIM_CHECK(stats.frames == 100 && stats.lzFrames >= 95 && stats.errors == 0);
+	SIM_CHECK(stats.wireBytes * 2 < stats.plainBytes);
+
+	// Other frames pass through untouched
+	uint8_t ack[6] = {1, 2, 3, 4, 5, 6};
+	link_send(1, FRAME_ACK, ack, sizeof(ack));
+	loopDeliver();
+	SIM_CHECK(delivered.frames == 51 && delivered.type[50] == FRAME_ACK && delivered.length[50] == 6);
+
+	// A garbled compressed frame: the link starts over with HELLO and
+	// the messages after it come through, compressed again
+	int length = snprintf(message, sizeof(message), "M5StickC+:%d 4.012V -52mA 38.5C %ds", 50, 100);
+	link_send(1, FRAME_DATA, (const uint8_t *)message, length);
+	SIM_CHECK(loop[1] == (FRAME_DATA | FRAME_LZ));
+	uint8_t garbled[] = {0xFF, 0x00};	// a match without its length
+	frame_header(loop, FRAME_DATA | FRAME_LZ, sizeof(garbled));
+	memcpy(&loop[FRAME_HEADER], garbled, sizeof(garbled));
+	loopLength = FRAME_HEADER + sizeof(garbled);
+	loopDeliver();
+	link_stats(&stats);
+	SIM_CHECK(stats.errors == 1 && delivered.frames == 51);
+	SIM_CHECK(link_caps() == 0 && loopLength && loop[1] == FRAME_HELLO);
+	loopDeliver();
+	SIM_CHECK(link_caps() == LINK_CAP_LZ);
+	PARSED_t after = {0};
+	delivered = after;
+	for (int i=51;i<70;i++) {
+		length = snprintf(message, sizeof(message), "M5StickC+:%d 4.012V -52mA 38.5C %ds", i, i * 2);
+		link_send(1, FRAME_DATA, (const uint8_t *)message, length);
+		parsedFrame(&after, FRAME_DATA, (const uint8_t *)message, length);
+		loopDeliver();
+	}
+	SIM_CHECK(delivered.frames == 19 && delivered.sum == after.sum);
+	LINK_STATS_t resumed;
+	link_stats(&resumed);
+	SIM_CHECK(resumed.errors == 1 && resumed.lzFrames - stats.lzFrames >= 2 * 19 - 2);
+	link_close();
+}
+
+static void testMsgpool(void)
+{
+	msgpool_init();
+	// The smallest slab that fits
+	CMD_t *event = msgpool_alloc(CMD_OPEN, 0);
+	CMD_t *line = msgpool_alloc(CMD_SEND, 10);
+	SIM_CHECK(event && line && event->size == 0 && line->size >= 10 && line->payload);
+	SIM_CHECK(event->command == CMD_OPEN && line->length == 0);
+	SIM_CHECK(msgpool_alloc(CMD_SEND, 4096) == NULL);
+	msgpool_free(line);
+	msgpool_free(event);
+
+	// Exhausted, then whole again after every message comes back
+	CMD_t *all[256];
+	int count = 0;
+	while (count < 256 && (all[count] = msgpool_alloc(CMD_SEND, 1)) != NULL) count++;
+	SIM_CHECK(count > 0 && count < 256);
+	SIM_CHECK(msgpool_alloc(CMD_SEND, 1) == NULL);
+	msgpool_free(all[0]);
+	SIM_CHECK(msgpool_alloc(CMD_SEND, 1) == all[0]);
+	for (int i=0;i<count;i++) msgpool_free(all[i]);
+	msgpool_free(NULL);
+	int again = 0;
+	while (again < 256 && (all[again] = msgpool_alloc(CMD_SEND, 1)) != NULL) again++;
+	SIM_CHECK(again == count);
+	for (int i=0;i<again;i++) msgpool_free(all[i]);
+}
+
+// What reaches esp_spp_write through mux.c and coalesce.c
+static uint8_t wire[16384];
+static size_t wireLength;
+static size_t writeSize[256];
+static int writes;
+static int returned;
+
+static bool wireWrite(uint32_t handle, const uint8_t *data, size_t length)
+{
+	SIM_CHECK(length <= MTU && wireLength + length <= sizeof(wire) && writes < 256);
+	if (wireLength + length > sizeof(wire) || writes == 256) return false;
+	memcpy(&wire[wireLength], data, length);
+	wireLength += length;
+	writeSize[writes++] = length;
+	return true;
+}
+
+// ESP_SPP_WRITE_EVT for every write so far
+static void wireDone(void)
+{
+	while (returned < writes) mux_write_done(writeSize[returned++]);
+}
+
+static void wireReset(void)
+{
+	mux_close();
+	coalesce_close();
+	wireLength = 0;
+	writes = 0;
+	returned = 0;
+}
+
+static PARSED_t wireFrames(void)
+{
+	PARSED_t p = {0};
+	FRAME_PARSER_t parser;
+	frame_parser_reset(&parser);
+	frame_parse(&parser, wire, wireLength, parsedFrame, &p);
+	SIM_CHECK(parser.skipped == 0);
+	return p;
+}
+
+static void sendFrame(uint8_t type, size_t length, uint8_t seed)
+{
+	uint8_t frame[FRAME_HEADER + FRAME_MAX_PAYLOAD];
+	mux_write(1, frame, makeFrame(frame, type, length, seed));
+}
+
+static void testCoalesce(void)
+{
+	wireReset();
+	// Small messages wait for the timer, then go in one write
+	for (int i=0;i<10;i++) sendFrame(FRAME_DATA, 20, i);
+	SIM_CHECK(writes == 0);
+	sim_advance_us(COALESCE_DELAY_MS * 1000 - 1000);
+	sim_run_timers();
+	SIM_CHECK(writes == 0);
+	sim_advance_us(1000);
+	SIM_CHECK(sim_run_timers() == 1);
+	SIM_CHECK(writes == 1 && writeSize[0] == 10 * 24);
+	wireDone();
+
+	// An ACK takes everything before it along at once
+	wireReset();
+	for (int i=0;i<10;i++) sendFrame(FRAME_DATA, 20, i);
+	sendFrame(FRAME_ACK, 6, 0);
+	SIM_CHECK(writes == 1 && writeSize[0] == 10 * 24 + 10);
+	PARSED_t p = wireFrames();
+	SIM_CHECK(p.frames == 11 && p.type[10] == FRAME_ACK);
+	wireDone();
+
+	// Writes are cut at the MTU, frames straddle them
+	wireReset();
+	for (int i=0;i<45;i++) sendFrame(FRAME_DATA, 20, i);
+	SIM_CHECK(writes == 1 && writeSize[0] == MTU);
+	sim_advance_us(COALESCE_DELAY_MS * 1000);
+	sim_run_timers();
+	SIM_CHECK(writes == 2 && writeSize[1] == 45 * 24 - MTU);
+	p = wireFrames();
+	SIM_CHECK(p.frames == 45);
+	wireDone();
+
+	COALESCE_STATS_t stats;
+	coalesce_stats(&stats);
+	SIM_CHECK(stats.writes == 4 && stats.full == 1 && stats.urgent == 1 && stats.timer == 2);
+}
+
+static void testMux(void)
+{
+	// A file transfer fills its credit, the rest waits in its queue
+	wireReset();
+	for (int i=0;i<4;i++) sendFrame(FRAME_CHUNK, 4 + 976, i);
+	SIM_CHECK(wireLength + MTU >= 2 * 984 && wireLength <= 2 * 984);
+	SIM_CHECK(mux_room(MUX_BULK) < 984);
+
+	// A call overtakes the queued chunks
+	sendFrame(FRAME_REQUEST, 12, 0);
+	PARSED_t p = wireFrames();
+	SIM_CHECK(p.frames == 3 && p.type[2] == FRAME_REQUEST);
+
+	// Returned credit lets the chunks go, in their order
+	for (int i=0;i<8 && returned < writes;i++) {
+		wireDone();
+		sim_advance_us(COALESCE_DELAY_MS * 1000);
+		sim_run_timers();
+	}
+	p = wireFrames();
+	SIM_CHECK(p.frames == 5);
+	int chunks = 0;
+	for (int i=0;i<p.frames;i++) {
+		if (p.type[i] != FRAME_CHUNK) continue;
+		SIM_CHECK(p.length[i] == 980);
+		chunks++;
+	}
+	SIM_CHECK(chunks == 4);
+
+	// Control frames are never held back by bulk
+	MUX_STATS_t stats[MUX_CHANNEL_MAX];
+	mux_stats(stats);
+	SIM_CHECK(stats[MUX_CONTROL].queued == 0 && stats[MUX_BULK].queued == 2);
+	SIM_CHECK(stats[MUX_BULK].drops == 0);
+
+	// A full queue drops, and says so
+	wireReset();
+	for (int i=0;i<5;i++) sendFrame(FRAME_CHUNK, 4 + 976, i);
+	mux_stats(stats);
+	SIM_CHECK(stats[MUX_BULK].drops == 1);
+	wireReset();
+}
+
+// The link over mux.c with no credit coming back, as in a long stall
+static size_t stalled;
+
+static bool stallWrite(uint32_t handle, const uint8_t *data, size_t length)
+{
+	stalled += length;
+	return loopWrite(handle, data, length);
+}
+
+// Messages that differ in length, so a missing one shifts the history
+static int stallMessage(char *message, size_t size, int i)
+{
+	return snprintf(message, size, "M5StickC+:%d %.*s4.012V -52mA 38.5C %ds", i, i % 7, "======", i * 2);
+}
+
+static void testLinkStall(void)
+{
+	mux_close();
+	mux_init(stallWrite);
+	link_init(LINK_CAP_LZ, mux_write, loopData);
+	link_open(1);
+	loopDeliver();
+	SIM_CHECK(link_caps() == LINK_CAP_LZ);
+	LINK_STATS_t before;
+	link_stats(&before);
+
+	// TELEMETRY fills its credit and its queue, then drops a frame
+	MUX_STATS_t stats[MUX_CHANNEL_MAX];
+	mux_stats(stats);
+	uint32_t drops = stats[MUX_TELEMETRY].drops;
+	PARSED_t sent = {0};
+	PARSED_t kept = {0};
+	delivered = sent;
+	char message[64];
+	int i = 0;
+	while (stats[MUX_TELEMETRY].drops == drops && i < 2000) {
+		kept = sent;
+		int length = stallMessage(message, sizeof(message), i);
+		link_send(1, FRAME_DATA, (const uint8_t *)message, length);
+		parsedFrame(&sent, FRAME_DATA, (const uint8_t *)message, length);
+		loopDeliver();
+		mux_stats(stats);
+		i++;
+	}
+	SIM_CHECK(stats[MUX_TELEMETRY].drops == drops + 1 && stats[MUX_TELEMETRY].queued > 0);
+
+	// The credit comes back and the queue drains, all but the dropped one
+	mux_write_done(stalled);
+	stalled = 0;
+	loopDeliver();
+	SIM_CHECK(delivered.frames == i - 1 && delivered.sum == kept.sum);
+
+	// The peer never saw the dropped frame, what follows decodes anyway
+	PARSED_t after = {0};
+	delivered = after;
+	for (int j=0;j<20;j++,i++) {
+		int length = stallMessage(message, sizeof(message), i);
+		link_send(1, FRAME_DATA, (const uint8_t *)message, length);
+		parsedFrame(&after, FRAME_DATA, (const uint8_t *)message, length);
+		mux_write_done(stalled);
+		stalled = 0;
+		loopDeliver();
+	}
+	SIM_CHECK(delivered.frames == 20 && delivered.sum == after.sum);
+	LINK_STATS_t link;
+	link_stats(&link);
+	// No corrupt frame, and all but the first after each HELLO went compressed
+	SIM_CHECK(link.errors == before.errors && link.lzFrames - before.lzFrames >= 2 * i - 8);
+	link_close();
+	mux_close();
+}
+
+int main(int argc, char **argv)
+{
+	testFontx();
+	testFrame();
+	testLink();
+	testMsgpool();
+	coalesce_init(wireWrite, MTU);
+	mux_init(coalesce_write);
+	testCoalesce();
+	testMux();
+	testLinkStall();
+	printf("%s\n", sim_failures ? "FAILED" : "PASSED");
+	return sim_failures ? 1 : 0;
+}
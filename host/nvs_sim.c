@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "nvs.h"
+
+#define NVS_SIM_NAMESPACES 4
+#define NVS_SIM_ENTRIES 16
+#define NVS_SIM_KEY 16	// NVS keys are at most 15 characters
+
+typedef struct {
+	nvs_handle_t handle;
+	char key[NVS_SIM_KEY];
+	uint32_t value;
+} NVS_ENTRY_t;
+
+static char namespaces[NVS_SIM_NAMESPACES][NVS_SIM_KEY];
+static NVS_ENTRY_t entries[NVS_SIM_ENTRIES];
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle)
+{
+	if (strlen(name) >= NVS_SIM_KEY) return ESP_ERR_NVS_KEY_TOO_LONG;
+	for (int i=0;i<NVS_SIM_NAMESPACES;i++) {
+		if (strcmp(namespaces[i], name) == 0) {
+			*out_handle = i + 1;
+			return ESP_OK;
+		}
+	}
+	// Like the real NVS, a namespace only comes to exist when opened for writing
+	if (open_mode == NVS_READONLY) return ESP_ERR_NVS_NOT_FOUND;
+	for (int i=0;i<NVS_SIM_NAMESPACES;i++) {
+		if (namespaces[i][0] == 0) {
+			strcpy(namespaces[i], name);
+			*out_handle = i + 1;
+			return ESP_OK;
+		}
+	}
+	return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+	return ESP_OK;
+}
+
+static NVS_ENTRY_t *nvs_find(nvs_handle_t handle, const char *key)
+{
+	for (int i=0;i<NVS_SIM_ENTRIES;i++) {
+		if (entries[i].handle == handle && strcmp(entries[i].key, key) == 0) return &entries[i];
+	}
+	return NULL;
+}
+
+esp_err_t nvs_get_u32(nvs_handle_t handle, const char *key, uint32_t *out_value)
+{
+	NVS_ENTRY_t *entry = nvs_find(handle, key);
+	if (entry == NULL) return ESP_ERR_NVS_NOT_FOUND;
+	*out_value = entry->value;
+	return ESP_OK;
+}
+
+esp_err_t nvs_set_u32(nvs_handle_t handle, const char *key, uint32_t value)
+{
+	if (strlen(key) >= NVS_SIM_KEY) return ESP_ERR_NVS_KEY_TOO_LONG;
+	NVS_ENTRY_t *entry = nvs_find(handle, key);
+	if (entry == NULL) entry = nvs_find(0, "");
+	if (entry == NULL) return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+	entry->handle = handle;
+	strcpy(entry->key, key);
+	entry->value = value;
+	return ESP_OK;
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key)
+{
+	NVS_ENTRY_t *entry = nvs_find(handle, key);
+	if (entry == NULL) return ESP_ERR_NVS_NOT_FOUND;
+	memset(entry, 0, sizeof(*entry));
+	return ESP_OK;
+}
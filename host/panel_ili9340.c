@@ -0,0 +1,160 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "ili9340.h"
+#include "spiclock.h"
+#include "spi_sim.h"
+
+// M5Stack acceptor wiring
+#define SCREEN_WIDTH 320
+#define SCREEN_HEIGHT 240
+#define MOSI_GPIO 23
+#define SCLK_GPIO 18
+#define TFT_CS_GPIO 14
+#define DC_GPIO 27
+#define RESET_GPIO 33
+#define BL_GPIO 32
+#define MISO_GPIO 19
+
+#define GOLDEN_HASH 0xbc5a7790
+
+static int count_color(int x1, int y1, int x2, int y2, uint16_t color)
+{
+	int count = 0;
+	for (int y=y1;y<=y2;y++) {
+		for (int x=x1;x<=x2;x++) {
+			if (sim_pixel(x, y) == color) count++;
+		}
+	}
+	return count;
+}
+
+// Same calibration glue as the acceptor
+static bool panelSetClock(void *dev, int hz)
+{
+	return spi_master_set_clock(dev, hz);
+}
+
+static void panelFill(void *dev)
+{
+	lcdFillScreen(dev, BLACK);
+}
+
+static bool panelVerify(void *dev)
+{
+	// A new pattern every round, so a write that never lands can't pass
+	static uint16_t seed = 0x5AA5;
+	uint16_t pattern[TFT_READ_MAX];
+	uint16_t readback[TFT_READ_MAX];
+	seed = seed * 75 + 74;
+	for (int i=0;i<TFT_READ_MAX;i++) pattern[i] = (i & 1) ? seed : ~seed;
+	lcdDrawMultiPixels(dev, 0, 0, TFT_READ_MAX, pattern);
+	if (lcdReadPixels(dev, 0, 0, TFT_READ_MAX, readback) == false) return false;
+	return memcmp(pattern, readback, sizeof(pattern)) == 0;
+}
+
+int main(int argc, char **argv)
+{
+	TFT_t dev;
+	sim_init(SIM_MIPI, DC_GPIO, SCREEN_WIDTH, SCREEN_HEIGHT, SCREEN_WIDTH, SCREEN_HEIGHT, 0, 0);
+
+	sim_begin("lcdInit");
+	spi_master_init(&dev, MOSI_GPIO, SCLK_GPIO, TFT_CS_GPIO, DC_GPIO, RESET_GPIO, BL_GPIO, MISO_GPIO, -1, -1);
+	lcdInit(&dev, 0x9341, SCREEN_WIDTH, SCREEN_HEIGHT, 0, 0);
+	sim_end();
+
+	sim_begin("lcdFillScreen");
+	lcdFillScreen(&dev, BLACK);
+	sim_end();
+	SIM_CHECK(count_color(0, 0, SCREEN_WIDTH-1, SCREEN_HEIGHT-1, BLACK) == SCREEN_WIDTH*SCREEN_HEIGHT);
+	SIM_CHECK(sim_stat("lcdFillScreen")->bytes >= SCREEN_WIDTH*SCREEN_HEIGHT*2);
+
+	// One pixel costs three commands and three data phases
+	sim_begin("lcdDrawPixel");
+	lcdDrawPixel(&dev, 10, 10, RED);
+	sim_end();
+	SIM_CHECK(sim_pixel(10, 10) == RED);
+	SIM_CHECK(sim_pixel(11, 10) == BLACK);
+	SIM_CHECK(sim_stat("lcdDrawPixel")->transactions == 6);
+	SIM_CHECK(sim_stat("lcdDrawPixel")->bytes == 13);
+
+	sim_begin("lcdDrawFillRect");
+	lcdDrawFillRect(&dev, 20, 20, 59, 39, GREEN);
+	sim_end();
+	SIM_CHECK(count_color(20, 20, 59, 39, GREEN) == 40*20);
+	SIM_CHECK(sim_pixel(19, 20) == BLACK);
+	SIM_CHECK(sim_pixel(60, 39) == BLACK);
+	SIM_CHECK(sim_pixel(20, 40) == BLACK);
+
+	sim_begin("lcdDrawLine");
+	lcdDrawLine(&dev, 100, 100, 199, 100, WHITE);
+	sim_end();
+	SIM_CHECK(count_color(100, 100, 199, 100, WHITE) == 100);
+
+	FontxFile fx[2];
+	InitFontx(fx, FONT_DIR "/ILGH24XB.FNT", "");
+	uint8_t ascii[] = "SPP";
+	sim_begin("lcdDrawString");
+	lcdDrawString(&dev, fx, 0, 70, ascii, YELLOW);
+	sim_end();
+	SIM_CHECK(count_color(0, 47, 3*12-1, 70, YELLOW) > 0);
+	SIM_CHECK(count_color(3*12, 47, 100, 70, YELLOW) == 0);
+
+	// Same scroll layout as the acceptor: fixed status line, scrolling body.
+	// Displayed row tfa+k shows GRAM row ((vsp-tfa+k) mod vsa)+tfa.
+	lcdDrawFillRect(&dev, 0, 0, SCREEN_WIDTH-1, 23, CYAN);
+	lcdDrawFillRect(&dev, 0, 216, SCREEN_WIDTH-1, 239, RED);
+	sim_begin("lcdScroll");
+	lcdSetScrollArea(&dev, 24, SCREEN_HEIGHT-24, 0);
+	lcdScroll(&dev, 216);
+	sim_end();
+	SIM_CHECK(count_color(0, 0, SCREEN_WIDTH-1, 23, CYAN) == SCREEN_WIDTH*24);
+	SIM_CHECK(count_color(0, 24, SCREEN_WIDTH-1, 47, RED) == SCREEN_WIDTH*24);
+	SIM_CHECK(sim_pixel(15, 58) == sim_gram(15, 34));
+	lcdScroll(&dev, 24);
+	SIM_CHECK(count_color(0, 216, SCREEN_WIDTH-1, 239, RED) == SCREEN_WIDTH*24);
+
+	uint32_t hash = sim_hash();
+	printf("framebuffer hash 0x%08x\n", hash);
+	SIM_CHECK(hash == GOLDEN_HASH);
+
+	// Memory Read returns what was drawn
+	uint16_t colors[3];
+	sim_begin("lcdReadPixels");
+	SIM_CHECK(lcdReadPixels(&dev, 19, 30, 3, colors));
+	sim_end();
+	SIM_CHECK(colors[0] == BLACK && colors[1] == GREEN && colors[2] == GREEN);
+
+	// The simulated panel garbles writes above 40MHz, readback has to notice
+	SPICLOCK_PANEL_t panel = {
+		.name = "ili9341",
+		.dev = &dev,
+		.candidates = {SPI_MASTER_FREQ_20M, SPI_MASTER_FREQ_26M, SPI_MASTER_FREQ_40M, SPI_MASTER_FREQ_80M},
+		.set_clock = panelSetClock,
+		.verify = panelVerify,
+		.fill = panelFill,
+	};
+	sim_set_max_clock(SPI_MASTER_FREQ_40M);
+	SIM_CHECK(spiclock_calibrate(&panel) == SPI_MASTER_FREQ_40M);
+	SIM_CHECK(sim_panel_clock() == SPI_MASTER_FREQ_40M);
+
+	// The second boot takes the clock from NVS without touching the bus
+	spi_master_set_clock(&dev, SPI_MASTER_FREQ_20M);
+	sim_begin("spiclock_calibrate");
+	SIM_CHECK(spiclock_calibrate(&panel) == SPI_MASTER_FREQ_40M);
+	sim_end();
+	SIM_CHECK(sim_stat("spiclock_calibrate")->transactions == 0);
+	SIM_CHECK(sim_panel_clock() == SPI_MASTER_FREQ_40M);
+
+	// Without readback every step that shortens the fill is taken
+	spiclock_forget(panel.name);
+	panel.verify = NULL;
+	sim_set_max_clock(0);
+	SIM_CHECK(spiclock_calibrate(&panel) == SPI_MASTER_FREQ_80M);
+
+	sim_report(stdout);
+	if (argc > 1) sim_dump_ppm(argv[1]);
+	sim_free();
+	printf("%d failure(s)\n", sim_failures);
+	return sim_failures ? 1 : 0;
+}
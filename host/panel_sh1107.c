@@ -0,0 +1,84 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "sh1107.h"
+#include "font8x8_basic.h"
+#include "spi_sim.h"
+
+// M5Stick wiring is fixed inside sh1107.c
+#define GRAM_WIDTH 128
+#define GRAM_HEIGHT 128
+#define SCREEN_WIDTH 64
+#define SCREEN_HEIGHT 128
+#define GPIO_DC 27
+
+#define GOLDEN_HASH 0x5f755561
+
+static int count_on(int x1, int y1, int x2, int y2)
+{
+	int count = 0;
+	for (int y=y1;y<=y2;y++) {
+		for (int x=x1;x<=x2;x++) {
+			if (sim_pixel(x, y)) count++;
+		}
+	}
+	return count;
+}
+
+int main(int argc, char **argv)
+{
+	SH1107_t dev;
+	memset(&dev, 0, sizeof(dev));
+	sim_init(SIM_SH1107, GPIO_DC, GRAM_WIDTH, GRAM_HEIGHT, SCREEN_WIDTH, SCREEN_HEIGHT, 0, 0);
+
+	sim_begin("spi_init");
+	spi_master_init(&dev);
+	spi_init(&dev, SCREEN_WIDTH, SCREEN_HEIGHT);
+	sim_end();
+
+	sim_begin("clear_screen");
+	clear_screen(&dev, false);
+	sim_end();
+	SIM_CHECK(count_on(0, 0, SCREEN_WIDTH-1, SCREEN_HEIGHT-1) == 0);
+
+	// Each glyph is 8 segments, one byte holds 8 vertical pixels
+	char text[] = "SPP";
+	sim_begin("display_text");
+	display_text(&dev, 2, text, 3, false);
+	sim_end();
+	for (int i=0;i<3;i++) {
+		for (int seg=0;seg<8;seg++) {
+			uint8_t bits = font8x8_basic_tr[(uint8_t)text[i]][seg];
+			for (int bit=0;bit<8;bit++) {
+				SIM_CHECK((sim_pixel(i*8+seg, 2*8+bit) != 0) == ((bits >> bit) & 1));
+			}
+		}
+	}
+	SIM_CHECK(sim_stat("display_text")->transactions == 3*4);
+
+	sim_begin("display_text");
+	display_text(&dev, 4, text, 3, true);
+	sim_end();
+	SIM_CHECK(count_on(24, 4*8, SCREEN_WIDTH-1, 4*8+7) == 0);
+	SIM_CHECK(count_on(0, 4*8, 23, 4*8+7) + count_on(0, 2*8, 23, 2*8+7) == 24*8);
+
+	sim_begin("software_scroll");
+	software_scroll(&dev, 6, 15);
+	for (int line=0;line<12;line++) {
+		char buf[9];
+		snprintf(buf, sizeof(buf), "%d", line);
+		scroll_text(&dev, buf, strlen(buf), false);
+	}
+	sim_end();
+	SIM_CHECK(count_on(0, 15*8, 7, 15*8+7) > 0);
+
+	uint32_t hash = sim_hash();
+	printf("framebuffer hash 0x%08x\n", hash);
+	SIM_CHECK(hash == GOLDEN_HASH);
+
+	sim_report(stdout);
+	if (argc > 1) sim_dump_ppm(argv[1]);
+	sim_free();
+	printf("%d failure(s)\n", sim_failures);
+	return sim_failures ? 1 : 0;
+}
@@ -0,0 +1,91 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "st7789.h"
+#include "spi_sim.h"
+
+// M5StickC Plus wiring
+#define GRAM_WIDTH 240
+#define GRAM_HEIGHT 320
+#define SCREEN_WIDTH 135
+#define SCREEN_HEIGHT 240
+#define OFFSET_X 52
+#define OFFSET_Y 40
+#define GPIO_MOSI 15
+#define GPIO_SCLK 13
+#define GPIO_CS 5
+#define GPIO_DC 23
+#define GPIO_RESET 18
+#define GPIO_BL -1
+
+#define GOLDEN_HASH 0x9333f302
+
+static int count_color(int x1, int y1, int x2, int y2, uint16_t color)
+{
+	int count = 0;
+	for (int y=y1;y<=y2;y++) {
+		for (int x=x1;x<=x2;x++) {
+			if (sim_pixel(x, y) == color) count++;
+		}
+	}
+	return count;
+}
+
+int main(int argc, char **argv)
+{
+	TFT_t dev;
+	sim_init(SIM_MIPI, GPIO_DC, GRAM_WIDTH, GRAM_HEIGHT, SCREEN_WIDTH, SCREEN_HEIGHT, OFFSET_X, OFFSET_Y);
+
+	sim_begin("lcdInit");
+	spi_master_init(&dev, GPIO_MOSI, GPIO_SCLK, GPIO_CS, GPIO_DC, GPIO_RESET, GPIO_BL);
+	lcdInit(&dev, SCREEN_WIDTH, SCREEN_HEIGHT, OFFSET_X, OFFSET_Y);
+	sim_end();
+
+	// The panel window sits at (52,40) inside the GRAM
+	sim_begin("lcdFillScreen");
+	lcdFillScreen(&dev, WHITE);
+	sim_end();
+	SIM_CHECK(count_color(0, 0, SCREEN_WIDTH-1, SCREEN_HEIGHT-1, WHITE) == SCREEN_WIDTH*SCREEN_HEIGHT);
+	SIM_CHECK(sim_gram(OFFSET_X-1, OFFSET_Y) == 0);
+	SIM_CHECK(sim_gram(OFFSET_X, OFFSET_Y-1) == 0);
+	SIM_CHECK(sim_gram(OFFSET_X+SCREEN_WIDTH, OFFSET_Y) == 0);
+	SIM_CHECK(sim_gram(OFFSET_X, OFFSET_Y+SCREEN_HEIGHT) == 0);
+	lcdFillScreen(&dev, BLACK);
+
+	sim_begin("lcdDrawPixel");
+	lcdDrawPixel(&dev, 0, 0, RED);
+	sim_end();
+	SIM_CHECK(sim_pixel(0, 0) == RED);
+	SIM_CHECK(sim_gram(OFFSET_X, OFFSET_Y) == RED);
+
+	sim_begin("lcdDrawFillRect");
+	lcdDrawFillRect(&dev, 10, 20, 29, 29, GREEN);
+	sim_end();
+	SIM_CHECK(count_color(10, 20, 29, 29, GREEN) == 20*10);
+	SIM_CHECK(sim_pixel(9, 20) == BLACK);
+	SIM_CHECK(sim_pixel(30, 29) == BLACK);
+
+	sim_begin("lcdDrawLine");
+	lcdDrawLine(&dev, 0, 100, SCREEN_WIDTH-1, 100, BLUE);
+	sim_end();
+	SIM_CHECK(count_color(0, 100, SCREEN_WIDTH-1, 100, BLUE) == SCREEN_WIDTH);
+
+	FontxFile fx[2];
+	InitFontx(fx, FONT_DIR "/ILGH16XB.FNT", "");
+	uint8_t ascii[] = "SPP";
+	sim_begin("lcdDrawString");
+	lcdDrawString(&dev, fx, 0, 15, ascii, YELLOW);
+	sim_end();
+	SIM_CHECK(count_color(0, 0, 3*8-1, 15, YELLOW) > 0);
+	SIM_CHECK(count_color(3*8, 0, SCREEN_WIDTH-1, 15, YELLOW) == 0);
+
+	uint32_t hash = sim_hash();
+	printf("framebuffer hash 0x%08x\n", hash);
+	SIM_CHECK(hash == GOLDEN_HASH);
+
+	sim_report(stdout);
+	if (argc > 1) sim_dump_ppm(argv[1]);
+	sim_free();
+	printf("%d failure(s)\n", sim_failures);
+	return sim_failures ? 1 : 0;
+}
@@ -0,0 +1,219 @@
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+
+#include "record.h"
+#include "lz.h"
+#include "spi_sim.h"
+
+// Binary records against the text the initiators used to send.
+// Sizes are per message, raw and after the LZ history the link keeps.
+// Times are host nanoseconds per message, to compare, not to expect on
+// the ESP32.
+#define BENCH_MESSAGES 1000
+#define BENCH_ROUNDS 200
+
+typedef struct {
+	uint32_t counter;
+	int32_t batVoltage;		// mV
+	int32_t batCurrent;		// mA
+	int32_t temperature;	// 0.1 degC
+	int64_t time;			// us
+} SAMPLE_t;
+
+static SAMPLE_t samples[BENCH_MESSAGES];
+static uint8_t wire[BENCH_MESSAGES][RECORD_MAX];
+static size_t wireLength[BENCH_MESSAGES];
+
+// A battery slowly running down, one message every 2 seconds
+static void makeSamples(void)
+{
+	uint32_t seed = 1;
+	for (int i=0;i<BENCH_MESSAGES;i++) {
+		seed = seed * 1103515245 + 12345;
+		samples[i].counter = i;
+		samples[i].batVoltage = 4100 - i / 10 + (seed >> 16) % 5;
+		samples[i].batCurrent = -48 - (int32_t)((seed >> 20) % 9);
+		samples[i].temperature = 380 + (seed >> 24) % 12;
+		samples[i].time = 1500000 + (int64_t)i * 2000000;
+	}
+}
+
+static size_t encodeText(const SAMPLE_t *s, char *dst, size_t size)
+{
+	return snprintf(dst, size, "M5StickC+:%"PRIu32" %"PRId32".%03"PRId32"V %"PRId32"mA %"PRId32".%"PRId32"C %"PRId64"s",
+		s->counter, s->batVoltage / 1000, s->batVoltage % 1000, s->batCurrent,
+		s->temperature / 10, s->temperature % 10, s->time / 1000000);
+}
+
+static size_t encodeRecord(const SAMPLE_t *s, uint8_t *dst)
+{
+	RECORD_t rec = {0};
+	RECORD_SET(&rec, device, RECORD_STICKC_PLUS);
+	RECORD_SET(&rec, counter, s->counter);
+	RECORD_SET(&rec, batVoltage, s->batVoltage);
+	RECORD_SET(&rec, batCurrent, s->batCurrent);
+	RECORD_SET(&rec, temperature, s->temperature);
+	RECORD_SET(&rec, time, s->time);
+	return record_encode(&rec, dst);
+}
+
+static double nsSince(const struct timespec *start)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1e9 + (now.tv_nsec - start->tv_nsec);
+}
+
+// Bytes on the link with LZ, messages in order through one history
+static double lzBytes(const uint8_t *messages, size_t stride, const size_t *lengths)
+{
+	static LZ_t lz;
+	lz_reset(&lz);
+	size_t total = 0;
+	for (int i=0;i<BENCH_MESSAGES;i++) {
+		uint8_t packed[LZ_BOUND(64)];
+		size_t packedLength = lz_compress(&lz, &messages[i * stride], lengths[i], packed, lengths[i] - 1);
+		total += packedLength ? packedLength : lengths[i];
+	}
+	return (double)total / BENCH_MESSAGES;
+}
+
+static bool sameRecord(const RECORD_t *a, const RECORD_t *b)
+{
+	if (a->fields != b->fields) return false;
+#define RECORD_SAME(name, kind, scale, unit) \
+	if ((a->fields & RECORD_HAS(name)) && a->name != b->name) return false;
+	RECORD_FIELDS(RECORD_SAME)
+#undef RECORD_SAME
+	return true;
+}
+
+static void testRecords(void)
+{
+	// Round trip at the edges of every kind
+	RECORD_t rec = {0};
+	RECORD_SET(&rec, device, RECORD_STICK);
+	RECORD_SET(&rec, counter, UINT32_MAX);
+	RECORD_SET(&rec, batVoltage, INT32_MIN);
+	RECORD_SET(&rec, batCurrent, INT32_MAX);
+	RECORD_SET(&rec, temperature, -1);
+	RECORD_SET(&rec, time, (int64_t)1000 << 32); // whole milliseconds survive
+	uint8_t buf[RECORD_MAX];
+	size_t length = record_encode(&rec, buf);
+	SIM_CHECK(length <= RECORD_MAX);
+	RECORD_t back;
+	SIM_CHECK(record_decode(buf, length, &back));
+	SIM_CHECK(sameRecord(&rec, &back));
+
+	// Every cut short record is refused
+	for (size_t i=0;i<length;i++) SIM_CHECK(record_decode(buf, i, &back) == false);
+	// So is one with trailing bytes
+	SIM_CHECK(record_decode(buf, length+1, &back) == false);
+
+	// Missing fields take no bytes and aren't drawn
+	RECORD_t part = {0};
+	RECORD_SET(&part, device, RECORD_STICK);
+	RECORD_SET(&part, counter, 7);
+	length = record_encode(&part, buf);
+	SIM_CHECK(length == 4);
+	SIM_CHECK(record_decode(buf, length, &back) && sameRecord(&part, &back));
+	char line[RECORD_LINE];
+	record_format(&back, line, sizeof(line));
+	SIM_CHECK(strcmp(line, "M5Stick:7") == 0);
+
+	// A field this schema doesn't know
+	uint8_t unknown[] = {RECORD_MARK, 1 << RECORD_FIELD_MAX, 0};
+	SIM_CHECK(record_decode(unknown, sizeof(unknown), &back) == false);
+	// Text is not a record
+	SIM_CHECK(record_is((const uint8_t *)"This is M5Stick:1", 17) == false);
+
+	RECORD_t full = {0};
+	RECORD_SET(&full, device, RECORD_STICKC_PLUS);
+	RECORD_SET(&full, counter, 12345);
+	RECORD_SET(&full, batVoltage, 4012);
+	RECORD_SET(&full, batCurrent, -52);
+	RECORD_SET(&full, temperature, -5);
+	RECORD_SET(&full, time, 1234567890);
+	record_format(&full, line, sizeof(line));
+	SIM_CHECK(strcmp(line, "M5StickC+:12345 4.012V -52mA -0.5C 1234s") == 0);
+	// Cut to the line, still terminated
+	char shortLine[12];
+	SIM_CHECK(record_format(&full, shortLine, sizeof(shortLine)) == sizeof(shortLine) - 1);
+	SIM_CHECK(strcmp(shortLine, "M5StickC+:1") == 0);
+}
+
+int main(int argc, char **argv)
+{
+	testRecords();
+	makeSamples();
+
+	// Sizes
+	static char text[BENCH_MESSAGES][64];
+	static size_t textLength[BENCH_MESSAGES];
+	double textBytes = 0;
+	double recordBytes = 0;
+	for (int i=0;i<BENCH_MESSAGES;i++) {
+		textLength[i] = encodeText(&samples[i], text[i], sizeof(text[i]));
+		wireLength[i] = encodeRecord(&samples[i], wire[i]);
+		textBytes += textLength[i];
+		recordBytes += wireLength[i];
+
+		// What the acceptor draws is the text the initiator used to send
+		RECORD_t rec;
+		char line[RECORD_LINE];
+		SIM_CHECK(record_decode(wire[i], wireLength[i], &rec));
+		record_format(&rec, line, sizeof(line));
+		SIM_CHECK(strcmp(line, text[i]) == 0);
+	}
+	textBytes /= BENCH_MESSAGES;
+	recordBytes /= BENCH_MESSAGES;
+	double textLz = lzBytes((const uint8_t *)text, sizeof(text[0]), textLength);
+	double recordLz = lzBytes((const uint8_t *)wire, sizeof(wire[0]), wireLength);
+
+	// Times
+	struct timespec start;
+	volatile size_t sink = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int r=0;r<BENCH_ROUNDS;r++) {
+		for (int i=0;i<BENCH_MESSAGES;i++) sink += encodeText(&samples[i], text[i], sizeof(text[i]));
+	}
+	double textEncode = nsSince(&start) / (BENCH_ROUNDS * BENCH_MESSAGES);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int r=0;r<BENCH_ROUNDS;r++) {
+		for (int i=0;i<BENCH_MESSAGES;i++) sink += encodeRecord(&samples[i], wire[i]);
+	}
+	double recordEncode = nsSince(&start) / (BENCH_ROUNDS * BENCH_MESSAGES);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int r=0;r<BENCH_ROUNDS;r++) {
+		for (int i=0;i<BENCH_MESSAGES;i++) {
+			RECORD_t rec;
+			sink += record_decode(wire[i], wireLength[i], &rec);
+		}
+	}
+	double recordDecode = nsSince(&start) / (BENCH_ROUNDS * BENCH_MESSAGES);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int r=0;r<BENCH_ROUNDS;r++) {
+		for (int i=0;i<BENCH_MESSAGES;i++) {
+			RECORD_t rec;
+			char line[RECORD_LINE];
+			record_decode(wire[i], wireLength[i], &rec);
+			sink += record_format(&rec, line, sizeof(line));
+		}
+	}
+	double recordFormat = nsSince(&start) / (BENCH_ROUNDS * BENCH_MESSAGES) - recordDecode;
+
+	printf("%-7s %7s %7s %10s %10s %10s\n", "format", "bytes", "lz", "encode(ns)", "decode", "format");
+	printf("%-7s %7.1f %7.1f %10.0f %10s %10s\n", "text", textBytes, textLz, textEncode, "-", "-");
+	printf("%-7s %7.1f %7.1f %10.0f %10.0f %10.0f\n", "record", recordBytes, recordLz, recordEncode, recordDecode, recordFormat);
+	printf("size: x%.1f smaller, x%.1f after LZ\n", textBytes / recordBytes, textLz / recordLz);
+	SIM_CHECK(recordBytes * 2 < textBytes);
+	SIM_CHECK(recordLz < textLz);
+
+	printf("%s\n", sim_failures ? "FAILED" : "PASSED");
+	return sim_failures ? 1 : 0;
+}
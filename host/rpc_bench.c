@@ -0,0 +1,189 @@
+#include <stdio.h>
+#include <string.h>
+#include "esp_timer.h"
+
+#include "link.h"
+#include "rpc.h"
+#include "spi_sim.h"
+
+// Loopback over a simulated SPP link: every request goes out through
+// link.c and comes back to the same rpc.c, which answers it and then
+// matches the response. The link delays each write by its time on air
+// plus a fixed latency, on the simulator clock.
+#define LINK_LATENCY_US 15000	// one way, typical for SPP with sniff off
+#define LINK_BYTES_PER_S 40000
+#define LINK_PACKETS 64
+
+#define BENCH_CALLS 400
+#define BENCH_ARGS 8
+
+typedef struct {
+	int64_t at;
+	size_t length;
+	uint8_t data[FRAME_HEADER + 3 + RPC_MAX_RESULT];
+} PACKET_t;
+
+static PACKET_t packets[LINK_PACKETS];
+static int pipeHead;
+static int pipeCount;
+static int64_t busyUntil;
+
+static bool pipeWrite(uint32_t handle, const uint8_t *data, size_t length)
+{
+	SIM_CHECK(pipeCount < LINK_PACKETS && length <= sizeof(packets[0].data));
+	if (pipeCount == LINK_PACKETS || length > sizeof(packets[0].data)) return false;
+	int64_t now = esp_timer_get_time();
+	if (busyUntil < now) busyUntil = now;
+	busyUntil += (int64_t)length * 1000000 / LINK_BYTES_PER_S;
+	PACKET_t *packet = &packets[(pipeHead + pipeCount) % LINK_PACKETS];
+	packet->at = busyUntil + LINK_LATENCY_US;
+	packet->length = length;
+	memcpy(packet->data, data, length);
+	pipeCount++;
+	return true;
+}
+
+static void pipeClear(void)
+{
+	pipeCount = 0;
+	busyUntil = 0;
+}
+
+// Delivers the next packet. false when nothing is on the link.
+static bool pipeDeliver(void)
+{
+	if (pipeCount == 0) return false;
+	PACKET_t packet = packets[pipeHead];
+	pipeHead = (pipeHead + 1) % LINK_PACKETS;
+	pipeCount--;
+	int64_t now = esp_timer_get_time();
+	if (packet.at > now) sim_advance_us(packet.at - now);
+	link_receive(1, packet.data, packet.length);
+	return true;
+}
+
+static void linkFrame(uint32_t handle, uint8_t type, const uint8_t *payload, size_t length)
+{
+	rpc_receive(handle, type, payload, length);
+}
+
+static int ping(const uint8_t *args, size_t length, uint8_t *result, size_t size)
+{
+	if (length > size) return -1;
+	memcpy(result, args, length);
+	return length;
+}
+
+typedef struct {
+	int64_t start;
+	uint8_t args[BENCH_ARGS];
+	rpc_status_t status;
+	bool done;
+} CALL_t;
+
+static CALL_t calls[BENCH_CALLS];
+static HIST_t latency;
+static int inflight;
+
+static void pingDone(void *ctx, rpc_method_t method, rpc_status_t status, const uint8_t *result, size_t length)
+{
+	CALL_t *call = ctx;
+	SIM_CHECK(call->done == false);
+	call->done = true;
+	call->status = status;
+	inflight--;
+	if (status != RPC_OK) return;
+	SIM_CHECK(length == BENCH_ARGS && memcmp(result, call->args, BENCH_ARGS) == 0);
+	hist_add(&latency, esp_timer_get_time() - call->start);
+}
+
+// Keeps depth calls on the link until BENCH_CALLS are answered.
+// Returns calls per second.
+static double bench(int depth)
+{
+	memset(calls, 0, sizeof(calls));
+	hist_reset(&latency);
+	inflight = 0;
+	int issued = 0;
+	int64_t start = esp_timer_get_time();
+	while (1) {
+		while (inflight < depth && issued < BENCH_CALLS) {
+			CALL_t *call = &calls[issued];
+			for (int i=0;i<BENCH_ARGS;i++) call->args[i] = issued + i;
+			call->start = esp_timer_get_time();
+			int id = rpc_call(1, RPC_PING, call->args, BENCH_ARGS, 1000, pingDone, call);
+			SIM_CHECK(id >= 0);
+			if (id < 0) break;
+			inflight++;
+			issued++;
+		}
+		if (pipeDeliver() == false) break;
+	}
+	int64_t elapsed = esp_timer_get_time() - start;
+
+	int ok = 0;
+	for (int i=0;i<BENCH_CALLS;i++) {
+		if (calls[i].done && calls[i].status == RPC_OK) ok++;
+	}
+	SIM_CHECK(ok == BENCH_CALLS);
+	double rate = elapsed ? BENCH_CALLS * 1000000.0 / elapsed : 0;
+	printf("%5d %9.1f %8u %8u %8u %8u\n", depth, rate, hist_percentile(&latency, 50),
+		hist_percentile(&latency, 90), hist_percentile(&latency, 99), latency.max);
+	return rate;
+}
+
+static void statusDone(void *ctx, rpc_method_t method, rpc_status_t status, const uint8_t *result, size_t length)
+{
+	*(rpc_status_t *)ctx = status;
+}
+
+int main(int argc, char **argv)
+{
+	link_init(LINK_CAP_LZ, pipeWrite, linkFrame);
+	rpc_register(RPC_PING, ping);
+	link_open(1);
+	while (pipeDeliver());
+	SIM_CHECK(link_framed());
+
+	printf("link: %d us one way, %d bytes/s, %d byte arguments\n", LINK_LATENCY_US, LINK_BYTES_PER_S, BENCH_ARGS);
+	printf("%5s %9s %8s %8s %8s %8s\n", "depth", "calls/s", "p50(us)", "p90", "p99", "max");
+	double serial = bench(1);
+	bench(2);
+	bench(4);
+	double pipelined = bench(RPC_MAX_PENDING);
+	printf("pipelining: x%.1f\n", pipelined / serial);
+	SIM_CHECK(pipelined > serial * 4);
+
+	HIST_t total;
+	rpc_latency(RPC_PING, &total);
+	SIM_CHECK(total.total == BENCH_CALLS * 4);
+
+	// A method without a handler
+	rpc_status_t status = RPC_OK;
+	SIM_CHECK(rpc_call(1, RPC_CONFIG, NULL, 0, 1000, statusDone, &status) >= 0);
+	while (pipeDeliver());
+	SIM_CHECK(status == RPC_UNKNOWN);
+
+	// The table holds RPC_MAX_PENDING calls
+	rpc_status_t statuses[RPC_MAX_PENDING + 1] = {RPC_OK};
+	for (int i=0;i<RPC_MAX_PENDING;i++) {
+		SIM_CHECK(rpc_call(1, RPC_PING, NULL, 0, 100 + i, statusDone, &statuses[i]) >= 0);
+	}
+	SIM_CHECK(rpc_call(1, RPC_PING, NULL, 0, 100, statusDone, &statuses[RPC_MAX_PENDING]) < 0);
+
+	// Lost requests time out one by one
+	pipeClear();
+	TickType_t wait = rpc_poll();
+	SIM_CHECK(wait > 0 && wait <= pdMS_TO_TICKS(101));
+	sim_advance_us(100500);
+	rpc_poll();
+	SIM_CHECK(statuses[0] == RPC_TIMEOUT && statuses[1] == RPC_OK);
+
+	// The rest fail when the link goes down
+	rpc_close();
+	for (int i=1;i<RPC_MAX_PENDING;i++) SIM_CHECK(statuses[i] == RPC_CLOSED);
+	SIM_CHECK(rpc_poll() == portMAX_DELAY);
+
+	printf("%s\n", sim_failures ? "FAILED" : "PASSED");
+	return sim_failures ? 1 : 0;
+}
@@ -0,0 +1,97 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/timers.h"
+#include "esp_timer.h"
+
+#include "spi_sim.h"
+
+// FreeRTOS queues and timers for the host build, in one thread.
+
+QueueHandle_t xQueueCreateStatic(UBaseType_t length, UBaseType_t itemSize, uint8_t *storage, StaticQueue_t *buffer)
+{
+	buffer->storage = storage;
+	buffer->length = length;
+	buffer->itemSize = itemSize;
+	buffer->head = 0;
+	buffer->count = 0;
+	return buffer;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks)
+{
+	if (queue->count == queue->length) return pdFALSE;
+	UBaseType_t tail = (queue->head + queue->count) % queue->length;
+	memcpy(&queue->storage[tail * queue->itemSize], item, queue->itemSize);
+	queue->count++;
+	return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks)
+{
+	if (queue->count == 0) return pdFALSE;
+	memcpy(item, &queue->storage[queue->head * queue->itemSize], queue->itemSize);
+	queue->head = (queue->head + 1) % queue->length;
+	queue->count--;
+	return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+	return queue->count;
+}
+
+static StaticTimer_t *timers;
+
+TimerHandle_t xTimerCreateStatic(const char *name, TickType_t period, UBaseType_t reload, void *id,
+	TimerCallbackFunction_t callback, StaticTimer_t *buffer)
+{
+	memset(buffer, 0, sizeof(*buffer));
+	buffer->period = period;
+	buffer->reload = reload;
+	buffer->id = id;
+	buffer->callback = callback;
+	buffer->next = timers;
+	timers = buffer;
+	return buffer;
+}
+
+BaseType_t xTimerStart(TimerHandle_t timer, TickType_t ticks)
+{
+	timer->active = true;
+	timer->due = esp_timer_get_time() + (int64_t)timer->period * portTICK_PERIOD_MS * 1000;
+	return pdPASS;
+}
+
+BaseType_t xTimerStop(TimerHandle_t timer, TickType_t ticks)
+{
+	timer->active = false;
+	return pdPASS;
+}
+
+BaseType_t xTimerChangePeriod(TimerHandle_t timer, TickType_t period, TickType_t ticks)
+{
+	timer->period = period;
+	return xTimerStart(timer, ticks);
+}
+
+BaseType_t xTimerIsTimerActive(TimerHandle_t timer)
+{
+	return timer->active;
+}
+
+int sim_run_timers(void)
+{
+	int fired = 0;
+	int64_t now = esp_timer_get_time();
+	for (StaticTimer_t *timer=timers;timer;timer=timer->next) {
+		if (timer->active == false || timer->due > now) continue;
+		if (timer->reload) timer->due += (int64_t)timer->period * portTICK_PERIOD_MS * 1000;
+		else timer->active = false;
+		timer->callback(timer);
+		fired++;
+	}
+	return fired;
+}
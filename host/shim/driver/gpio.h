@@ -0,0 +1,21 @@
+#ifndef HOST_GPIO_H_
+#define HOST_GPIO_H_
+
+#include <stdint.h>
+#include "esp_err.h"
+
+typedef int gpio_num_t;
+
+typedef enum {
+	GPIO_MODE_DISABLE = 0,
+	GPIO_MODE_INPUT = 1,
+	GPIO_MODE_OUTPUT = 2,
+	GPIO_MODE_DEF_INPUT = 1,
+} gpio_mode_t;
+
+esp_err_t gpio_reset_pin(gpio_num_t gpio_num);
+esp_err_t gpio_set_direction(gpio_num_t gpio_num, gpio_mode_t mode);
+esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level);
+int gpio_get_level(gpio_num_t gpio_num);
+
+#endif /* HOST_GPIO_H_ */
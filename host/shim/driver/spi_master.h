@@ -0,0 +1,70 @@
+#ifndef HOST_SPI_MASTER_H_
+#define HOST_SPI_MASTER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "driver/gpio.h"
+
+typedef enum {
+	SPI1_HOST = 0,
+	SPI2_HOST = 1,
+	SPI3_HOST = 2,
+} spi_host_device_t;
+
+#define HSPI_HOST SPI2_HOST
+#define SPI_DMA_CH_AUTO 3
+
+#define SPI_MASTER_FREQ_8M	(80 * 1000 * 1000 / 10)
+#define SPI_MASTER_FREQ_10M	(80 * 1000 * 1000 / 8)
+#define SPI_MASTER_FREQ_20M	(80 * 1000 * 1000 / 4)
+#define SPI_MASTER_FREQ_26M	(80 * 1000 * 1000 / 3)
+#define SPI_MASTER_FREQ_40M	(80 * 1000 * 1000 / 2)
+#define SPI_MASTER_FREQ_80M	(80 * 1000 * 1000 / 1)
+
+#define SPI_DEVICE_NO_DUMMY (1<<6)
+#define SPI_TRANS_CS_KEEP_ACTIVE (1<<8)
+
+typedef struct {
+	int mosi_io_num;
+	int miso_io_num;
+	int sclk_io_num;
+	int quadwp_io_num;
+	int quadhd_io_num;
+	int max_transfer_sz;
+	uint32_t flags;
+} spi_bus_config_t;
+
+typedef struct {
+	uint8_t command_bits;
+	uint8_t address_bits;
+	uint8_t dummy_bits;
+	uint8_t mode;
+	int clock_speed_hz;
+	int spics_io_num;
+	uint32_t flags;
+	int queue_size;
+} spi_device_interface_config_t;
+
+typedef struct {
+	uint32_t flags;
+	size_t length;
+	size_t rxlength;
+	void *user;
+	const void *tx_buffer;
+	void *rx_buffer;
+} spi_transaction_t;
+
+typedef struct spi_device_t *spi_device_handle_t;
+
+esp_err_t spi_bus_initialize(spi_host_device_t host_id, const spi_bus_config_t *bus_config, int dma_chan);
+esp_err_t spi_bus_add_device(spi_host_device_t host_id, const spi_device_interface_config_t *dev_config, spi_device_handle_t *handle);
+esp_err_t spi_bus_remove_device(spi_device_handle_t handle);
+esp_err_t spi_device_acquire_bus(spi_device_handle_t device, TickType_t wait);
+void spi_device_release_bus(spi_device_handle_t dev);
+esp_err_t spi_device_transmit(spi_device_handle_t handle, spi_transaction_t *trans_desc);
+esp_err_t spi_device_polling_transmit(spi_device_handle_t handle, spi_transaction_t *trans_desc);
+
+#endif /* HOST_SPI_MASTER_H_ */
@@ -0,0 +1,21 @@
+#ifndef HOST_ESP_ERR_H_
+#define HOST_ESP_ERR_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef int esp_err_t;
+
+#define ESP_OK		0
+#define ESP_FAIL	-1
+
+#define ESP_ERR_NVS_NOT_ENOUGH_SPACE	0x1105
+#define ESP_ERR_NVS_NOT_FOUND			0x1102
+#define ESP_ERR_NVS_KEY_TOO_LONG		0x110b
+
+static inline const char *esp_err_to_name(esp_err_t code)
+{
+	return code == ESP_OK ? "ESP_OK" : "ESP_FAIL";
+}
+
+#endif /* HOST_ESP_ERR_H_ */
@@ -0,0 +1,15 @@
+#ifndef HOST_ESP_LOG_H_
+#define HOST_ESP_LOG_H_
+
+#include <stdio.h>
+#include "esp_err.h"
+
+// Driver logging is compiled in for format checking, but never printed.
+#define ESP_LOG_SILENT(tag, format, ...) do { if (0) printf("%s " format, tag, ##__VA_ARGS__); } while(0)
+#define ESP_LOGE(tag, format, ...) ESP_LOG_SILENT(tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) ESP_LOG_SILENT(tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) ESP_LOG_SILENT(tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) ESP_LOG_SILENT(tag, format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...) ESP_LOG_SILENT(tag, format, ##__VA_ARGS__)
+
+#endif /* HOST_ESP_LOG_H_ */
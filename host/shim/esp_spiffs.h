@@ -0,0 +1,6 @@
+#ifndef HOST_ESP_SPIFFS_H_
+#define HOST_ESP_SPIFFS_H_
+
+// Fonts are read straight from the project's font directory on the host.
+
+#endif /* HOST_ESP_SPIFFS_H_ */
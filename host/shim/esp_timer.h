@@ -0,0 +1,9 @@
+#ifndef HOST_ESP_TIMER_H_
+#define HOST_ESP_TIMER_H_
+
+#include <stdint.h>
+
+// Microseconds of simulated bus time
+int64_t esp_timer_get_time(void);
+
+#endif /* HOST_ESP_TIMER_H_ */
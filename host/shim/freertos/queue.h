@@ -0,0 +1,22 @@
+#ifndef HOST_QUEUE_H_
+#define HOST_QUEUE_H_
+
+#include "freertos/FreeRTOS.h"
+
+// Copies items in and out of caller storage like the real queue.
+// One thread, so nothing ever blocks: ticks are ignored.
+typedef struct {
+	uint8_t *storage;
+	UBaseType_t length;
+	UBaseType_t itemSize;
+	UBaseType_t head;
+	UBaseType_t count;
+} StaticQueue_t;
+typedef StaticQueue_t * QueueHandle_t;
+
+QueueHandle_t xQueueCreateStatic(UBaseType_t length, UBaseType_t itemSize, uint8_t *storage, StaticQueue_t *buffer);
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks);
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks);
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue);
+
+#endif /* HOST_QUEUE_H_ */
@@ -0,0 +1,19 @@
+#ifndef HOST_TASK_H_
+#define HOST_TASK_H_
+
+#include "freertos/FreeRTOS.h"
+
+typedef void * TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+// vTaskDelay does not sleep. The simulator adds the delay to its clock.
+void vTaskDelay(TickType_t ticks);
+TickType_t xTaskGetTickCount(void);
+
+// The host build runs in one thread
+typedef int portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED 0
+#define taskENTER_CRITICAL(mux) ((void)(mux))
+#define taskEXIT_CRITICAL(mux) ((void)(mux))
+
+#endif /* HOST_TASK_H_ */
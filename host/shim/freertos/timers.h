@@ -0,0 +1,28 @@
+#ifndef HOST_TIMERS_H_
+#define HOST_TIMERS_H_
+
+#include "freertos/FreeRTOS.h"
+
+// Timers run on the simulator clock, from sim_run_timers().
+struct SIM_TIMER;
+typedef struct SIM_TIMER * TimerHandle_t;
+typedef void (*TimerCallbackFunction_t)(TimerHandle_t timer);
+
+typedef struct SIM_TIMER {
+	TickType_t period;
+	bool reload;
+	bool active;
+	int64_t due;
+	void *id;
+	TimerCallbackFunction_t callback;
+	struct SIM_TIMER *next;
+} StaticTimer_t;
+
+TimerHandle_t xTimerCreateStatic(const char *name, TickType_t period, UBaseType_t reload, void *id,
+	TimerCallbackFunction_t callback, StaticTimer_t *buffer);
+BaseType_t xTimerStart(TimerHandle_t timer, TickType_t ticks);
+BaseType_t xTimerStop(TimerHandle_t timer, TickType_t ticks);
+BaseType_t xTimerChangePeriod(TimerHandle_t timer, TickType_t period, TickType_t ticks);
+BaseType_t xTimerIsTimerActive(TimerHandle_t timer);
+
+#endif /* HOST_TIMERS_H_ */
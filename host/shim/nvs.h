@@ -0,0 +1,23 @@
+#ifndef HOST_NVS_H_
+#define HOST_NVS_H_
+
+#include <stdint.h>
+#include "esp_err.h"
+
+// u32 entries kept in memory for the life of the process
+
+typedef uint32_t nvs_handle_t;
+
+typedef enum {
+	NVS_READONLY,
+	NVS_READWRITE
+} nvs_open_mode_t;
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle);
+void nvs_close(nvs_handle_t handle);
+esp_err_t nvs_commit(nvs_handle_t handle);
+esp_err_t nvs_get_u32(nvs_handle_t handle, const char *key, uint32_t *out_value);
+esp_err_t nvs_set_u32(nvs_handle_t handle, const char *key, uint32_t value);
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key);
+
+#endif /* HOST_NVS_H_ */
@@ -0,0 +1,507 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/spi_master.h"
+#include "driver/gpio.h"
+#include "esp_timer.h"
+
+#include "spi_sim.h"
+
+#define MAX_DEVICE 4
+#define MAX_STAT 32
+#define MAX_PARAM 16
+
+struct spi_device_t {
+	bool used;
+	int clock_speed_hz;
+	int spics_io_num;
+};
+
+static struct spi_device_t devices[MAX_DEVICE];
+static bool panelAdded;
+static int panelCs;	// the first device added is the panel
+static int maxClock;
+
+static sim_protocol_t protocol;
+static int dcGpio;
+static int dcLevel;
+static int gramWidth;
+static int gramHeight;
+static int panelWidth;
+static int panelHeight;
+static int panelOffsetx;
+static int panelOffsety;
+static uint16_t *gram;
+static uint64_t clockUs;
+
+// MIPI DCS state
+static uint8_t command;
+static uint8_t params[MAX_PARAM];
+static int paramCount;
+static uint16_t xs, xe, ys, ye;
+static int cx, cy;
+static bool highByte;
+static uint8_t pixelHigh;
+static uint16_t tfa, vsa, bfa, vsp;
+static bool readDummy;
+static int readPhase;
+
+// SH1107 state
+static uint8_t pendingCommand;
+static int page;
+static int column;
+static bool inverted;
+
+static SIM_STAT_t stats[MAX_STAT];
+static int statCount;
+static SIM_STAT_t *current;
+static SIM_STAT_t other = { .name = "(other)" };
+
+int sim_failures;
+
+void sim_init(sim_protocol_t _protocol, int dc_gpio, int gram_width, int gram_height,
+	int width, int height, int offsetx, int offsety)
+{
+	sim_free();
+	protocol = _protocol;
+	dcGpio = dc_gpio;
+	dcLevel = -1;
+	gramWidth = gram_width;
+	gramHeight = gram_height;
+	panelWidth = width;
+	panelHeight = height;
+	panelOffsetx = offsetx;
+	panelOffsety = offsety;
+	gram = calloc(gram_width * gram_height, sizeof(uint16_t));
+	memset(devices, 0, sizeof(devices));
+	panelAdded = false;
+	maxClock = 0;
+	clockUs = 0;
+	command = 0;
+	paramCount = 0;
+	xs = ys = 0;
+	xe = gram_width - 1;
+	ye = gram_height - 1;
+	cx = cy = 0;
+	highByte = true;
+	tfa = bfa = vsp = 0;
+	vsa = gram_height;
+	pendingCommand = 0;
+	page = column = 0;
+	inverted = false;
+	memset(stats, 0, sizeof(stats));
+	statCount = 0;
+	current = NULL;
+	memset(&other, 0, sizeof(other));
+	other.name = "(other)";
+}
+
+void sim_free(void)
+{
+	free(gram);
+	gram = NULL;
+}
+
+// ---------------------------------------------------------------- decoding
+
+static void mipi_advance(void)
+{
+	cx++;
+	if (cx > xe) {
+		cx = xs;
+		cy++;
+		if (cy > ye) cy = ys;
+	}
+}
+
+static void mipi_pixel(uint16_t color)
+{
+	if (cx < gramWidth && cy < gramHeight) gram[cy * gramWidth + cx] = color;
+	mipi_advance();
+}
+
+// Memory Read: a dummy byte, then 6 bits of red, green and blue per pixel
+static uint8_t mipi_read(void)
+{
+	if (readDummy) {
+		readDummy = false;
+		return 0;
+	}
+	uint16_t color = (cx < gramWidth && cy < gramHeight) ? gram[cy * gramWidth + cx] : 0;
+	uint8_t data;
+	if (readPhase == 0) data = (color >> 8) & 0xF8;
+	else if (readPhase == 1) data = (color >> 3) & 0xFC;
+	else data = (color << 3) & 0xF8;
+	if (++readPhase == 3) {
+		readPhase = 0;
+		mipi_advance();
+	}
+	return data;
+}
+
+static void mipi_command(uint8_t cmd)
+{
+	command = cmd;
+	paramCount = 0;
+	if (cmd == 0x2C) {
+		cx = xs;
+		cy = ys;
+	}
+	if (cmd == 0x2C || cmd == 0x3C) highByte = true;
+	if (cmd == 0x2E) {
+		cx = xs;
+		cy = ys;
+		readDummy = true;
+		readPhase = 0;
+	}
+}
+
+static void mipi_data(uint8_t data)
+{
+	if (command == 0x2C || command == 0x3C) {
+		if (highByte) {
+			pixelHigh = data;
+		} else {
+			mipi_pixel((pixelHigh << 8) | data);
+		}
+		highByte = !highByte;
+		return;
+	}
+
+	if (paramCount < MAX_PARAM) params[paramCount] = data;
+	paramCount++;
+	if (command == 0x2A && paramCount == 4) {
+		xs = (params[0] << 8) | params[1];
+		xe = (params[2] << 8) | params[3];
+	}
+	if (command == 0x2B && paramCount == 4) {
+		ys = (params[0] << 8) | params[1];
+		ye = (params[2] << 8) | params[3];
+	}
+	if (command == 0x33 && paramCount == 6) {
+		tfa = (params[0] << 8) | params[1];
+		vsa = (params[2] << 8) | params[3];
+		bfa = (params[4] << 8) | params[5];
+	}
+	if (command == 0x37 && paramCount == 2) {
+		vsp = (params[0] << 8) | params[1];
+	}
+}
+
+static bool sh1107_has_param(uint8_t cmd)
+{
+	switch(cmd) {
+	case 0x81: case 0xA8: case 0xAD: case 0xD3: case 0xD5:
+	case 0xD9: case 0xDA: case 0xDB: case 0xDC:
+		return true;
+	}
+	return false;
+}
+
+static void sh1107_command(uint8_t cmd)
+{
+	if (pendingCommand) {
+		pendingCommand = 0;
+		return;
+	}
+	if (sh1107_has_param(cmd)) {
+		pendingCommand = cmd;
+	} else if (cmd <= 0x0F) {
+		column = (column & 0x70) | cmd;
+	} else if (cmd >= 0x10 && cmd <= 0x17) {
+		column = ((cmd & 0x07) << 4) | (column & 0x0F);
+	} else if ((cmd & 0xF0) == 0xB0) {
+		page = cmd & 0x0F;
+	} else if (cmd == 0xA6) {
+		inverted = false;
+	} else if (cmd == 0xA7) {
+		inverted = true;
+	}
+}
+
+static void sh1107_data(uint8_t data)
+{
+	for (int bit=0;bit<8;bit++) {
+		int y = page * 8 + bit;
+		if (column < gramWidth && y < gramHeight)
+			gram[y * gramWidth + column] = (data >> bit) & 1;
+	}
+	column = (column + 1) % gramWidth;
+}
+
+static void decode(const uint8_t *buf, size_t len)
+{
+	for (size_t i=0;i<len;i++) {
+		if (protocol == SIM_MIPI) {
+			if (dcLevel == 0) mipi_command(buf[i]);
+			else mipi_data(buf[i]);
+		} else {
+			if (dcLevel == 0) sh1107_command(buf[i]);
+			else sh1107_data(buf[i]);
+		}
+	}
+}
+
+// ---------------------------------------------------------------- accounting
+
+static SIM_STAT_t *stat_of(void)
+{
+	return current ? current : &other;
+}
+
+void sim_begin(const char *name)
+{
+	for (int i=0;i<statCount;i++) {
+		if (strcmp(stats[i].name, name) == 0) {
+			current = &stats[i];
+			current->calls++;
+			return;
+		}
+	}
+	if (statCount == MAX_STAT) {
+		current = NULL;
+		return;
+	}
+	current = &stats[statCount++];
+	current->name = name;
+	current->calls = 1;
+}
+
+void sim_end(void)
+{
+	current = NULL;
+}
+
+const SIM_STAT_t *sim_stat(const char *name)
+{
+	for (int i=0;i<statCount;i++) {
+		if (strcmp(stats[i].name, name) == 0) return &stats[i];
+	}
+	return NULL;
+}
+
+void sim_report(FILE *fp)
+{
+	SIM_STAT_t total = {0};
+	fprintf(fp, "%-24s %6s %8s %10s %8s %12s\n", "api", "calls", "trans", "bytes", "dc", "est_us");
+	for (int i=0;i<=statCount;i++) {
+		SIM_STAT_t *s = (i < statCount) ? &stats[i] : &other;
+		if (s->transactions == 0 && s->calls == 0) continue;
+		fprintf(fp, "%-24s %6u %8u %10u %8u %12.0f\n", s->name, s->calls, s->transactions, s->bytes, s->toggles, s->us);
+		total.transactions += s->transactions;
+		total.bytes += s->bytes;
+		total.toggles += s->toggles;
+		total.us += s->us;
+	}
+	fprintf(fp, "%-24s %6s %8u %10u %8u %12.0f\n", "total", "", total.transactions, total.bytes, total.toggles, total.us);
+}
+
+uint32_t sim_clock_us(void)
+{
+	return (uint32_t)clockUs;
+}
+
+void sim_advance_us(uint32_t us)
+{
+	clockUs += us;
+}
+
+void sim_set_max_clock(int hz)
+{
+	maxClock = hz;
+}
+
+int sim_panel_clock(void)
+{
+	for (int i=0;i<MAX_DEVICE;i++) {
+		if (devices[i].used && devices[i].spics_io_num == panelCs) return devices[i].clock_speed_hz;
+	}
+	return 0;
+}
+
+// ---------------------------------------------------------------- framebuffer
+
+uint16_t sim_gram(int x, int y)
+{
+	if (x < 0 || y < 0 || x >= gramWidth || y >= gramHeight) return 0;
+	return gram[y * gramWidth + x];
+}
+
+// Vertical scrolling maps a displayed row inside the scroll area
+// to GRAM row ((vsp - tfa + k) mod vsa) + tfa.
+// The mapping is only applied when TFA+VSA+BFA covers the GRAM, as the datasheet requires.
+static int scroll_row(int row)
+{
+	if (tfa + vsa + bfa != gramHeight || vsa == 0) return row;
+	if (row < tfa || row >= tfa + vsa) return row;
+	int k = row - tfa;
+	int start = vsp - tfa;
+	if (start < 0) start = 0;
+	return ((start + k) % vsa) + tfa;
+}
+
+uint16_t sim_pixel(int x, int y)
+{
+	if (x < 0 || y < 0 || x >= panelWidth || y >= panelHeight) return 0;
+	int gx = x + panelOffsetx;
+	int gy = y + panelOffsety;
+	if (protocol == SIM_SH1107) {
+		bool on = sim_gram(gx, gy) != 0;
+		if (inverted) on = !on;
+		return on ? 0xFFFF : 0x0000;
+	}
+	return sim_gram(gx, scroll_row(gy));
+}
+
+// FNV-1a over the visible panel
+uint32_t sim_hash(void)
+{
+	uint32_t hash = 2166136261u;
+	for (int y=0;y<panelHeight;y++) {
+		for (int x=0;x<panelWidth;x++) {
+			uint16_t pixel = sim_pixel(x, y);
+			hash = (hash ^ (pixel & 0xFF)) * 16777619u;
+			hash = (hash ^ (pixel >> 8)) * 16777619u;
+		}
+	}
+	return hash;
+}
+
+int sim_dump_ppm(const char *path)
+{
+	FILE *fp = fopen(path, "wb");
+	if (fp == NULL) return -1;
+	fprintf(fp, "P6\n%d %d\n255\n", panelWidth, panelHeight);
+	for (int y=0;y<panelHeight;y++) {
+		for (int x=0;x<panelWidth;x++) {
+			uint16_t pixel = sim_pixel(x, y);
+			uint8_t rgb[3];
+			rgb[0] = ((pixel >> 11) & 0x1F) * 255 / 31;
+			rgb[1] = ((pixel >> 5) & 0x3F) * 255 / 63;
+			rgb[2] = (pixel & 0x1F) * 255 / 31;
+			fwrite(rgb, 1, 3, fp);
+		}
+	}
+	fclose(fp);
+	return 0;
+}
+
+// ---------------------------------------------------------------- ESP-IDF replacements
+
+esp_err_t spi_bus_initialize(spi_host_device_t host_id, const spi_bus_config_t *bus_config, int dma_chan)
+{
+	return ESP_OK;
+}
+
+esp_err_t spi_bus_add_device(spi_host_device_t host_id, const spi_device_interface_config_t *dev_config, spi_device_handle_t *handle)
+{
+	for (int i=0;i<MAX_DEVICE;i++) {
+		if (devices[i].used) continue;
+		devices[i].used = true;
+		devices[i].clock_speed_hz = dev_config->clock_speed_hz;
+		devices[i].spics_io_num = dev_config->spics_io_num;
+		if (panelAdded == false) {
+			panelAdded = true;
+			panelCs = dev_config->spics_io_num;
+		}
+		*handle = &devices[i];
+		return ESP_OK;
+	}
+	return ESP_FAIL;
+}
+
+esp_err_t spi_bus_remove_device(spi_device_handle_t handle)
+{
+	handle->used = false;
+	return ESP_OK;
+}
+
+esp_err_t spi_device_acquire_bus(spi_device_handle_t handle, TickType_t wait)
+{
+	return ESP_OK;
+}
+
+void spi_device_release_bus(spi_device_handle_t handle)
+{
+}
+
+esp_err_t spi_device_transmit(spi_device_handle_t handle, spi_transaction_t *trans_desc)
+{
+	size_t bytes = trans_desc->length / 8;
+	bool panel = handle->spics_io_num == panelCs;
+	if (trans_desc->rx_buffer) {
+		size_t rxbytes = (trans_desc->rxlength ? trans_desc->rxlength : trans_desc->length) / 8;
+		uint8_t *rx = trans_desc->rx_buffer;
+		memset(rx, 0, rxbytes);
+		if (panel && protocol == SIM_MIPI && command == 0x2E) {
+			for (size_t i=0;i<rxbytes;i++) rx[i] = mipi_read();
+		}
+	}
+	if (panel && trans_desc->tx_buffer) {
+		if (maxClock && handle->clock_speed_hz > maxClock) {
+			// Too fast for the panel: it latches some bits wrong
+			uint8_t *garbled = malloc(bytes);
+			for (size_t i=0;i<bytes;i++) garbled[i] = ((const uint8_t *)trans_desc->tx_buffer)[i] ^ 0x01;
+			decode(garbled, bytes);
+			free(garbled);
+		} else {
+			decode(trans_desc->tx_buffer, bytes);
+		}
+	}
+
+	double us = SIM_TRANS_OVERHEAD_US;
+	if (handle->clock_speed_hz) us += (double)trans_desc->length * 1000000.0 / handle->clock_speed_hz;
+	SIM_STAT_t *s = stat_of();
+	s->transactions++;
+	s->bytes += bytes;
+	s->us += us;
+	clockUs += (uint64_t)us;
+	return ESP_OK;
+}
+
+esp_err_t spi_device_polling_transmit(spi_device_handle_t handle, spi_transaction_t *trans_desc)
+{
+	return spi_device_transmit(handle, trans_desc);
+}
+
+esp_err_t gpio_reset_pin(gpio_num_t gpio_num)
+{
+	return ESP_OK;
+}
+
+esp_err_t gpio_set_direction(gpio_num_t gpio_num, gpio_mode_t mode)
+{
+	return ESP_OK;
+}
+
+esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level)
+{
+	if (gpio_num == dcGpio) {
+		if (dcLevel != -1 && dcLevel != (int)level) stat_of()->toggles++;
+		dcLevel = level;
+	}
+	return ESP_OK;
+}
+
+int gpio_get_level(gpio_num_t gpio_num)
+{
+	return 1;
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+	clockUs += (uint64_t)ticks * portTICK_PERIOD_MS * 1000;
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+	return clockUs / 1000 / portTICK_PERIOD_MS;
+}
+
+int64_t esp_timer_get_time(void)
+{
+	return clockUs;
+}
@@ -0,0 +1,68 @@
+#ifndef HOST_SPI_SIM_H_
+#define HOST_SPI_SIM_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Display controller simulator for the host build.
+// It replaces spi_device_transmit/gpio_set_level/vTaskDelay, decodes the
+// byte stream the real panel drivers send and keeps a copy of the GRAM.
+// Coordinates are the ones the driver addresses (MADCTL is not modeled).
+
+typedef enum {
+	SIM_MIPI,	// ILI9340/ILI9341/ST7735S/ST7789 (0x2A/0x2B/0x2C/0x33/0x37)
+	SIM_SH1107,	// SH1107 page addressing
+} sim_protocol_t;
+
+// Fixed cost of one spi_device_transmit call (queue, CS, ISR) on the ESP32.
+#define SIM_TRANS_OVERHEAD_US 15
+
+typedef struct {
+	const char *name;
+	uint32_t calls;
+	uint32_t transactions;
+	uint32_t bytes;
+	uint32_t toggles;	// DC line changes
+	double us;			// estimated bus time
+} SIM_STAT_t;
+
+// gram_width/gram_height: controller memory size
+// width/height/offsetx/offsety: the visible panel inside the GRAM
+void sim_init(sim_protocol_t protocol, int dc_gpio, int gram_width, int gram_height,
+	int width, int height, int offsetx, int offsety);
+void sim_free(void);
+
+// Visible pixel after vertical scrolling, in panel coordinates.
+// SH1107 returns 0xFFFF for a lit pixel and 0x0000 otherwise.
+uint16_t sim_pixel(int x, int y);
+uint16_t sim_gram(int x, int y);
+uint32_t sim_hash(void);
+int sim_dump_ppm(const char *path);
+
+// Attribute the following bus traffic to a driver API.
+void sim_begin(const char *name);
+void sim_end(void);
+const SIM_STAT_t *sim_stat(const char *name);
+void sim_report(FILE *fp);
+uint32_t sim_clock_us(void);
+// Moves the clock behind esp_timer_get_time forward, e.g. for a simulated link
+void sim_advance_us(uint32_t us);
+// Fires the FreeRTOS timers that are due on that clock. Returns how many.
+int sim_run_timers(void);
+
+// Writes to the panel above hz reach the GRAM with bit 0 of every byte flipped.
+// 0 removes the limit.
+void sim_set_max_clock(int hz);
+int sim_panel_clock(void);
+
+extern int sim_failures;
+
+#define SIM_CHECK(cond) do { \
+	if (!(cond)) { \
+		printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+		sim_failures++; \
+	} \
+} while(0)
+
+#endif /* HOST_SPI_SIM_H_ */